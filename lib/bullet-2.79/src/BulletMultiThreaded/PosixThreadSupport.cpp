@@ -47,9 +47,6 @@ PosixThreadSupport::~PosixThreadSupport()
 #define NAMED_SEMAPHORES
 #endif
 
-// this semaphore will signal, if and how many threads are finished with their work
-static sem_t* mainSemaphore=0;
-
 static sem_t* createSem(const char* baseName)
 {
 	static int semCount = 0;
@@ -103,19 +100,17 @@ static void *threadFunction(void *argument)
 			btAssert(status->m_status);
 			status->m_userThreadFunc(userPtr,status->m_lsMemory);
 			status->m_status = 2;
-			checkPThreadFunction(sem_post(mainSemaphore));
+			checkPThreadFunction(sem_post(status->mainSemaphore));
 	                status->threadUsed++;
 		} else {
 			//exit Thread
 			status->m_status = 3;
-			checkPThreadFunction(sem_post(mainSemaphore));
-			printf("Thread with taskId %i exiting\n",status->m_taskId);
+			checkPThreadFunction(sem_post(status->mainSemaphore));
 			break;
 		}
 		
 	}
 
-	printf("Thread TERMINATED\n");
 	return 0;
 
 }
@@ -168,7 +163,7 @@ void PosixThreadSupport::waitForResponse(unsigned int *puiArgument0, unsigned in
 	btAssert(m_activeSpuStatus.size());
 
         // wait for any of the threads to finish
-	checkPThreadFunction(sem_wait(mainSemaphore));
+	checkPThreadFunction(sem_wait(m_mainSemaphore));
         
 	// get at least one thread which has finished
         size_t last = -1;
@@ -196,21 +191,16 @@ void PosixThreadSupport::waitForResponse(unsigned int *puiArgument0, unsigned in
 
 void PosixThreadSupport::startThreads(ThreadConstructionInfo& threadConstructionInfo)
 {
-        printf("%s creating %i threads.\n", __FUNCTION__, threadConstructionInfo.m_numThreads);
 	m_activeSpuStatus.resize(threadConstructionInfo.m_numThreads);
         
-	mainSemaphore = createSem("main");                
-	//checkPThreadFunction(sem_wait(mainSemaphore));
+	m_mainSemaphore = createSem("main");                
    
 	for (int i=0;i < threadConstructionInfo.m_numThreads;i++)
 	{
-		printf("starting thread %d\n",i);
-
 		btSpuStatus&	spuStatus = m_activeSpuStatus[i];
 
 		spuStatus.startSemaphore = createSem("threadLocal");                
-                
-                checkPThreadFunction(pthread_create(&spuStatus.thread, NULL, &threadFunction, (void*)&spuStatus));
+		spuStatus.mainSemaphore = m_mainSemaphore;
 
 		spuStatus.m_userPtr=0;
 
@@ -221,8 +211,8 @@ void PosixThreadSupport::startThreads(ThreadConstructionInfo& threadConstruction
 		spuStatus.m_userThreadFunc = threadConstructionInfo.m_userThreadFunc;
         spuStatus.threadUsed = 0;
 
-		printf("started thread %d \n",i);
-		
+		// the status must be fully initialized before the thread reads it
+                checkPThreadFunction(pthread_create(&spuStatus.thread, NULL, &threadFunction, (void*)&spuStatus));
 	}
 
 }
@@ -238,20 +228,21 @@ void PosixThreadSupport::stopSPU()
 	for(size_t t=0; t < size_t(m_activeSpuStatus.size()); ++t) 
 	{
             btSpuStatus&	spuStatus = m_activeSpuStatus[t];
-            printf("%s: Thread %i used: %ld\n", __FUNCTION__, int(t), spuStatus.threadUsed);
 
 	spuStatus.m_userPtr = 0;       
  	checkPThreadFunction(sem_post(spuStatus.startSemaphore));
-	checkPThreadFunction(sem_wait(mainSemaphore));
+	checkPThreadFunction(sem_wait(m_mainSemaphore));
 
-	printf("destroy semaphore\n"); 
-            destroySem(spuStatus.startSemaphore);
-            printf("semaphore destroyed\n");
 		checkPThreadFunction(pthread_join(spuStatus.thread,0));
+            destroySem(spuStatus.startSemaphore);
         }
-	printf("destroy main semaphore\n");
-        destroySem(mainSemaphore);
-	printf("main semaphore destroyed\n");
+	// stopSPU is called both by SpuCollisionTaskProcess and by our destructor;
+	// only tear down the semaphore once
+	if (m_mainSemaphore)
+	{
+		destroySem(m_mainSemaphore);
+		m_mainSemaphore = 0;
+	}
 	m_activeSpuStatus.clear();
 }
 
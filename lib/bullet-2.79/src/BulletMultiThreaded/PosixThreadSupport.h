@@ -61,12 +61,16 @@ public:
 
                 pthread_t thread;
                 sem_t* startSemaphore;
+                sem_t* mainSemaphore; //owned by the PosixThreadSupport, shared by all of its threads
 
         unsigned long threadUsed;
 	};
 private:
 
 	btAlignedObjectArray<btSpuStatus>	m_activeSpuStatus;
+	// signalled by the worker threads when they finish a task.
+	// per instance, so that several thread supports can coexist in one process
+	sem_t*	m_mainSemaphore;
 public:
 	///Setup and initialize SPU/CELL/Libspe2
 
@@ -96,13 +96,11 @@ btScalar* identityIfBad(btScalar m[16]) { //doesn't fix segfaults, unfortunately
 }
 
 void BulletObject::destroy() {
+    getEnvironment()->bullet->forgetAabbDirty(rigidBody.get());
     getEnvironment()->bullet->dynamicsWorld->removeRigidBody(rigidBody.get());
 }
 
 BulletObject::BulletObject(const BulletObject &o) : isKinematic(o.isKinematic) {
-    // we need to access lots of private members of btRigidBody and etc
-    // the easiest way to do this is to use serialization
-
     // first copy over the collisionShape. This isn't a real deep copy,
     // but we can share collisionShapes so this should be fine
     collisionShape = o.collisionShape;
@@ -110,81 +108,24 @@ BulletObject::BulletObject(const BulletObject &o) : isKinematic(o.isKinematic) {
     // then copy the motionstate
     motionState = o.motionState->clone(*this);
 
-    // then serialize the rigid body
-    boost::shared_ptr<btDefaultSerializer> serializer(new btDefaultSerializer());
-    int len; btChunk *chunk; const char *structType;
-    // http://www.bulletphysics.com/Bullet/BulletFull/btDiscreteDynamicsWorld_8cpp_source.html#l01147
-    serializer->startSerialization();
-        // rigid body
-        len = o.rigidBody->calculateSerializeBufferSize();
-        chunk = serializer->allocate(len, 1);
-        structType = o.rigidBody->serialize(chunk->m_oldPtr, serializer.get());
-        serializer->finalizeChunk(chunk, structType, BT_RIGIDBODY_CODE, o.rigidBody.get());
-        // collision shape
-//        len = collisionShape->calculateSerializeBufferSize();
-//        chunk = serializer->allocate(len, 1);
-//        structType = collisionShape->serialize(chunk->m_oldPtr, serializer.get());
-//        serializer->finalizeChunk(chunk, structType, BT_SHAPE_CODE, collisionShape);
-        // TODO: constraints?
-    serializer->finishSerialization();
-
-    // read the data that the serializer just wrote
-    int bufSize = serializer->getCurrentBufferSize();
-    boost::scoped_array<char> buf(new char[bufSize]);
-    memcpy(buf.get(), serializer->getBufferPointer(), bufSize);
-    boost::shared_ptr<bParse::btBulletFile> bulletFile(
-        new bParse::btBulletFile(buf.get(), bufSize));
-    bulletFile->parse(false);
-    // create a new rigidBody with the data
-    BOOST_ASSERT(bulletFile->m_rigidBodies.size() == 1);
-    if (bulletFile->getFlags() & bParse::FD_DOUBLE_PRECISION) {
-        // double precision not supported
-        BOOST_ASSERT(false);
-    } else {
-        // single precision
-        btRigidBodyFloatData *data = reinterpret_cast<btRigidBodyFloatData *> (bulletFile->m_rigidBodies[0]);
-        btScalar mass = btScalar(data->m_inverseMass? 1.f/data->m_inverseMass : 0.f);
-        btVector3 localInertia; localInertia.setZero();
-        btTransform startTransform;
-        startTransform.deSerializeFloat(data->m_collisionObjectData.m_worldTransform);
-        //	startTransform.setBasis(btMatrix3x3::getIdentity());
-        if (collisionShape->isNonMoving())
-            mass = 0.f;
-        if (mass)
-            collisionShape->calculateLocalInertia(mass, localInertia);
-
-        // fill in btRigidBody params
-        btRigidBody::btRigidBodyConstructionInfo ci(mass, motionState.get(), collisionShape.get(), localInertia);
-        ci.m_linearDamping = data->m_linearDamping;
-        ci.m_angularDamping = data->m_angularDamping;
-        ci.m_additionalDampingFactor = data->m_additionalDampingFactor;
-        ci.m_additionalLinearDampingThresholdSqr = data->m_additionalLinearDampingThresholdSqr;
-        ci.m_additionalAngularDampingThresholdSqr = data->m_additionalAngularDampingThresholdSqr;
-        ci.m_additionalAngularDampingFactor = data->m_additionalAngularDampingFactor;
-        ci.m_linearSleepingThreshold = data->m_linearSleepingThreshold;
-        ci.m_angularSleepingThreshold = data->m_angularSleepingThreshold;
-        ci.m_additionalDamping = data->m_additionalDamping;
-        rigidBody.reset(new btRigidBody(ci));
-
-        // extra "active" params
-        rigidBody->setLinearVelocity(o.rigidBody->getLinearVelocity());
-        rigidBody->setAngularVelocity(o.rigidBody->getAngularVelocity());
-        rigidBody->applyCentralForce(o.rigidBody->getTotalForce());
-        rigidBody->applyTorque(o.rigidBody->getTotalTorque());
-
-        // fill in btCollisionObject params for the rigid body
-        btCollisionObject *colObj = rigidBody.get();
-        btCollisionObjectFloatData &colObjData = data->m_collisionObjectData;
-        btVector3 temp;
-        temp.deSerializeFloat(colObjData.m_anisotropicFriction);
-        colObj->setAnisotropicFriction(temp);
-        colObj->setContactProcessingThreshold(colObjData.m_contactProcessingThreshold);
-        colObj->setFriction(colObjData.m_friction);
-        colObj->setRestitution(colObjData.m_restitution);
-        colObj->setCollisionFlags(colObjData.m_collisionFlags);
-        colObj->setHitFraction(colObjData.m_hitFraction);
-        colObj->setActivationState(colObjData.m_activationState1);
-    }
+    // then clone the rigid body. btRigidBody's implicit copy constructor copies
+    // every field (mass props, damping, sleeping thresholds, velocities, forces,
+    // material, flags) in whatever precision btScalar is; afterwards we only
+    // have to reset the fields that tie the original to its world.
+    btRigidBody *rb = new btRigidBody(*o.rigidBody);
+    rigidBody.reset(rb);
+    rb->setBroadphaseHandle(NULL);
+    rb->setIslandTag(-1);
+    rb->setCompanionId(-1);
+    rb->setUserPointer(NULL);
+    // constraints in the new world add their own references
+    while (rb->getNumConstraintRefs())
+        rb->removeConstraintRef(rb->getConstraintRef(0));
+    // setMotionState overwrites the transforms from the motion state, which can
+    // lag behind the body when it is interpolated
+    rb->setMotionState(motionState.get());
+    rb->setWorldTransform(o.rigidBody->getWorldTransform());
+    rb->setInterpolationWorldTransform(o.rigidBody->getInterpolationWorldTransform());
 }
 
 
@@ -26,6 +26,8 @@ public:
             // if we want to do collision detection in between timesteps,
             // we also have to directly set this
             obj.rigidBody->setCenterOfMassTransform(pos);
+            if (obj.getEnvironment())
+                obj.getEnvironment()->bullet->markAabbDirty(obj.rigidBody.get());
         }
 
         Ptr clone(BulletObject &newObj);
@@ -54,7 +56,9 @@ public:
     BulletObject(btScalar mass, btCollisionShape *cs, const btTransform &initTrans, bool isKinematic_=false);
     BulletObject(btScalar mass, boost::shared_ptr<btCollisionShape> cs, const btTransform &initTrans, bool isKinematic_=false);
 
-    BulletObject(const BulletObject &o); // copy constructor
+    // copy constructor. shares the collision shape and clones the rigid body
+    // field by field (no serialization)
+    BulletObject(const BulletObject &o);
     virtual ~BulletObject();
     EnvironmentObject::Ptr copy(Fork &f) const {
         Ptr o(new BulletObject(*this));
@@ -0,0 +1,97 @@
+// Microbenchmark for BulletObject cloning (the per-body cost of forking).
+// Compares the field-wise clone in BulletObject's copy constructor against
+// the btDefaultSerializer + btBulletFile round-trip it replaced.
+// usage: bench_clone [numBodies] [numRepeats]
+#include "basicobjects.h"
+#include <Serialize/BulletFileLoader/btBulletFile.h>
+#include <boost/scoped_array.hpp>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+
+static double now() {
+    timeval t; gettimeofday(&t, NULL);
+    return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+#ifndef BT_USE_DOUBLE_PRECISION
+// the old clone path, kept here as the baseline
+static btRigidBody *serializerClone(const btRigidBody &o, btMotionState *ms, btCollisionShape *cs) {
+    boost::shared_ptr<btDefaultSerializer> serializer(new btDefaultSerializer());
+    serializer->startSerialization();
+    int len = o.calculateSerializeBufferSize();
+    btChunk *chunk = serializer->allocate(len, 1);
+    const char *structType = o.serialize(chunk->m_oldPtr, serializer.get());
+    serializer->finalizeChunk(chunk, structType, BT_RIGIDBODY_CODE, (void *) &o);
+    serializer->finishSerialization();
+
+    int bufSize = serializer->getCurrentBufferSize();
+    boost::scoped_array<char> buf(new char[bufSize]);
+    memcpy(buf.get(), serializer->getBufferPointer(), bufSize);
+    boost::shared_ptr<bParse::btBulletFile> bulletFile(new bParse::btBulletFile(buf.get(), bufSize));
+    bulletFile->parse(false);
+
+    btRigidBodyFloatData *data = reinterpret_cast<btRigidBodyFloatData *> (bulletFile->m_rigidBodies[0]);
+    btScalar mass = btScalar(data->m_inverseMass? 1.f/data->m_inverseMass : 0.f);
+    btVector3 localInertia(0, 0, 0);
+    if (mass)
+        cs->calculateLocalInertia(mass, localInertia);
+    btRigidBody::btRigidBodyConstructionInfo ci(mass, ms, cs, localInertia);
+    ci.m_linearDamping = data->m_linearDamping;
+    ci.m_angularDamping = data->m_angularDamping;
+    ci.m_additionalDampingFactor = data->m_additionalDampingFactor;
+    ci.m_additionalLinearDampingThresholdSqr = data->m_additionalLinearDampingThresholdSqr;
+    ci.m_additionalAngularDampingThresholdSqr = data->m_additionalAngularDampingThresholdSqr;
+    ci.m_additionalAngularDampingFactor = data->m_additionalAngularDampingFactor;
+    ci.m_linearSleepingThreshold = data->m_linearSleepingThreshold;
+    ci.m_angularSleepingThreshold = data->m_angularSleepingThreshold;
+    ci.m_additionalDamping = data->m_additionalDamping;
+    btRigidBody *rb = new btRigidBody(ci);
+    rb->setLinearVelocity(o.getLinearVelocity());
+    rb->setAngularVelocity(o.getAngularVelocity());
+    btCollisionObjectFloatData &colObjData = data->m_collisionObjectData;
+    btVector3 temp;
+    temp.deSerializeFloat(colObjData.m_anisotropicFriction);
+    rb->setAnisotropicFriction(temp);
+    rb->setContactProcessingThreshold(colObjData.m_contactProcessingThreshold);
+    rb->setFriction(colObjData.m_friction);
+    rb->setRestitution(colObjData.m_restitution);
+    rb->setCollisionFlags(colObjData.m_collisionFlags);
+    rb->setHitFraction(colObjData.m_hitFraction);
+    rb->setActivationState(colObjData.m_activationState1);
+    return rb;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    int numBodies = argc > 1 ? atoi(argv[1]) : 1000;
+    int numRepeats = argc > 2 ? atoi(argv[2]) : 10;
+
+    std::vector<BulletObject::Ptr> objs;
+    for (int i = 0; i < numBodies; ++i) {
+        btTransform t(btQuaternion::getIdentity(), btVector3(i, 0, 1));
+        objs.push_back(BulletObject::Ptr(new BoxObject(1, btVector3(.1, .1, .1), t)));
+        objs.back()->rigidBody->setLinearVelocity(btVector3(0, 0, -i));
+    }
+
+    double t0 = now();
+    for (int r = 0; r < numRepeats; ++r)
+        for (int i = 0; i < numBodies; ++i)
+            BulletObject copy(*objs[i]);
+    double fieldwise = (now() - t0) / (numRepeats*numBodies);
+    printf("field-wise clone: %8.0f ns/body\n", fieldwise*1e9);
+
+#ifndef BT_USE_DOUBLE_PRECISION
+    t0 = now();
+    for (int r = 0; r < numRepeats; ++r)
+        for (int i = 0; i < numBodies; ++i) {
+            btDefaultMotionState ms(objs[i]->rigidBody->getCenterOfMassTransform());
+            delete serializerClone(*objs[i]->rigidBody, &ms, objs[i]->collisionShape.get());
+        }
+    double serialized = (now() - t0) / (numRepeats*numBodies);
+    printf("serializer clone: %8.0f ns/body (%.1fx)\n", serialized*1e9, serialized/fieldwise);
+#else
+    printf("serializer clone: not supported in double precision\n");
+#endif
+    return 0;
+}
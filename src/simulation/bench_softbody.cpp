@@ -0,0 +1,107 @@
+// Benchmark for the soft body solvers on the tetgen clothing meshes.
+// Drops each mesh onto a plane and times the steps with btDefaultSoftBodySolver,
+// ParallelSoftBodySolver and ParallelSoftBodySolver with the SSE kernels.
+// usage: bench_softbody [numSteps] [numThreads] [mesh prefix (without .node/.ele/.face) ...]
+#include "environment.h"
+#include "soft_body_solver.h"
+#include <BulletSoftBody/btSoftBodyHelpers.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+static double now() {
+    timeval t; gettimeofday(&t, NULL);
+    return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+static std::string readFile(const std::string &path) {
+    std::ifstream f(path.c_str());
+    if (!f) {
+        fprintf(stderr, "can't read %s\n", path.c_str());
+        exit(1);
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+struct Mesh {
+    std::string name, ele, face, node;
+};
+
+// seconds per step; nodes receives the final node positions
+static double run(const Mesh &mesh, int numSteps, int numThreads, bool simd, std::vector<btVector3> &nodes) {
+    BulletInstance bullet(0, 0, numThreads, simd);
+    btStaticPlaneShape planeShape(btVector3(0, 0, 1), 0);
+    btRigidBody plane(0, NULL, &planeShape);
+    bullet.dynamicsWorld->addRigidBody(&plane);
+
+    btSoftBody *psb = btSoftBodyHelpers::CreateFromTetGenData(*bullet.softBodyWorldInfo,
+        mesh.ele.c_str(), mesh.face.c_str(), mesh.node.c_str(), false, true, true);
+    // iteration counts of makeCloth
+    psb->m_cfg.piterations = 50;
+    psb->m_cfg.citerations = 50;
+    psb->m_cfg.diterations = 50;
+    psb->setTotalMass(1);
+    psb->translate(btVector3(0, 0, 1));
+    bullet.dynamicsWorld->addSoftBody(psb);
+
+    double t0 = now();
+    for (int i = 0; i < numSteps; ++i)
+        bullet.dynamicsWorld->stepSimulation(1/60., 0);
+    double elapsed = now() - t0;
+
+    nodes.resize(psb->m_nodes.size());
+    for (int i = 0; i < psb->m_nodes.size(); ++i)
+        nodes[i] = psb->m_nodes[i].m_x;
+    printf("  %d nodes, %d links\n", psb->m_nodes.size(), psb->m_links.size());
+    bullet.dynamicsWorld->removeSoftBody(psb);
+    delete psb;
+    bullet.dynamicsWorld->removeRigidBody(&plane);
+    return elapsed / numSteps;
+}
+
+static btScalar maxDeviation(const std::vector<btVector3> &a, const std::vector<btVector3> &b) {
+    btScalar d = 0;
+    for (int i = 0; i < a.size(); ++i)
+        d = btMax(d, a[i].distance(b[i]));
+    return d;
+}
+
+int main(int argc, char *argv[]) {
+    int numSteps = argc > 1 ? atoi(argv[1]) : 200;
+    int numThreads = argc > 2 ? atoi(argv[2]) : 1;
+    std::vector<std::string> prefixes;
+    for (int i = 3; i < argc; ++i)
+        prefixes.push_back(argv[i]);
+    if (prefixes.empty()) {
+        prefixes.push_back(STRINGIFY(BULLETSIM_DATA_DIR) "/clothing/shirt.1");
+        prefixes.push_back(STRINGIFY(BULLETSIM_DATA_DIR) "/clothing/pants_final.1");
+    }
+
+    for (int m = 0; m < prefixes.size(); ++m) {
+        Mesh mesh;
+        mesh.name = prefixes[m];
+        mesh.ele = readFile(prefixes[m] + ".ele");
+        mesh.face = readFile(prefixes[m] + ".face");
+        mesh.node = readFile(prefixes[m] + ".node");
+        printf("%s, %d steps, %d threads\n", mesh.name.c_str(), numSteps, numThreads);
+
+        std::vector<btVector3> reference, nodes;
+        double serial = run(mesh, numSteps, 0, false, reference);
+        printf("default solver:  %8.3f ms/step\n", serial*1e3);
+        double parallel = run(mesh, numSteps, numThreads, false, nodes);
+        printf("parallel:        %8.3f ms/step (%.2fx), max deviation %g\n",
+               parallel*1e3, serial/parallel, maxDeviation(reference, nodes));
+        double simd = run(mesh, numSteps, numThreads, true, nodes);
+        printf("parallel + simd: %8.3f ms/step (%.2fx), max deviation %g\n",
+               simd*1e3, serial/simd, maxDeviation(reference, nodes));
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Timing test for the soft body topology tables on the tetgen clothing meshes.
+// Builds the tetrahedron/face/node tables of each mesh with soft_body_topology
+// and with the former pairwise face comparisons, checks that both agree and
+// prints the times.
+// usage: bench_topology [mesh prefix (without .node/.ele/.face) ...]
+#include "soft_body_topology.h"
+#include <BulletSoftBody/btSoftBodyHelpers.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+static double now() {
+    timeval t; gettimeofday(&t, NULL);
+    return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+static string readFile(const string &path) {
+    ifstream f(path.c_str());
+    if (!f) {
+        fprintf(stderr, "can't read %s\n", path.c_str());
+        exit(1);
+    }
+    stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+struct Tables {
+    btSoftBody::tFaceArray faces;
+    vector<vector<int> > face2tetras, tetra2faces, node2faces, face2nodes;
+};
+
+static bool sameFace(const btSoftBody::Face &f0, const btSoftBody::Face &f1) {
+    for (int c = 0; c < 3; ++c)
+        if (f0.m_n[c] != f1.m_n[0] && f0.m_n[c] != f1.m_n[1] && f0.m_n[c] != f1.m_n[2])
+            return false;
+    return true;
+}
+
+// the tables as BulletSoftObject used to compute them: every face of every
+// tetrahedron is compared with all the faces found before, and every node
+// with all the faces
+static void quadraticTables(const btSoftBody *psb, Tables &tables) {
+    const btSoftBody::tTetraArray &tetras = psb->m_tetras;
+    tables.tetra2faces = vector<vector<int> >(tetras.size());
+    for (int t = 0; t < tetras.size(); ++t) {
+        for (int c = 0; c < 4; ++c) {
+            for (int d = c+1; d < 4; ++d) {
+                for (int e = d+1; e < 4; ++e) {
+                    btSoftBody::Face face;
+                    face.m_n[0] = tetras[t].m_n[c];
+                    face.m_n[1] = tetras[t].m_n[d];
+                    face.m_n[2] = tetras[t].m_n[e];
+                    int j;
+                    for (j = 0; j < tables.faces.size(); ++j)
+                        if (sameFace(face, tables.faces[j])) break;
+                    if (j == tables.faces.size()) {
+                        tables.faces.push_back(face);
+                        tables.face2tetras.push_back(vector<int>());
+                    }
+                    tables.face2tetras[j].push_back(t);
+                    tables.tetra2faces[t].push_back(j);
+                }
+            }
+        }
+    }
+    const btSoftBody::tNodeArray &nodes = psb->m_nodes;
+    tables.node2faces = vector<vector<int> >(nodes.size());
+    tables.face2nodes = vector<vector<int> >(tables.faces.size(), vector<int>(3, -1));
+    for (int i = 0; i < nodes.size(); ++i) {
+        for (int j = 0; j < tables.faces.size(); ++j) {
+            for (int c = 0; c < 3; ++c) {
+                if (&nodes[i] == tables.faces[j].m_n[c]) {
+                    tables.node2faces[i].push_back(j);
+                    tables.face2nodes[j][c] = i;
+                }
+            }
+        }
+    }
+}
+
+static void linearTables(const btSoftBody *psb, Tables &tables) {
+    computeTetraFaces(psb, tables.faces, tables.face2tetras, tables.tetra2faces);
+    computeNodeFaceMapping(psb, tables.faces, tables.node2faces, tables.face2nodes);
+}
+
+// the surface faces may have been flipped by computeTetraFaces, so the faces
+// are compared as node sets
+static bool agree(const Tables &a, const Tables &b) {
+    if (a.faces.size() != b.faces.size()) return false;
+    for (int j = 0; j < a.faces.size(); ++j)
+        if (!sameFace(a.faces[j], b.faces[j])) return false;
+    return a.face2tetras == b.face2tetras && a.tetra2faces == b.tetra2faces && a.node2faces == b.node2faces;
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> prefixes;
+    for (int i = 1; i < argc; ++i)
+        prefixes.push_back(argv[i]);
+    if (prefixes.empty()) {
+        prefixes.push_back(STRINGIFY(BULLETSIM_DATA_DIR) "/clothing/shirt.1");
+        prefixes.push_back(STRINGIFY(BULLETSIM_DATA_DIR) "/clothing/pants_final.1");
+    }
+
+    btSoftBodyWorldInfo worldInfo;
+    bool ok = true;
+    for (int m = 0; m < prefixes.size(); ++m) {
+        const string ele = readFile(prefixes[m] + ".ele"), face = readFile(prefixes[m] + ".face"), node = readFile(prefixes[m] + ".node");
+        btSoftBody *psb = btSoftBodyHelpers::CreateFromTetGenData(worldInfo,
+            ele.c_str(), face.c_str(), node.c_str(), false, true, true);
+        printf("%s: %d nodes, %d tetras\n", prefixes[m].c_str(), psb->m_nodes.size(), psb->m_tetras.size());
+
+        Tables quadratic, linear;
+        double t0 = now();
+        quadraticTables(psb, quadratic);
+        double t1 = now();
+        linearTables(psb, linear);
+        double t2 = now();
+        const bool same = agree(quadratic, linear);
+        ok = ok && same;
+        printf("  pairwise: %9.3f ms\n  hashed:   %9.3f ms (%.0fx), %d faces, %s\n",
+               (t1-t0)*1e3, (t2-t1)*1e3, (t1-t0)/(t2-t1), linear.faces.size(), same ? "tables agree" : "TABLES DIFFER");
+        delete psb;
+    }
+    return ok ? 0 : 1;
+}
@@ -2,6 +2,9 @@
 #include "logging.h"
 
 #include "rope.h"
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <set>
 
 namespace bs {
 
@@ -42,10 +45,14 @@ string toStr(const btVector3 &v) {
 template<typename T>
 struct type_traits {
   static const char* npname;
+  static const char bufformat; // struct module code used by the buffer protocol
 };
 template<> const char* type_traits<float>::npname = "float32";
 template<> const char* type_traits<int>::npname = "int32";
 template<> const char* type_traits<double>::npname = "float64";
+template<> const char type_traits<float>::bufformat = 'f';
+template<> const char type_traits<int>::bufformat = 'i';
+template<> const char type_traits<double>::bufformat = 'd';
 
 template <typename T>
 T* getPointer(const py::object& arr) {
@@ -54,6 +61,46 @@ T* getPointer(const py::object& arr) {
   return p;
 }
 
+// Borrows the memory of a caller-provided array through the buffer protocol,
+// for the Get*Into functions that fill an existing array instead of allocating.
+// The array must be C-contiguous, writable, of element type T and of exactly
+// the given shape; nothing is converted or copied.
+template<typename T>
+class WritableBuffer {
+public:
+  WritableBuffer(py::object arr, int ndim, const Py_ssize_t* shape) {
+    if (PyObject_GetBuffer(arr.ptr(), &m_view, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE | PyBUF_FORMAT) != 0) {
+      PyErr_Clear();
+      throw std::runtime_error("expected a writable C-contiguous array");
+    }
+    const char* fmt = m_view.format ? m_view.format : "B";
+    char code = fmt[strlen(fmt) - 1]; // skip byte order prefix
+    if (m_view.itemsize != sizeof(T) || code != type_traits<T>::bufformat) {
+      PyBuffer_Release(&m_view);
+      throw std::runtime_error((boost::format("expected array of type %s, got format '%s'") % type_traits<T>::npname % fmt).str());
+    }
+    bool shapeOk = m_view.ndim == ndim;
+    for (int i = 0; shapeOk && i < ndim; ++i) {
+      shapeOk = m_view.shape[i] == shape[i];
+    }
+    if (!shapeOk) {
+      PyBuffer_Release(&m_view);
+      stringstream ss;
+      ss << "expected array of shape (";
+      for (int i = 0; i < ndim; ++i) ss << (i ? ", " : "") << shape[i];
+      ss << ")";
+      throw std::runtime_error(ss.str());
+    }
+  }
+  ~WritableBuffer() { PyBuffer_Release(&m_view); }
+  T* data() { return (T*) m_view.buf; }
+
+private:
+  Py_buffer m_view;
+  WritableBuffer(const WritableBuffer&);
+  WritableBuffer& operator=(const WritableBuffer&);
+};
+
 template<typename T>
 py::object toNdarray1(const T* data, size_t dim0) {
   py::object out = numpy.attr("empty")(py::make_tuple(dim0), type_traits<T>::npname);
@@ -228,15 +275,49 @@ btTransform toBtTransform(py::object py_hmat, btScalar scale=1) {
   return t;
 }
 
-template<typename KeyT, typename ValueT>
-ValueT &findOrFail(map<KeyT, ValueT> &m, const KeyT &key, const string &error_str="") {
-  typename map<KeyT, ValueT>::iterator i = m.find(key);
+// releases the GIL for the lifetime of the object. no python objects may be
+// touched while it is alive
+class ScopedGILRelease {
+public:
+  ScopedGILRelease() : m_state(PyEval_SaveThread()) { }
+  ~ScopedGILRelease() { PyEval_RestoreThread(m_state); }
+private:
+  PyThreadState* m_state;
+};
+
+// row-major 4x4 homogeneous matrix
+static void toHmat(const btTransform& t, btScalar* out) {
+  for (int j = 0; j < 3; ++j) {
+    for (int k = 0; k < 3; ++k) {
+      out[4*j + k] = t.getBasis().getRow(j).m_floats[k];
+    }
+    out[4*j + 3] = t.getOrigin().m_floats[j];
+  }
+  out[12] = out[13] = out[14] = 0.;
+  out[15] = 1.;
+}
+
+template<typename MapT>
+typename MapT::mapped_type &findOrFail(MapT &m, const typename MapT::key_type &key, const string &error_str="") {
+  typename MapT::iterator i = m.find(key);
   if (i == m.end()) {
     throw std::runtime_error(error_str);
   }
   return i->second;
 }
 
+static RaveLinkObject* getLinkObjectOrFail(const btCollisionObject *obj) {
+  RaveLinkObject *link = getRaveLinkObject(obj);
+  if (!link) {
+    throw std::runtime_error("collision object doesn't belong to an OpenRAVE link");
+  }
+  return link;
+}
+
+static KinBody::LinkPtr getLinkOrFail(const btCollisionObject *obj) {
+  return getLinkObjectOrFail(obj)->link;
+}
+
 
 EnvironmentBasePtr GetCppEnv(py::object py_env) {
   int id = py::extract<int>(openravepy.attr("RaveGetEnvironmentId")(py_env));
@@ -280,6 +361,12 @@ py::object BulletObject::py_GetTransform() {
   return toNdarray2(mat, 4, 4).attr("T");
 }
 
+void BulletObject::py_GetTransformInto(py::object out) {
+  const Py_ssize_t shape[] = {4, 4};
+  WritableBuffer<btScalar> buf(out, 2, shape);
+  toHmat(GetTransform(), buf.data());
+}
+
 void BulletObject::SetTransform(const btTransform& t) {
   //m_obj->children[0]->rigidBody->setCenterOfMassTransform(m_obj->toWorldFrame(t));
   m_obj->children[0]->motionState->setKinematicPos(m_obj->toWorldFrame(t));
@@ -331,6 +418,46 @@ CollisionPtr Collision::Flipped() const {
   return CollisionPtr(new Collision(linkB, linkA, ptB, ptA, -normalB2A, distance, weight));
 }
 
+void CollisionArrays::clear() {
+  bodyIds.clear();
+  linkIndices.clear();
+  ptA.clear();
+  ptB.clear();
+  normalB2A.clear();
+  distance.clear();
+  weight.clear();
+}
+
+static void pushBack(vector<btScalar>& v, const btVector3& x) {
+  v.push_back(x.x());
+  v.push_back(x.y());
+  v.push_back(x.z());
+}
+
+void CollisionArrays::add(const RaveLinkObject* linkA, const RaveLinkObject* linkB, const btVector3& ptA_, const btVector3& ptB_, const btVector3& normalB2A_, btScalar distance_, btScalar weight_) {
+  bodyIds.push_back(linkA->link->GetParent()->GetEnvironmentId());
+  bodyIds.push_back(linkB->link->GetParent()->GetEnvironmentId());
+  linkIndices.push_back(linkA->link->GetIndex());
+  linkIndices.push_back(linkB->link->GetIndex());
+  pushBack(ptA, ptA_);
+  pushBack(ptB, ptB_);
+  pushBack(normalB2A, normalB2A_);
+  distance.push_back(distance_);
+  weight.push_back(weight_);
+}
+
+py::object CollisionArrays::py_ToDict() const {
+  py::dict out;
+  out["bodyIds"] = toNdarray2(bodyIds.data(), size(), 2);
+  out["linkIndices"] = toNdarray2(linkIndices.data(), size(), 2);
+  out["ptA"] = toNdarray2(ptA.data(), size(), 3);
+  out["ptB"] = toNdarray2(ptB.data(), size(), 3);
+  out["normalB2A"] = toNdarray2(normalB2A.data(), size(), 3);
+  out["distance"] = toNdarray1(distance.data(), size());
+  out["weight"] = toNdarray1(weight.data(), size());
+  return out;
+}
+
 
 RayCollision::RayCollision(const btVector3& rayFrom_, const btVector3& rayTo_, const KinBody::LinkPtr link_, const btVector3& pt_, const btVector3& normal_, double closestHitFraction_) :
     rayFrom(rayFrom_),
@@ -357,7 +484,17 @@ SimulationParams::SimulationParams()
     friction(.5),
     restitution(0),
     margin(.0005),
-    linkPadding(0)
+    linkPadding(0),
+    hullCache(true),
+    convexDecomposition(false),
+    decompositionConcavity(.05),
+    maxHullVertices(0),
+    numDispatcherThreads(0),
+    numSolverThreads(0),
+    numSoftBodyThreads(0),
+    softBodySimd(false),
+    numQueryThreads(0),
+    numLoadThreads(0)
 { }
 
 void SimulationParams::Apply() {
@@ -370,10 +507,21 @@ void SimulationParams::Apply() {
   BulletConfig::restitution = restitution;
   BulletConfig::margin = margin;
   BulletConfig::linkPadding = linkPadding;
+  BulletConfig::hullCache = hullCache;
+  BulletConfig::convexDecomposition = convexDecomposition;
+  BulletConfig::decompositionConcavity = decompositionConcavity;
+  BulletConfig::maxHullVertices = maxHullVertices;
+  BulletConfig::numDispatcherThreads = numDispatcherThreads;
+  BulletConfig::numSolverThreads = numSolverThreads;
+  BulletConfig::numSoftBodyThreads = numSoftBodyThreads;
+  BulletConfig::softBodySimd = softBodySimd;
+  BulletConfig::numQueryThreads = numQueryThreads;
+  BulletConfig::numLoadThreads = numLoadThreads;
 }
 
 void BulletEnvironment::init(EnvironmentBasePtr rave_env, const vector<string>& dynamic_obj_names) {
   GetSimParams()->Apply();
+  m_numQueryThreads = BulletConfig::numQueryThreads;
   BulletInstance::Ptr bullet(new BulletInstance);
   m_env.reset(new Environment(bullet));
   m_rave.reset(new RaveInstance(rave_env));
@@ -394,21 +542,25 @@ BulletEnvironment::~BulletEnvironment() {
   LOG_DEBUG("py bullet env destroyed");
 }
 
+RaveObject::Ptr BulletEnvironment::findObject(const string &name) {
+  return boost::dynamic_pointer_cast<RaveObject>(m_env->getObjectByName(name));
+}
+
 BulletObjectPtr BulletEnvironment::GetObjectByName(const string &name) {
-  return BulletObjectPtr(new BulletObject(getObjectByName(m_env, m_rave, name)));
+  return BulletObjectPtr(new BulletObject(findObject(name)));
 }
 
 BulletObjectPtr BulletEnvironment::GetObjectFromKinBody(KinBodyPtr kb) {
   if (RaveGetEnvironmentId(kb->GetEnv()) != RaveGetEnvironmentId(m_rave->env)) {
     throw std::runtime_error("trying to get Bullet object for a KinBody that doesn't belong to this (OpenRAVE base) environment");
   }
-  return BulletObjectPtr(new BulletObject(getObjectByName(m_env, m_rave, kb->GetName())));
+  return GetObjectByName(kb->GetName());
 }
 BulletObjectPtr BulletEnvironment::py_GetObjectFromKinBody(py::object py_kb) {
   if (openravepy.attr("RaveGetEnvironmentId")(py_kb.attr("GetEnv")()) != RaveGetEnvironmentId(m_rave->env)) {
     throw std::runtime_error("trying to get Bullet object for a KinBody that doesn't belong to this (OpenRAVE base) environment");
   }
-  return BulletObjectPtr(new BulletObject(getObjectByName(m_env, m_rave, GetCppKinBody(py_kb, m_rave->env)->GetName())));
+  return GetObjectByName(GetCppKinBody(py_kb, m_rave->env)->GetName());
 }
 
 vector<BulletObjectPtr> BulletEnvironment::GetObjects() {
@@ -429,6 +581,57 @@ vector<BulletObjectPtr> BulletEnvironment::GetDynamicObjects() {
   return out;
 }
 
+vector<BulletObjectPtr> BulletEnvironment::toObjVec(py::list py_objs) {
+  int n = py::len(py_objs);
+  vector<BulletObjectPtr> out(n);
+  for (int i = 0; i < n; ++i) {
+    py::extract<BulletObjectPtr> get_obj(py_objs[i]);
+    if (get_obj.check()) {
+      out[i] = get_obj();
+    } else {
+      string name = py::extract<string>(py_objs[i]);
+      RaveObject::Ptr obj = findObject(name);
+      if (!obj) {
+        throw std::runtime_error((boost::format("object %s not in bullet env") % name).str());
+      }
+      out[i].reset(new BulletObject(obj));
+    }
+  }
+  return out;
+}
+
+void BulletEnvironment::GetTransforms(const vector<BulletObjectPtr>& objs, btScalar* out) {
+  for (int i = 0; i < objs.size(); ++i) {
+    toHmat(objs[i]->GetTransform(), out + 16*i);
+  }
+}
+
+void BulletEnvironment::SetTransforms(const vector<BulletObjectPtr>& objs, const btScalar* hmats) {
+  for (int i = 0; i < objs.size(); ++i) {
+    const btScalar* m = hmats + 16*i;
+    btTransform t(btMatrix3x3(m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10]), btVector3(m[3], m[7], m[11]));
+    objs[i]->SetTransform(t);
+  }
+}
+
+py::object BulletEnvironment::py_GetTransforms(py::list py_objs) {
+  vector<BulletObjectPtr> objs = toObjVec(py_objs);
+  py::object out = numpy.attr("empty")(py::make_tuple(objs.size(), 4, 4), type_traits<btScalar>::npname);
+  GetTransforms(objs, getPointer<btScalar>(out));
+  return out;
+}
+
+void BulletEnvironment::py_SetTransforms(py::list py_objs, py::object py_hmats) {
+  vector<BulletObjectPtr> objs = toObjVec(py_objs);
+  py::object hmats = ensureFormat<btScalar>(py_hmats);
+  py::object shape = hmats.attr("shape");
+  if (py::len(shape) != 3 || py::extract<size_t>(shape[0]) != objs.size()
+      || py::extract<size_t>(shape[1]) != 4 || py::extract<size_t>(shape[2]) != 4) {
+    throw std::runtime_error((boost::format("expected array of shape (%d, 4, 4)") % objs.size()).str());
+  }
+  SetTransforms(objs, getPointer<btScalar>(hmats));
+}
+
 EnvironmentBasePtr BulletEnvironment::GetRaveEnv() {
   return m_rave->env;
 }
@@ -473,12 +676,12 @@ vector<CollisionPtr> BulletEnvironment::DetectAllCollisions() {
     btPersistentManifold* contactManifold = dispatcher->getManifoldByIndexInternal(i);
     int numContacts = contactManifold->getNumContacts();
     LOG_DEBUG_FMT("number of contacts in manifold %i: %i", i, numContacts);
-    btRigidBody *objA = static_cast<btRigidBody *>(contactManifold->getBody0());
-    btRigidBody *objB = static_cast<btRigidBody *>(contactManifold->getBody1());
+    const btCollisionObject *objA = static_cast<const btCollisionObject *>(contactManifold->getBody0());
+    const btCollisionObject *objB = static_cast<const btCollisionObject *>(contactManifold->getBody1());
     for (int j = 0; j < numContacts; ++j) {
       btManifoldPoint& pt = contactManifold->getContactPoint(j);
-      KinBody::LinkPtr linkA = findOrFail(m_rave->bulletsim2rave_links, objA);
-      KinBody::LinkPtr linkB = findOrFail(m_rave->bulletsim2rave_links, objB);
+      KinBody::LinkPtr linkA = getLinkOrFail(objA);
+      KinBody::LinkPtr linkB = getLinkOrFail(objB);
       collisions.push_back(CollisionPtr(new Collision(
         linkA, linkB, pt.getPositionWorldOnA()/METERS, pt.getPositionWorldOnB()/METERS,
         pt.m_normalWorldOnB/METERS, pt.m_distance1/METERS, 1./numContacts)));
@@ -499,10 +702,8 @@ vector<CollisionPtr> BulletEnvironment::ContactTest(BulletObjectPtr obj) {
     btScalar addSingleResult(btManifoldPoint &pt,
                              const btCollisionObject *colObj0, int, int,
                              const btCollisionObject *colObj1, int, int) {
-      btRigidBody *objA = const_cast<btRigidBody *>(static_cast<const btRigidBody *>(colObj0));
-      btRigidBody *objB = const_cast<btRigidBody *>(static_cast<const btRigidBody *>(colObj1));
-      KinBody::LinkPtr linkA = findOrFail(m_rave->bulletsim2rave_links, objA);
-      KinBody::LinkPtr linkB = findOrFail(m_rave->bulletsim2rave_links, objB);
+      KinBody::LinkPtr linkA = getLinkOrFail(colObj0);
+      KinBody::LinkPtr linkB = getLinkOrFail(colObj1);
       m_out.push_back(CollisionPtr(new Collision(
         linkA, linkB, pt.getPositionWorldOnA()/METERS, pt.getPositionWorldOnB()/METERS,
         pt.m_normalWorldOnB/METERS, pt.m_distance1/METERS, 1.)));
@@ -511,6 +712,7 @@ vector<CollisionPtr> BulletEnvironment::ContactTest(BulletObjectPtr obj) {
   } cb(out, m_rave);
 
   // do contact test for all links of obj
+  m_env->bullet->updateDirtyAabbs();
   RaveObject::ChildVector& obj_children = obj->m_obj->getChildren();
   for (int i = 0; i < obj_children.size(); ++i) {
     m_env->bullet->dynamicsWorld->contactTest(obj_children[i]->rigidBody.get(), cb);
@@ -519,6 +721,56 @@ vector<CollisionPtr> BulletEnvironment::ContactTest(BulletObjectPtr obj) {
   return out;
 }
 
+void BulletEnvironment::DetectAllCollisionsFlat(CollisionArrays& out) {
+  btCollisionDispatcher *dispatcher = m_env->bullet->dispatcher;
+  int numManifolds = dispatcher->getNumManifolds();
+  for (int i = 0; i < numManifolds; ++i) {
+    btPersistentManifold* contactManifold = dispatcher->getManifoldByIndexInternal(i);
+    int numContacts = contactManifold->getNumContacts();
+    if (numContacts == 0) continue;
+    const RaveLinkObject *linkA = getLinkObjectOrFail(static_cast<const btCollisionObject *>(contactManifold->getBody0()));
+    const RaveLinkObject *linkB = getLinkObjectOrFail(static_cast<const btCollisionObject *>(contactManifold->getBody1()));
+    for (int j = 0; j < numContacts; ++j) {
+      btManifoldPoint& pt = contactManifold->getContactPoint(j);
+      out.add(linkA, linkB, pt.getPositionWorldOnA()/METERS, pt.getPositionWorldOnB()/METERS,
+        pt.m_normalWorldOnB/METERS, pt.m_distance1/METERS, 1./numContacts);
+    }
+  }
+}
+
+void BulletEnvironment::ContactTestFlat(BulletObjectPtr obj, CollisionArrays& out) {
+  struct ContactCallback : public btCollisionWorld::ContactResultCallback {
+    CollisionArrays &m_out;
+    ContactCallback(CollisionArrays &out_) : m_out(out_) { }
+    btScalar addSingleResult(btManifoldPoint &pt,
+                             const btCollisionObject *colObj0, int, int,
+                             const btCollisionObject *colObj1, int, int) {
+      m_out.add(getLinkObjectOrFail(colObj0), getLinkObjectOrFail(colObj1),
+        pt.getPositionWorldOnA()/METERS, pt.getPositionWorldOnB()/METERS,
+        pt.m_normalWorldOnB/METERS, pt.m_distance1/METERS, 1.);
+      return 0;
+    }
+  } cb(out);
+
+  m_env->bullet->updateDirtyAabbs();
+  RaveObject::ChildVector& obj_children = obj->m_obj->getChildren();
+  for (int i = 0; i < obj_children.size(); ++i) {
+    m_env->bullet->dynamicsWorld->contactTest(obj_children[i]->rigidBody.get(), cb);
+  }
+}
+
+py::object BulletEnvironment::py_DetectAllCollisionsFlat() {
+  m_collisionArrays.clear();
+  DetectAllCollisionsFlat(m_collisionArrays);
+  return m_collisionArrays.py_ToDict();
+}
+
+py::object BulletEnvironment::py_ContactTestFlat(BulletObjectPtr obj) {
+  m_collisionArrays.clear();
+  ContactTestFlat(obj, m_collisionArrays);
+  return m_collisionArrays.py_ToDict();
+}
+
 vector<RayCollisionPtr> BulletEnvironment::RayTest(const vector<btVector3>& rayFroms, const vector<btVector3>& rayTos, BulletObjectPtr obj) {
   vector<RayCollisionPtr> ray_collisions;
 
@@ -558,7 +810,7 @@ vector<RayCollisionPtr> BulletEnvironment::RayTest(const vector<btVector3>& rayF
         const btTransform& transform = obj_children[j]->rigidBody->getCenterOfMassTransform(); // in bullet scale
         btCollisionWorld::rayTestSingle(rayFromTrans, rayToTrans, rigidBody, collisionShape, transform, resultCallback);
         if (resultCallback.hasHit()) {
-          KinBody::LinkPtr link = findOrFail(m_rave->bulletsim2rave_links, dynamic_cast<btRigidBody*>(resultCallback.m_collisionObject));
+          KinBody::LinkPtr link = getLinkOrFail(resultCallback.m_collisionObject);
           // for some reason resultCallback.m_collisionObject is not the same as rigidBody sometimes
           ray_collisions.push_back(RayCollisionPtr(new RayCollision(
               resultCallback.m_rayFromWorld/METERS,
@@ -581,6 +833,267 @@ vector<RayCollisionPtr> BulletEnvironment::py_RayTest(py::object py_rayFroms, py
   return RayTest(rayFroms, rayTos, obj);
 }
 
+void BulletEnvironment::RayTestBatch(BulletObjectPtr obj, int n, const btScalar* rayFroms, const btScalar* rayTos,
+                                     int* linkIndices, btScalar* pts, btScalar* normals, btScalar* fractions) {
+  RayCaster::Ptr& caster = m_rayCasters[obj->m_obj.get()];
+  if (!caster) {
+    RaveObject::ChildVector& children = obj->m_obj->getChildren();
+    vector<btCollisionObject*> colObjs(children.size());
+    for (int i = 0; i < children.size(); ++i) {
+      colObjs[i] = children[i]->rigidBody.get();
+    }
+    caster.reset(new RayCaster(colObjs, queryPool()));
+  }
+  caster->cast(n, rayFroms, rayTos, linkIndices, pts, normals, fractions, METERS);
+  // the caster reports positions in the children, which skip links without geometry
+  RaveObject::ChildVector& children = obj->m_obj->getChildren();
+  for (int i = 0; i < n; ++i) {
+    if (linkIndices[i] >= 0) linkIndices[i] = children[linkIndices[i]]->link->GetIndex();
+  }
+}
+
+py::object BulletEnvironment::py_RayTestBatch(py::object py_rayFroms, py::object py_rayTos, BulletObjectPtr obj) {
+  vector<btScalar> rayFroms, rayTos;
+  size_t n, dim1, n2, dim1_2;
+  fromNdarray2(py_rayFroms, rayFroms, n, dim1);
+  fromNdarray2(py_rayTos, rayTos, n2, dim1_2);
+  if (dim1 != 3 || dim1_2 != 3 || n != n2) {
+    throw std::runtime_error((boost::format("expected two (N,3) arrays, got (%d,%d) and (%d,%d)") % n % dim1 % n2 % dim1_2).str());
+  }
+  py::object linkIndices = numpy.attr("empty")(py::make_tuple(n), type_traits<int>::npname);
+  py::object pts = numpy.attr("empty")(py::make_tuple(n, 3), type_traits<btScalar>::npname);
+  py::object normals = numpy.attr("empty")(py::make_tuple(n, 3), type_traits<btScalar>::npname);
+  py::object fractions = numpy.attr("empty")(py::make_tuple(n), type_traits<btScalar>::npname);
+  int* pLinkIndices = getPointer<int>(linkIndices);
+  btScalar *pPts = getPointer<btScalar>(pts), *pNormals = getPointer<btScalar>(normals), *pFractions = getPointer<btScalar>(fractions);
+  {
+    ScopedGILRelease nogil;
+    RayTestBatch(obj, n, rayFroms.data(), rayTos.data(), pLinkIndices, pPts, pNormals, pFractions);
+  }
+  py::dict out;
+  out["linkIndices"] = linkIndices;
+  out["pt"] = pts;
+  out["normal"] = normals;
+  out["fraction"] = fractions;
+  return out;
+}
+
+void BulletEnvironment::RenderDepth(const btTransform& camToWorld, float fx, float fy, float cx, float cy, int width, int height, float* out) {
+  if (!m_depthRenderer) {
+    m_depthRenderer.reset(new DepthRenderer(queryPool()));
+  }
+  btTransform t = camToWorld;
+  t.getOrigin() *= METERS;
+  m_depthRenderer->render(m_env->bullet->dynamicsWorld, t, fx, fy, cx, cy, width, height, out, METERS);
+}
+
+py::object BulletEnvironment::py_RenderDepth(py::object py_intrinsics, py::object py_pose, int width, int height) {
+  vector<btScalar> K; size_t dim0, dim1;
+  fromNdarray2(py_intrinsics, K, dim0, dim1);
+  if (dim0 != 3 || dim1 != 3) {
+    throw std::runtime_error((boost::format("expected 3x3 camera matrix, got %dx%d") % dim0 % dim1).str());
+  }
+  if (width <= 0 || height <= 0) {
+    throw std::runtime_error((boost::format("invalid image size %dx%d") % width % height).str());
+  }
+  btTransform camToWorld = toBtTransform(py_pose);
+  py::object out = numpy.attr("empty")(py::make_tuple(height, width), type_traits<float>::npname);
+  float* pout = getPointer<float>(out);
+  {
+    ScopedGILRelease nogil;
+    RenderDepth(camToWorld, K[0], K[4], K[2], K[5], width, height, pout);
+  }
+  return out;
+}
+
+ThreadPool::Ptr BulletEnvironment::queryPool() {
+  if (!m_queryPool) {
+    int numThreads = m_numQueryThreads > 0 ? m_numQueryThreads : std::max(1u, boost::thread::hardware_concurrency());
+    m_queryPool.reset(new ThreadPool(numThreads));
+  }
+  return m_queryPool;
+}
+
+void BulletEnvironment::distancePairs(const vector<BulletObjectPtr>& objsA, const vector<BulletObjectPtr>& objsB, vector<DistanceQuery::ObjectPair>& pairs) {
+  std::set<DistanceQuery::ObjectPair> seen;
+  for (int a = 0; a < objsA.size(); ++a) {
+    RaveObject::ChildVector& childrenA = objsA[a]->m_obj->getChildren();
+    for (int b = 0; b < objsB.size(); ++b) {
+      if (objsA[a]->m_obj == objsB[b]->m_obj) continue;
+      RaveObject::ChildVector& childrenB = objsB[b]->m_obj->getChildren();
+      for (int i = 0; i < childrenA.size(); ++i) {
+        for (int j = 0; j < childrenB.size(); ++j) {
+          btCollisionObject *colA = childrenA[i]->rigidBody.get(), *colB = childrenB[j]->rigidBody.get();
+          if (!seen.insert(DistanceQuery::ObjectPair(std::min(colA, colB), std::max(colA, colB))).second) continue;
+          pairs.push_back(DistanceQuery::ObjectPair(colA, colB));
+        }
+      }
+    }
+  }
+}
+
+void BulletEnvironment::ComputeDistancesFlat(const vector<BulletObjectPtr>& objsA, const vector<BulletObjectPtr>& objsB, btScalar maxDist, CollisionArrays& out) {
+  if (!m_distanceQuery) {
+    m_distanceQuery.reset(new DistanceQuery(queryPool()));
+  }
+  vector<DistanceQuery::ObjectPair> pairs;
+  distancePairs(objsA, objsB, pairs);
+  vector<DistanceQuery::Result> results;
+  m_distanceQuery->compute(pairs, maxDist * METERS, results);
+  for (int i = 0; i < results.size(); ++i) {
+    const DistanceQuery::Result& r = results[i];
+    out.add(getLinkObjectOrFail(pairs[r.pair].first), getLinkObjectOrFail(pairs[r.pair].second),
+      r.ptA/METERS, r.ptB/METERS, r.normalB2A/METERS, r.distance/METERS, 1.);
+  }
+}
+
+vector<CollisionPtr> BulletEnvironment::ComputeDistances(const vector<BulletObjectPtr>& objsA, const vector<BulletObjectPtr>& objsB, btScalar maxDist) {
+  if (!m_distanceQuery) {
+    m_distanceQuery.reset(new DistanceQuery(queryPool()));
+  }
+  vector<DistanceQuery::ObjectPair> pairs;
+  distancePairs(objsA, objsB, pairs);
+  vector<DistanceQuery::Result> results;
+  m_distanceQuery->compute(pairs, maxDist * METERS, results);
+  vector<CollisionPtr> out;
+  out.reserve(results.size());
+  for (int i = 0; i < results.size(); ++i) {
+    const DistanceQuery::Result& r = results[i];
+    out.push_back(CollisionPtr(new Collision(
+      getLinkOrFail(pairs[r.pair].first), getLinkOrFail(pairs[r.pair].second),
+      r.ptA/METERS, r.ptB/METERS, r.normalB2A/METERS, r.distance/METERS, 1.)));
+  }
+  return out;
+}
+
+vector<CollisionPtr> BulletEnvironment::py_ComputeDistances(py::list py_objsA, py::list py_objsB, btScalar maxDist) {
+  vector<BulletObjectPtr> objsA = toObjVec(py_objsA), objsB = toObjVec(py_objsB);
+  ScopedGILRelease nogil;
+  return ComputeDistances(objsA, objsB, maxDist);
+}
+
+py::object BulletEnvironment::py_ComputeDistancesFlat(py::list py_objsA, py::list py_objsB, btScalar maxDist) {
+  vector<BulletObjectPtr> objsA = toObjVec(py_objsA), objsB = toObjVec(py_objsB);
+  m_collisionArrays.clear();
+  {
+    ScopedGILRelease nogil;
+    ComputeDistancesFlat(objsA, objsB, maxDist, m_collisionArrays);
+  }
+  return m_collisionArrays.py_ToDict();
+}
+
+void BulletEnvironment::CastContinuous(BulletObjectPtr obj, const vector<int>& dofIndices, int n, const btScalar* startDofs, const btScalar* endDofs, vector<ContinuousCaster::Hit>& hits) {
+  RaveObject::Ptr raveObj = obj->m_obj;
+  const vector<int>& moved = raveObj->childrenMovedBy(dofIndices);
+  RaveObject::ChildVector& children = raveObj->getChildren();
+  int m = moved.size(), k = dofIndices.size();
+  vector<btTransform> from(n * m), to(n * m);
+  raveObj->movedChildPoses(dofIndices, n, vector<dReal>(startDofs, startDofs + n * k).data(), from.data());
+  raveObj->movedChildPoses(dofIndices, n, vector<dReal>(endDofs, endDofs + n * k).data(), to.data());
+
+  vector<btCollisionObject*> moving(m);
+  for (int i = 0; i < m; ++i) {
+    moving[i] = children[moved[i]]->rigidBody.get();
+  }
+  vector<const btCollisionObject*> ignored;
+  for (int i = 0; i < children.size(); ++i) {
+    ignored.push_back(children[i]->rigidBody.get());
+  }
+  raveObj->getIgnoredObstacles(ignored);
+  if (!m_continuousCaster) {
+    m_continuousCaster.reset(new ContinuousCaster(queryPool()));
+  }
+  hits.resize(n);
+  m_env->bullet->updateDirtyAabbs();
+  m_continuousCaster->cast(m_env->bullet->dynamicsWorld, moving, ignored, n, from.data(), to.data(), hits.data());
+  // the caster indexes the moved links only
+  for (int s = 0; s < n; ++s) {
+    if (hits[s].object >= 0) hits[s].object = moved[hits[s].object];
+  }
+}
+
+py::object BulletEnvironment::py_CastContinuous(BulletObjectPtr obj, py::list py_dofIndices, py::object py_startDofs, py::object py_endDofs) {
+  vector<int> dofIndices(py::len(py_dofIndices));
+  for (int j = 0; j < dofIndices.size(); ++j) {
+    dofIndices[j] = py::extract<int>(py_dofIndices[j]);
+  }
+  vector<btScalar> startDofs, endDofs;
+  size_t n, dim1, n2, dim1_2;
+  fromNdarray2(py_startDofs, startDofs, n, dim1);
+  fromNdarray2(py_endDofs, endDofs, n2, dim1_2);
+  if (dim1 != dofIndices.size() || dim1_2 != dofIndices.size() || n != n2) {
+    throw std::runtime_error((boost::format("expected two (N,%d) arrays, got (%d,%d) and (%d,%d)") % dofIndices.size() % n % dim1 % n2 % dim1_2).str());
+  }
+  vector<ContinuousCaster::Hit> hits;
+  {
+    ScopedGILRelease nogil;
+    CastContinuous(obj, dofIndices, n, startDofs.data(), endDofs.data(), hits);
+  }
+
+  py::object fraction = numpy.attr("empty")(py::make_tuple(n), type_traits<btScalar>::npname);
+  py::object linkIndex = numpy.attr("empty")(py::make_tuple(n), type_traits<int>::npname);
+  py::object obstacleBodyId = numpy.attr("empty")(py::make_tuple(n), type_traits<int>::npname);
+  py::object obstacleLinkIndex = numpy.attr("empty")(py::make_tuple(n), type_traits<int>::npname);
+  py::object pts = numpy.attr("empty")(py::make_tuple(n, 3), type_traits<btScalar>::npname);
+  py::object normals = numpy.attr("empty")(py::make_tuple(n, 3), type_traits<btScalar>::npname);
+  btScalar *pFraction = getPointer<btScalar>(fraction), *pPts = getPointer<btScalar>(pts), *pNormals = getPointer<btScalar>(normals);
+  int *pLinkIndex = getPointer<int>(linkIndex), *pBodyId = getPointer<int>(obstacleBodyId), *pObstacleLink = getPointer<int>(obstacleLinkIndex);
+  RaveObject::ChildVector& children = obj->m_obj->getChildren();
+  for (int s = 0; s < n; ++s) {
+    const ContinuousCaster::Hit& hit = hits[s];
+    const RaveLinkObject* obstacle = hit.obstacle ? getRaveLinkObject(hit.obstacle) : NULL;
+    pFraction[s] = hit.fraction;
+    pLinkIndex[s] = hit.object >= 0 ? children[hit.object]->link->GetIndex() : -1;
+    pBodyId[s] = obstacle ? obstacle->link->GetParent()->GetEnvironmentId() : -1;
+    pObstacleLink[s] = obstacle ? obstacle->link->GetIndex() : -1;
+    btVector3 pt = hit.point / METERS;
+    for (int j = 0; j < 3; ++j) {
+      pPts[3*s + j] = pt[j];
+      pNormals[3*s + j] = hit.normal[j];
+    }
+  }
+  py::dict out;
+  out["fraction"] = fraction;
+  out["linkIndex"] = linkIndex;
+  out["obstacleBodyId"] = obstacleBodyId;
+  out["obstacleLinkIndex"] = obstacleLinkIndex;
+  out["pt"] = pts;
+  out["normal"] = normals;
+  return out;
+}
+
+void BulletEnvironment::FilterCollisionFree(BulletObjectPtr obj, const vector<int>& dofIndices, int n, const btScalar* dofs, vector<bool>& free) {
+  if (!m_poseChecker) {
+    m_poseChecker.reset(new PoseChecker(queryPool()));
+  }
+  vector<dReal> vals(dofs, dofs + n * dofIndices.size());
+  obj->m_obj->filterCollisionFree(dofIndices, n, vals.data(), *m_poseChecker, free);
+}
+
+py::object BulletEnvironment::py_FilterCollisionFree(BulletObjectPtr obj, py::list py_dofIndices, py::object py_dofs) {
+  vector<int> dofIndices(py::len(py_dofIndices));
+  for (int j = 0; j < dofIndices.size(); ++j) {
+    dofIndices[j] = py::extract<int>(py_dofIndices[j]);
+  }
+  vector<btScalar> dofs;
+  size_t n, dim1;
+  fromNdarray2(py_dofs, dofs, n, dim1);
+  if (dim1 != dofIndices.size()) {
+    throw std::runtime_error((boost::format("expected an (N,%d) array, got (%d,%d)") % dofIndices.size() % n % dim1).str());
+  }
+  vector<bool> free;
+  {
+    ScopedGILRelease nogil;
+    FilterCollisionFree(obj, dofIndices, n, dofs.data(), free);
+  }
+  py::object out = numpy.attr("empty")(py::make_tuple(n), "bool");
+  bool* pOut = getPointer<bool>(out);
+  for (int s = 0; s < n; ++s) {
+    pOut[s] = free[s];
+  }
+  return out;
+}
+
 void BulletEnvironment::SetContactDistance(double dist) {
   LOG_DEBUG_FMT("setting contact distance to %.2f", dist);
   //m_contactDistance = dist;
@@ -655,6 +1168,9 @@ void BulletEnvironment::RemoveConstraint(BulletConstraint::Ptr cnt) {
 }
 
 void BulletEnvironment::Remove(BulletObjectPtr obj) {
+  m_rayCasters.erase(obj->m_obj.get());
+  if (m_depthRenderer) m_depthRenderer->clearShapeCache();
+  if (m_distanceQuery) m_distanceQuery->clearCache();
   m_env->remove(obj->m_obj);
 }
 
@@ -662,6 +1178,121 @@ void BulletEnvironment::Add(BulletObjectPtr obj) {
   m_env->add(obj->m_obj);
 }
 
+EnvironmentState::Ptr BulletEnvironment::SaveState() {
+  return m_env->saveState();
+}
+
+void BulletEnvironment::RestoreState(EnvironmentState::Ptr state) {
+  m_env->restoreState(*state);
+}
+
+
+EnvironmentBatch::EnvironmentBatch(EnvironmentBasePtr rave_env, const vector<string>& dynamic_obj_names, int numEnvs, int numThreads) {
+  init(rave_env, dynamic_obj_names, numEnvs, numThreads);
+}
+
+EnvironmentBatch::EnvironmentBatch(py::object py_rave_env, py::list dynamic_obj_names, int numEnvs, int numThreads) {
+  init(GetCppEnv(py_rave_env), toStrVec(dynamic_obj_names), numEnvs, numThreads);
+}
+
+void EnvironmentBatch::init(EnvironmentBasePtr rave_env, const vector<string>& dynamic_obj_names, int numEnvs, int numThreads) {
+  if (numEnvs <= 0) {
+    throw std::runtime_error((boost::format("EnvironmentBatch needs at least one environment, got %d") % numEnvs).str());
+  }
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, boost::thread::hardware_concurrency());
+  }
+  m_envs.reserve(numEnvs);
+  for (int i = 0; i < numEnvs; ++i) {
+    m_envs.push_back(BulletEnvironmentPtr(new BulletEnvironment(rave_env, dynamic_obj_names)));
+  }
+  m_pool.reset(new ThreadPool(std::min(numThreads, numEnvs)));
+}
+
+int EnvironmentBatch::GetNumEnvironments() {
+  return m_envs.size();
+}
+
+int EnvironmentBatch::GetNumThreads() {
+  return m_pool->size();
+}
+
+BulletEnvironmentPtr EnvironmentBatch::GetEnvironment(int i) {
+  if (i < 0 || i >= m_envs.size()) {
+    throw std::runtime_error((boost::format("environment index %d out of range [0, %d)") % i % m_envs.size()).str());
+  }
+  return m_envs[i];
+}
+
+void EnvironmentBatch::stepOne(int i, float dt, int maxSubSteps, float fixedTimeStep) {
+  m_envs[i]->Step(dt, maxSubSteps, fixedTimeStep);
+}
+
+void EnvironmentBatch::Step(float dt, int maxSubSteps, float fixedTimeStep) {
+  m_pool->parallelFor(m_envs.size(), boost::bind(&EnvironmentBatch::stepOne, this, _1, dt, maxSubSteps, fixedTimeStep));
+}
+
+void EnvironmentBatch::py_Step(float dt, int maxSubSteps, float fixedTimeStep) {
+  ScopedGILRelease nogil;
+  Step(dt, maxSubSteps, fixedTimeStep);
+}
+
+void EnvironmentBatch::resolveObjects(const vector<string>& names, vector<vector<RaveObject::Ptr> >& objs) {
+  objs.assign(m_envs.size(), vector<RaveObject::Ptr>(names.size()));
+  for (int i = 0; i < m_envs.size(); ++i) {
+    for (int j = 0; j < names.size(); ++j) {
+      objs[i][j] = m_envs[i]->findObject(names[j]);
+      if (!objs[i][j]) {
+        throw std::runtime_error((boost::format("object %s not in bullet env %d") % names[j] % i).str());
+      }
+    }
+  }
+}
+
+void EnvironmentBatch::getTransformsOne(int i, const vector<vector<RaveObject::Ptr> >& objs, btScalar* out) {
+  const vector<RaveObject::Ptr>& envObjs = objs[i];
+  btScalar* p = out + 16*envObjs.size()*i;
+  for (int j = 0; j < envObjs.size(); ++j) {
+    toHmat(envObjs[j]->toRaveFrame(envObjs[j]->children[0]->rigidBody->getCenterOfMassTransform()), p + 16*j);
+  }
+}
+
+void EnvironmentBatch::writeTransforms(const vector<vector<RaveObject::Ptr> >& objs, btScalar* out) {
+  m_pool->parallelFor(m_envs.size(), boost::bind(&EnvironmentBatch::getTransformsOne, this, _1, boost::cref(objs), out));
+}
+
+void EnvironmentBatch::GetTransforms(const vector<string>& names, btScalar* out) {
+  vector<vector<RaveObject::Ptr> > objs;
+  resolveObjects(names, objs);
+  writeTransforms(objs, out);
+}
+
+py::object EnvironmentBatch::py_GetTransforms(py::list py_names) {
+  vector<string> names = toStrVec(py_names);
+  py::object out = numpy.attr("empty")(py::make_tuple(m_envs.size(), names.size(), 4, 4), type_traits<btScalar>::npname);
+  btScalar* pout = getPointer<btScalar>(out);
+  {
+    ScopedGILRelease nogil;
+    GetTransforms(names, pout);
+  }
+  return out;
+}
+
+py::object EnvironmentBatch::py_StepAndGetTransforms(float dt, int maxSubSteps, float fixedTimeStep, py::list py_names) {
+  vector<string> names = toStrVec(py_names);
+  py::object out = numpy.attr("empty")(py::make_tuple(m_envs.size(), names.size(), 4, 4), type_traits<btScalar>::npname);
+  btScalar* pout = getPointer<btScalar>(out);
+  // look the objects up before stepping, so that a bad name doesn't leave the batch stepped
+  vector<vector<RaveObject::Ptr> > objs;
+  resolveObjects(names, objs);
+  {
+    ScopedGILRelease nogil;
+    Step(dt, maxSubSteps, fixedTimeStep);
+    writeTransforms(objs, pout);
+  }
+  return out;
+}
+
 
 
 static string makeRaveCylsXML(string name, btScalar radius, const vector<btScalar> &lengths) {
@@ -788,7 +1419,7 @@ vector<btMatrix3x3> CapsuleRope::GetRotations() {
 void CapsuleRope::SetRotations(py::object rots) {
   vector<btMatrix3x3> m;
   fromNdarray3ToBtMats(numpy.attr("asarray")(rots), m);
-  CapsuleRope_setRotations(m_children_rigidbodies, m);
+  CapsuleRope_setRotations(m_children_rigidbodies, m, m_obj->getEnvironment()->bullet.get());
 }
 std::vector<btVector3> CapsuleRope::GetTranslations() {
   std::vector<btVector3> out = CapsuleRope_getTranslations(m_children_rigidbodies);
@@ -799,7 +1430,7 @@ void CapsuleRope::SetTranslations(py::object trans) {
   vector<btVector3> v;
   fromNdarray2ToBtVecs(numpy.attr("asarray")(trans), v);
   scale(v, METERS);
-  CapsuleRope_setTranslations(m_children_rigidbodies, v);
+  CapsuleRope_setTranslations(m_children_rigidbodies, v, m_obj->getEnvironment()->bullet.get());
 }
 vector<float> CapsuleRope::GetHalfHeights() {
   std::vector<float> out = CapsuleRope_getHalfHeights(m_children_rigidbodies);
@@ -807,12 +1438,76 @@ vector<float> CapsuleRope::GetHalfHeights() {
   return out;
 }
 
-py::object CapsuleRope::py_GetNodes() { return toNdarray2(GetNodes()); }
-py::object CapsuleRope::py_GetControlPoints() { return toNdarray2(GetControlPoints()); }
-py::object CapsuleRope::py_GetRotations() { return toNdarray3(GetRotations()); }
+// The *Into functions write straight from the rigid bodies into the output
+// buffer, without the intermediate vectors of the functions above.
+void CapsuleRope::GetNodesInto(btScalar* out) {
+  CapsuleRope_getNodesInto(m_children_rigidbodies, out, 1.0f/METERS);
+}
+void CapsuleRope::GetControlPointsInto(btScalar* out) {
+  CapsuleRope_getControlPointsInto(m_children_rigidbodies, out, 1.0f/METERS);
+}
+void CapsuleRope::GetRotationsInto(btScalar* out) {
+  CapsuleRope_getRotationsInto(m_children_rigidbodies, out);
+}
+void CapsuleRope::GetTranslationsInto(btScalar* out) {
+  GetNodesInto(out);
+}
+void CapsuleRope::GetHalfHeightsInto(btScalar* out) {
+  CapsuleRope_getHalfHeightsInto(m_children_rigidbodies, out, 1.0f/METERS);
+}
+
+py::object CapsuleRope::py_GetNodes() {
+  py::object out = numpy.attr("empty")(py::make_tuple(m_children_rigidbodies.size(), 3), type_traits<btScalar>::npname);
+  GetNodesInto(getPointer<btScalar>(out));
+  return out;
+}
+py::object CapsuleRope::py_GetControlPoints() {
+  py::object out = numpy.attr("empty")(py::make_tuple(m_children_rigidbodies.size() + 1, 3), type_traits<btScalar>::npname);
+  GetControlPointsInto(getPointer<btScalar>(out));
+  return out;
+}
+py::object CapsuleRope::py_GetRotations() {
+  py::object out = numpy.attr("empty")(py::make_tuple(m_children_rigidbodies.size(), 3, 3), type_traits<btScalar>::npname);
+  GetRotationsInto(getPointer<btScalar>(out));
+  return out;
+}
 void CapsuleRope::py_SetRotations(py::object py_rots) { return SetRotations(py_rots); }
-py::object CapsuleRope::py_GetTranslations() { return toNdarray2(GetTranslations()); }
+py::object CapsuleRope::py_GetTranslations() {
+  py::object out = numpy.attr("empty")(py::make_tuple(m_children_rigidbodies.size(), 3), type_traits<btScalar>::npname);
+  GetTranslationsInto(getPointer<btScalar>(out));
+  return out;
+}
 void CapsuleRope::py_SetTranslations(py::object py_trans) { return SetTranslations(py_trans); }
-py::object CapsuleRope::py_GetHalfHeights() { return toNdarray(GetHalfHeights()); }
+py::object CapsuleRope::py_GetHalfHeights() {
+  py::object out = numpy.attr("empty")(py::make_tuple(m_children_rigidbodies.size()), type_traits<btScalar>::npname);
+  GetHalfHeightsInto(getPointer<btScalar>(out));
+  return out;
+}
+
+void CapsuleRope::py_GetNodesInto(py::object out) {
+  const Py_ssize_t shape[] = {(Py_ssize_t) m_children_rigidbodies.size(), 3};
+  WritableBuffer<btScalar> buf(out, 2, shape);
+  GetNodesInto(buf.data());
+}
+void CapsuleRope::py_GetControlPointsInto(py::object out) {
+  const Py_ssize_t shape[] = {(Py_ssize_t) m_children_rigidbodies.size() + 1, 3};
+  WritableBuffer<btScalar> buf(out, 2, shape);
+  GetControlPointsInto(buf.data());
+}
+void CapsuleRope::py_GetRotationsInto(py::object out) {
+  const Py_ssize_t shape[] = {(Py_ssize_t) m_children_rigidbodies.size(), 3, 3};
+  WritableBuffer<btScalar> buf(out, 3, shape);
+  GetRotationsInto(buf.data());
+}
+void CapsuleRope::py_GetTranslationsInto(py::object out) {
+  const Py_ssize_t shape[] = {(Py_ssize_t) m_children_rigidbodies.size(), 3};
+  WritableBuffer<btScalar> buf(out, 2, shape);
+  GetTranslationsInto(buf.data());
+}
+void CapsuleRope::py_GetHalfHeightsInto(py::object out) {
+  const Py_ssize_t shape[] = {(Py_ssize_t) m_children_rigidbodies.size()};
+  WritableBuffer<btScalar> buf(out, 1, shape);
+  GetHalfHeightsInto(buf.data());
+}
 
 } // namespace bs
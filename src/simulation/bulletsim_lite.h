@@ -3,6 +3,12 @@
 #include <boost/python.hpp>
 #include "environment.h"
 #include "openravesupport.h"
+#include "thread_pool.h"
+#include "ray_caster.h"
+#include "depth_renderer.h"
+#include "distance_query.h"
+#include "continuous_caster.h"
+#include "pose_checker.h"
 #include "macros.h"
 
 namespace bs {
@@ -29,6 +35,8 @@ public:
 
   virtual btTransform GetTransform();
   virtual py::object py_GetTransform();
+  // fills a preallocated 4x4 array (row-major, like GetTransform's result)
+  void py_GetTransformInto(py::object out);
 
   virtual void SetTransform(const btTransform& t);
   virtual void py_SetTransform(py::object py_hmat);
@@ -70,6 +78,23 @@ struct BULLETSIM_API Collision {
   CollisionPtr Flipped() const;
 };
 
+// Contacts stored as flat arrays, one entry per contact point, with the same
+// values as the corresponding Collision objects. Links are identified by the
+// environment id of their KinBody and their index in it.
+struct BULLETSIM_API CollisionArrays {
+  vector<int> bodyIds;     // N*2: A, B
+  vector<int> linkIndices; // N*2: A, B
+  vector<btScalar> ptA, ptB, normalB2A; // N*3
+  vector<btScalar> distance, weight;    // N
+
+  size_t size() const { return distance.size(); }
+  void clear();
+  void add(const RaveLinkObject* linkA, const RaveLinkObject* linkB, const btVector3& ptA_, const btVector3& ptB_, const btVector3& normalB2A_, btScalar distance_, btScalar weight_);
+
+  // dict of numpy arrays: bodyIds (N,2), linkIndices (N,2), ptA, ptB, normalB2A (N,3), distance, weight (N,)
+  py::object py_ToDict() const;
+};
+
 struct RayCollision;
 typedef boost::shared_ptr<RayCollision> RayCollisionPtr;
 struct BULLETSIM_API RayCollision {
@@ -97,6 +122,16 @@ struct BULLETSIM_API SimulationParams {
   float restitution;
   float margin;
   float linkPadding;
+  bool hullCache;
+  bool convexDecomposition;
+  float decompositionConcavity;
+  int maxHullVertices;
+  int numDispatcherThreads;
+  int numSolverThreads;
+  int numSoftBodyThreads;
+  bool softBodySimd;
+  int numQueryThreads;
+  int numLoadThreads;
 
   SimulationParams();
   void Apply();
@@ -118,6 +153,13 @@ public:
   vector<BulletObjectPtr> GetObjects();
   vector<BulletObjectPtr> GetDynamicObjects();
 
+  // Poses of many objects in one call. Objects are given as BulletObjects or
+  // names; transforms are an (N,4,4) array of row-major homogeneous matrices.
+  void GetTransforms(const vector<BulletObjectPtr>& objs, btScalar* out);
+  void SetTransforms(const vector<BulletObjectPtr>& objs, const btScalar* hmats);
+  py::object py_GetTransforms(py::list py_objs);
+  void py_SetTransforms(py::list py_objs, py::object py_hmats);
+
   EnvironmentBasePtr GetRaveEnv();
   py::object py_GetRaveEnv();
 
@@ -134,8 +176,61 @@ public:
 
   vector<CollisionPtr> DetectAllCollisions();
   vector<CollisionPtr> ContactTest(BulletObjectPtr obj);
+  // same contacts as above, appended to flat arrays instead of one Collision each
+  void DetectAllCollisionsFlat(CollisionArrays& out);
+  void ContactTestFlat(BulletObjectPtr obj, CollisionArrays& out);
+  py::object py_DetectAllCollisionsFlat();
+  py::object py_ContactTestFlat(BulletObjectPtr obj);
   vector<RayCollisionPtr> RayTest(const vector<btVector3>& rayFroms, const vector<btVector3>& rayTos, BulletObjectPtr obj);
   vector<RayCollisionPtr> py_RayTest(py::object py_rayFroms, py::object py_rayTos, BulletObjectPtr obj);
+  // Casts n rays against the links of obj on SimulationParams::numQueryThreads threads.
+  // rayFroms/rayTos hold 3 scalars per ray. For each ray, writes the OpenRAVE index of the
+  // hit link (-1 for a miss), the hit point, the unit normal and the hit fraction (1 for a miss).
+  // The acceleration structure for obj is built on first use and kept until obj is removed.
+  void RayTestBatch(BulletObjectPtr obj, int n, const btScalar* rayFroms, const btScalar* rayTos,
+                    int* linkIndices, btScalar* pts, btScalar* normals, btScalar* fractions);
+  // rayFroms, rayTos: (N,3). returns a dict of numpy arrays:
+  // linkIndices (N,), pt (N,3), normal (N,3), fraction (N,)
+  py::object py_RayTestBatch(py::object py_rayFroms, py::object py_rayTos, BulletObjectPtr obj);
+
+  // Depth image of all collision shapes, seen by a pinhole camera with focal lengths
+  // fx, fy and principal point cx, cy, looking along +z of camToWorld (x right, y down).
+  // Writes width*height depths along the optical axis, row by row; NaN where nothing is seen.
+  void RenderDepth(const btTransform& camToWorld, float fx, float fy, float cx, float cy, int width, int height, float* out);
+  // intrinsics: 3x3 camera matrix, pose: 4x4 camera to world. returns a (height,width) float32 array
+  py::object py_RenderDepth(py::object py_intrinsics, py::object py_pose, int width, int height);
+
+  // Signed distances between every link of objsA and every link of objsB that are
+  // at most maxDist apart (negative when penetrating), computed by GJK/EPA from the
+  // current poses only, unlike the contact manifolds read by DetectAllCollisions.
+  // Links of the same body are not paired, and each unordered pair is tested once,
+  // so objsA and objsB may overlap. Pairs run on SimulationParams::numQueryThreads threads.
+  vector<CollisionPtr> ComputeDistances(const vector<BulletObjectPtr>& objsA, const vector<BulletObjectPtr>& objsB, btScalar maxDist);
+  void ComputeDistancesFlat(const vector<BulletObjectPtr>& objsA, const vector<BulletObjectPtr>& objsB, btScalar maxDist, CollisionArrays& out);
+  vector<CollisionPtr> py_ComputeDistances(py::list py_objsA, py::list py_objsB, btScalar maxDist);
+  py::object py_ComputeDistancesFlat(py::list py_objsA, py::list py_objsB, btScalar maxDist);
+
+  // Continuous collision check of n motions of obj, from the DOF values startDofs[s] to
+  // endDofs[s] (dofIndices.size() values each), against everything else in the environment.
+  // Each link moves on a straight line with a constant rotation rate between its poses at
+  // the two ends, which is close to joint space interpolation for short segments.
+  // Only the links the DOFs move are swept; obj's other links and the objects it ignores
+  // (e.g. grabbed ones) aren't obstacles. hits[s] is the first contact of segment s; links
+  // are obj's children, indexed as in getChildren(). obj is left in the configuration it
+  // had before the call.
+  void CastContinuous(BulletObjectPtr obj, const vector<int>& dofIndices, int n, const btScalar* startDofs, const btScalar* endDofs, vector<ContinuousCaster::Hit>& hits);
+  // startDofs, endDofs: (N,len(dofIndices)). returns a dict of numpy arrays:
+  // fraction (N,), linkIndex (N,) of the link that hits first (-1 for a free segment),
+  // obstacleBodyId, obstacleLinkIndex (N,) (-1 if the obstacle is not an OpenRAVE link), pt, normal (N,3)
+  py::object py_CastContinuous(BulletObjectPtr obj, py::list py_dofIndices, py::object py_startDofs, py::object py_endDofs);
+
+  // Discrete collision check of n configurations of obj, each setting its DOFs dofIndices
+  // to a row of dofs, e.g. all IK solutions of an arm. free[s] is true if the links moved
+  // by the DOFs don't collide with anything at configuration s; see RaveObject::filterCollisionFree.
+  // Configurations are checked on SimulationParams::numQueryThreads threads.
+  void FilterCollisionFree(BulletObjectPtr obj, const vector<int>& dofIndices, int n, const btScalar* dofs, vector<bool>& free);
+  // dofs: (N,len(dofIndices)). returns a bool array (N,)
+  py::object py_FilterCollisionFree(BulletObjectPtr obj, py::list py_dofIndices, py::object py_dofs);
 
   void SetContactDistance(double dist);
 
@@ -146,14 +241,70 @@ public:
   void Remove(BulletObjectPtr obj);
   void Add(BulletObjectPtr obj);
 
+  // in-place snapshot/rollback of the simulation state, see EnvironmentState
+  EnvironmentState::Ptr SaveState();
+  void RestoreState(EnvironmentState::Ptr state);
+
+  // the RaveObject named name, from m_env's name index; NULL if there is none
+  RaveObject::Ptr findObject(const string& name);
+
 private:
   Environment::Ptr m_env;
   RaveInstance::Ptr m_rave;
   vector<string> m_dynamic_obj_names;
+  CollisionArrays m_collisionArrays; // scratch for the python *Flat queries
+  map<RaveObject*, RayCaster::Ptr> m_rayCasters;
+  DepthRenderer::Ptr m_depthRenderer;
+  DistanceQuery::Ptr m_distanceQuery;
+  ContinuousCaster::Ptr m_continuousCaster;
+  PoseChecker::Ptr m_poseChecker;
+  int m_numQueryThreads;
+  ThreadPool::Ptr m_queryPool; // shared by the batched queries, created on first use
+  ThreadPool::Ptr queryPool();
+  void distancePairs(const vector<BulletObjectPtr>& objsA, const vector<BulletObjectPtr>& objsB, vector<DistanceQuery::ObjectPair>& pairs);
   void init(EnvironmentBasePtr rave_env, const vector<string>& dynamic_obj_names);
+
+  vector<BulletObjectPtr> toObjVec(py::list py_objs);
 };
 typedef boost::shared_ptr<BulletEnvironment> BulletEnvironmentPtr;
 
+// N independent BulletEnvironments built from the same OpenRAVE environment,
+// stepped together on a thread pool. The python wrappers release the GIL for
+// the whole batch, so a rollout tick is one call instead of N.
+class BULLETSIM_API EnvironmentBatch {
+public:
+  // numThreads <= 0 uses one thread per hardware core
+  EnvironmentBatch(EnvironmentBasePtr rave_env, const vector<string>& dynamic_obj_names, int numEnvs, int numThreads=0);
+  EnvironmentBatch(py::object py_rave_env, py::list dynamic_obj_names, int numEnvs, int numThreads=0);
+
+  int GetNumEnvironments();
+  int GetNumThreads();
+  BulletEnvironmentPtr GetEnvironment(int i);
+
+  void Step(float dt, int maxSubSteps, float fixedTimeStep);
+  void py_Step(float dt, int maxSubSteps, float fixedTimeStep);
+
+  // poses of the named objects in every environment, as a
+  // numEnvs x numObjs x 4 x 4 array of homogeneous matrices
+  void GetTransforms(const vector<string>& names, btScalar* out);
+  py::object py_GetTransforms(py::list names);
+  // Step followed by GetTransforms, without reacquiring the GIL in between
+  py::object py_StepAndGetTransforms(float dt, int maxSubSteps, float fixedTimeStep, py::list names);
+
+private:
+  vector<BulletEnvironmentPtr> m_envs;
+  ThreadPool::Ptr m_pool;
+
+  void init(EnvironmentBasePtr rave_env, const vector<string>& dynamic_obj_names, int numEnvs, int numThreads);
+  // objs[i][j] is the object named names[j] in environment i, looked up by name on every
+  // call since objects may be removed or replaced between calls
+  void resolveObjects(const vector<string>& names, vector<vector<RaveObject::Ptr> >& objs);
+  void stepOne(int i, float dt, int maxSubSteps, float fixedTimeStep);
+  void writeTransforms(const vector<vector<RaveObject::Ptr> >& objs, btScalar* out);
+  void getTransformsOne(int i, const vector<vector<RaveObject::Ptr> >& objs, btScalar* out);
+};
+typedef boost::shared_ptr<EnvironmentBatch> EnvironmentBatchPtr;
+
 
 struct BULLETSIM_API CapsuleRopeParams {
   float radius;
@@ -185,6 +336,14 @@ public:
   void SetTranslations(py::object trans);
   vector<float> GetHalfHeights();
 
+  // write into caller-provided buffers: n*3, (n+1)*3, n*3*3, n*3 and n scalars
+  // for n capsules
+  void GetNodesInto(btScalar* out);
+  void GetControlPointsInto(btScalar* out);
+  void GetRotationsInto(btScalar* out);
+  void GetTranslationsInto(btScalar* out);
+  void GetHalfHeightsInto(btScalar* out);
+
   py::object py_GetNodes();
   py::object py_GetControlPoints();
   py::object py_GetRotations();
@@ -192,6 +351,12 @@ public:
   py::object py_GetTranslations();
   void py_SetTranslations(py::object py_trans);
   py::object py_GetHalfHeights();
+  // fill preallocated C-contiguous arrays of the right shape and dtype
+  void py_GetNodesInto(py::object out);
+  void py_GetControlPointsInto(py::object out);
+  void py_GetRotationsInto(py::object out);
+  void py_GetTranslationsInto(py::object out);
+  void py_GetHalfHeightsInto(py::object out);
 
   // not supported
   virtual void UpdateBullet();
@@ -18,6 +18,7 @@ BOOST_PYTHON_MODULE(cbulletsimpy) {
     .def("GetName", &bs::BulletObject::GetName)
     .def("GetKinBody", &bs::BulletObject::py_GetKinBody, "get the KinBody in the OpenRAVE environment this object was created from")
     .def("GetTransform", &bs::BulletObject::py_GetTransform)
+    .def("GetTransformInto", &bs::BulletObject::py_GetTransformInto, "write the transform into a preallocated 4x4 array")
     .def("SetTransform", &bs::BulletObject::py_SetTransform)
     .def("SetLinearVelocity", &bs::BulletObject::py_SetLinearVelocity)
     .def("SetAngularVelocity", &bs::BulletObject::py_SetAngularVelocity)
@@ -53,6 +54,8 @@ BOOST_PYTHON_MODULE(cbulletsimpy) {
 
   py::class_<BulletConstraint, BulletConstraint::Ptr, boost::noncopyable>("BulletConstraint", py::no_init);
 
+  py::class_<EnvironmentState, EnvironmentState::Ptr, boost::noncopyable>("EnvironmentState", py::no_init);
+
   py::class_<bs::SimulationParams, bs::SimulationParamsPtr>("SimulationParams", py::no_init)
     .def_readwrite("scale", &bs::SimulationParams::scale)
     .def_readwrite("gravity", &bs::SimulationParams::gravity)
@@ -63,6 +66,16 @@ BOOST_PYTHON_MODULE(cbulletsimpy) {
     .def_readwrite("restitution", &bs::SimulationParams::restitution)
     .def_readwrite("margin", &bs::SimulationParams::margin)
     .def_readwrite("linkPadding", &bs::SimulationParams::linkPadding)
+    .def_readwrite("hullCache", &bs::SimulationParams::hullCache)
+    .def_readwrite("convexDecomposition", &bs::SimulationParams::convexDecomposition)
+    .def_readwrite("decompositionConcavity", &bs::SimulationParams::decompositionConcavity)
+    .def_readwrite("maxHullVertices", &bs::SimulationParams::maxHullVertices)
+    .def_readwrite("numDispatcherThreads", &bs::SimulationParams::numDispatcherThreads)
+    .def_readwrite("numSolverThreads", &bs::SimulationParams::numSolverThreads)
+    .def_readwrite("numSoftBodyThreads", &bs::SimulationParams::numSoftBodyThreads)
+    .def_readwrite("softBodySimd", &bs::SimulationParams::softBodySimd)
+    .def_readwrite("numQueryThreads", &bs::SimulationParams::numQueryThreads)
+    .def_readwrite("numLoadThreads", &bs::SimulationParams::numLoadThreads)
     ;
 
   py::class_<bs::BulletEnvironment, bs::BulletEnvironmentPtr>("BulletEnvironment", py::init<py::object, py::list>())
@@ -70,18 +83,39 @@ BOOST_PYTHON_MODULE(cbulletsimpy) {
     .def("GetObjectFromKinBody", &bs::BulletEnvironment::py_GetObjectFromKinBody, "")
     .def("GetObjects", &bs::BulletEnvironment::GetObjects, "get all objects")
     .def("GetDynamicObjects", &bs::BulletEnvironment::GetDynamicObjects, "get dynamic objects")
+    .def("GetTransforms", &bs::BulletEnvironment::py_GetTransforms, "(N,4,4) array of transforms for a list of objects or object names")
+    .def("SetTransforms", &bs::BulletEnvironment::py_SetTransforms, "set transforms of a list of objects or object names from an (N,4,4) array")
     .def("GetRaveEnv", &bs::BulletEnvironment::py_GetRaveEnv, "get the backing OpenRAVE environment")
     .def("SetGravity", &bs::BulletEnvironment::py_SetGravity)
     .def("GetGravity", &bs::BulletEnvironment::py_GetGravity)
     .def("Step", &bs::BulletEnvironment::Step)
     .def("DetectAllCollisions", &bs::BulletEnvironment::DetectAllCollisions)
     .def("ContactTest", &bs::BulletEnvironment::ContactTest)
+    .def("DetectAllCollisionsFlat", &bs::BulletEnvironment::py_DetectAllCollisionsFlat, "like DetectAllCollisions, but returns a dict of flat numpy arrays (bodyIds, linkIndices, ptA, ptB, normalB2A, distance, weight)")
+    .def("ContactTestFlat", &bs::BulletEnvironment::py_ContactTestFlat, "like ContactTest, but returns a dict of flat numpy arrays (see DetectAllCollisionsFlat)")
     .def("RayTest", &bs::BulletEnvironment::py_RayTest)
+    .def("RenderDepth", &bs::BulletEnvironment::py_RenderDepth, "RenderDepth(K, pose, width, height): (height,width) depth image of the collision shapes from a pinhole camera with 3x3 intrinsics K and 4x4 camera-to-world pose (z forward, x right, y down). NaN where nothing is seen")
+    .def("RayTestBatch", &bs::BulletEnvironment::py_RayTestBatch, "cast (N,3) arrays of rays against obj on several threads; returns a dict of arrays linkIndices, pt, normal, fraction")
+    .def("ComputeDistances", &bs::BulletEnvironment::py_ComputeDistances, "ComputeDistances(objsA, objsB, maxDist): Collisions for all link pairs between the two lists of objects or names closer than maxDist, from GJK/EPA on the current poses; distance is negative for penetration")
+    .def("ComputeDistancesFlat", &bs::BulletEnvironment::py_ComputeDistancesFlat, "like ComputeDistances, but returns a dict of flat numpy arrays (see DetectAllCollisionsFlat)")
+    .def("CastContinuous", &bs::BulletEnvironment::py_CastContinuous, "CastContinuous(obj, dofIndices, startDofs, endDofs): continuous collision check of obj moving from each row of startDofs to the same row of endDofs; returns a dict of arrays fraction, linkIndex, obstacleBodyId, obstacleLinkIndex, pt, normal with the first contact of each motion")
+    .def("FilterCollisionFree", &bs::BulletEnvironment::py_FilterCollisionFree, "FilterCollisionFree(obj, dofIndices, dofs): for each row of dofs, whether obj's links moved by dofIndices are collision free at those DOF values; returns a bool array")
     .def("SetContactDistance", &bs::BulletEnvironment::SetContactDistance)
     .def("AddConstraint", &bs::BulletEnvironment::py_AddConstraint)
     .def("RemoveConstraint", &bs::BulletEnvironment::RemoveConstraint)
     .def("Remove", &bs::BulletEnvironment::Remove)
     .def("Add", &bs::BulletEnvironment::Add)
+    .def("SaveState", &bs::BulletEnvironment::SaveState, "snapshot poses, velocities, constraint impulses and contact caches")
+    .def("RestoreState", &bs::BulletEnvironment::RestoreState, "roll back in place to a state from SaveState")
+    ;
+
+  py::class_<bs::EnvironmentBatch, bs::EnvironmentBatchPtr>("EnvironmentBatch", py::init<py::object, py::list, int, py::optional<int> >())
+    .def("GetNumEnvironments", &bs::EnvironmentBatch::GetNumEnvironments)
+    .def("GetNumThreads", &bs::EnvironmentBatch::GetNumThreads)
+    .def("GetEnvironment", &bs::EnvironmentBatch::GetEnvironment)
+    .def("Step", &bs::EnvironmentBatch::py_Step, "step all environments in parallel, with the GIL released")
+    .def("GetTransforms", &bs::EnvironmentBatch::py_GetTransforms, "poses of the named objects in all environments, as a numEnvs x numObjs x 4 x 4 array")
+    .def("StepAndGetTransforms", &bs::EnvironmentBatch::py_StepAndGetTransforms, "Step followed by GetTransforms")
     ;
 
   py::class_<bs::CapsuleRopeParams, bs::CapsuleRopeParamsPtr>("CapsuleRopeParams", py::init<>())
@@ -102,6 +136,11 @@ BOOST_PYTHON_MODULE(cbulletsimpy) {
     .def("GetTranslations", &bs::CapsuleRope::py_GetTranslations)
     .def("SetTranslations", &bs::CapsuleRope::py_SetTranslations)
     .def("GetHalfHeights", &bs::CapsuleRope::py_GetHalfHeights)
+    .def("GetNodesInto", &bs::CapsuleRope::py_GetNodesInto, "like GetNodes, but writes into a preallocated (n,3) array")
+    .def("GetControlPointsInto", &bs::CapsuleRope::py_GetControlPointsInto, "like GetControlPoints, but writes into a preallocated (n+1,3) array")
+    .def("GetRotationsInto", &bs::CapsuleRope::py_GetRotationsInto, "like GetRotations, but writes into a preallocated (n,3,3) array")
+    .def("GetTranslationsInto", &bs::CapsuleRope::py_GetTranslationsInto, "like GetTranslations, but writes into a preallocated (n,3) array")
+    .def("GetHalfHeightsInto", &bs::CapsuleRope::py_GetHalfHeightsInto, "like GetHalfHeights, but writes into a preallocated (n,) array")
     ;
 
   py::scope().attr("sim_params") = bs::GetSimParams();
@@ -7,5 +7,14 @@ float BulletConfig::friction = .5;
 float BulletConfig::restitution = 0;
 float BulletConfig::margin = .0005;
 float BulletConfig::linkPadding = 0;
-bool BulletConfig::graphicsMesh = false;
+bool BulletConfig::hullCache = true;
+bool BulletConfig::convexDecomposition = false;
+float BulletConfig::decompositionConcavity = .05;
+int BulletConfig::maxHullVertices = 0;
 int BulletConfig::kinematicPolicy = 1;
+int BulletConfig::numDispatcherThreads = 0;
+int BulletConfig::numSolverThreads = 0;
+int BulletConfig::numSoftBodyThreads = 0;
+bool BulletConfig::softBodySimd = false;
+int BulletConfig::numQueryThreads = 0;
+int BulletConfig::numLoadThreads = 0;
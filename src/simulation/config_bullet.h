@@ -11,8 +11,17 @@ struct BulletConfig : Config {
   static float restitution;
   static float margin;
   static float linkPadding;
-  static bool graphicsMesh;
+  static bool hullCache;
+  static bool convexDecomposition;
+  static float decompositionConcavity;
+  static int maxHullVertices;
 	static int kinematicPolicy;
+  static int numDispatcherThreads;
+  static int numSolverThreads;
+  static int numSoftBodyThreads;
+  static bool softBodySimd;
+  static int numQueryThreads;
+  static int numLoadThreads;
 
   BulletConfig() : Config() {
     params.push_back(new Parameter<float>("gravity", &gravity.m_floats[2], "gravity (z component)")); 
@@ -23,8 +32,17 @@ struct BulletConfig : Config {
     params.push_back(new Parameter<float>("restitution", &restitution, "not currently implemented"));
     params.push_back(new Parameter<float>("margin", &margin, "not currently implemented"));
     params.push_back(new Parameter<float>("linkPadding", &linkPadding, "expand links by that much if they're convex hull shapes"));
-    params.push_back(new Parameter<bool>("graphicsMesh", &graphicsMesh, "visualize a high res graphics mesh"));
+    params.push_back(new Parameter<bool>("hullCache", &hullCache, "keep the convex hulls of a model's trimeshes in <model file>.hulls and reuse them"));
+    params.push_back(new Parameter<bool>("convexDecomposition", &convexDecomposition, "load the trimeshes of OpenRAVE bodies as convex decompositions (HACD) instead of single convex hulls"));
+    params.push_back(new Parameter<float>("decompositionConcavity", &decompositionConcavity, "largest concavity a part of a convex decomposition may have, as a fraction of the mesh's bounding box diagonal"));
+    params.push_back(new Parameter<int>("maxHullVertices", &maxHullVertices, "most vertices a convex hull of a trimesh (or of a part of one) may have. 0: btShapeHull's fixed sampling"));
 		params.push_back(new Parameter<int>("kinematicPolicy", &kinematicPolicy, "0: nothing dynamic. 1: non-robot kinbodies dynamic 2: everything dynamic"));
+    params.push_back(new Parameter<int>("numDispatcherThreads", &numDispatcherThreads, "narrowphase collision threads. 0: single-threaded btCollisionDispatcher"));
+    params.push_back(new Parameter<int>("numSolverThreads", &numSolverThreads, "threads for solving simulation islands in parallel. 0: btSequentialImpulseConstraintSolver"));
+    params.push_back(new Parameter<int>("numSoftBodyThreads", &numSoftBodyThreads, "threads for solving soft body links in parallel. 0: btDefaultSoftBodySolver"));
+    params.push_back(new Parameter<bool>("softBodySimd", &softBodySimd, "with numSoftBodyThreads > 0, solve links with SSE on struct-of-arrays node copies"));
+    params.push_back(new Parameter<int>("numQueryThreads", &numQueryThreads, "threads for batched queries (RayTestBatch, RenderDepth, ComputeDistances). 0: one per hardware thread"));
+    params.push_back(new Parameter<int>("numLoadThreads", &numLoadThreads, "threads for building link shapes when loading from OpenRAVE. 0: one per hardware thread"));
   }
 };
 
@@ -0,0 +1,176 @@
+#include "continuous_caster.h"
+#include "distance_query.h"
+#include <LinearMath/btTransformUtil.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace {
+// conservative advancement stops this close to the obstacle, in world units
+const btScalar TOLERANCE = .001;
+const int MAX_ITERATIONS = 256;
+
+// Convex hull of a convex shape at two poses, in the frame of the first one.
+// Only the support mapping is implemented, which is all GJK needs.
+class CastHullShape : public btConvexShape {
+public:
+    CastHullShape(const btConvexShape *shape, const btTransform &fromToTo) :
+        m_shape(shape), m_fromToTo(fromToTo) {
+        m_shapeType = CUSTOM_CONVEX_SHAPE_TYPE;
+    }
+
+    virtual btVector3 localGetSupportingVertex(const btVector3 &v) const {
+        btVector3 p0 = m_shape->localGetSupportingVertex(v);
+        btVector3 p1 = m_fromToTo(m_shape->localGetSupportingVertex(v * m_fromToTo.getBasis()));
+        return v.dot(p0) >= v.dot(p1) ? p0 : p1;
+    }
+    virtual btVector3 localGetSupportingVertexWithoutMargin(const btVector3 &v) const {
+        btVector3 p0 = m_shape->localGetSupportingVertexWithoutMargin(v);
+        btVector3 p1 = m_fromToTo(m_shape->localGetSupportingVertexWithoutMargin(v * m_fromToTo.getBasis()));
+        return v.dot(p0) >= v.dot(p1) ? p0 : p1;
+    }
+    virtual void batchedUnitVectorGetSupportingVertexWithoutMargin(const btVector3 *vectors, btVector3 *out, int n) const {
+        for (int i = 0; i < n; ++i)
+            out[i] = localGetSupportingVertexWithoutMargin(vectors[i]);
+    }
+    virtual void getAabb(const btTransform &t, btVector3 &aabbMin, btVector3 &aabbMax) const {
+        btVector3 min1, max1;
+        m_shape->getAabb(t, aabbMin, aabbMax);
+        m_shape->getAabb(t * m_fromToTo, min1, max1);
+        aabbMin.setMin(min1);
+        aabbMax.setMax(max1);
+    }
+    virtual void getAabbSlow(const btTransform &t, btVector3 &aabbMin, btVector3 &aabbMax) const {
+        getAabb(t, aabbMin, aabbMax);
+    }
+    virtual void setLocalScaling(const btVector3 &) { }
+    virtual const btVector3 &getLocalScaling() const { return m_shape->getLocalScaling(); }
+    virtual void setMargin(btScalar) { }
+    virtual btScalar getMargin() const { return m_shape->getMargin(); }
+    virtual int getNumPreferredPenetrationDirections() const { return 0; }
+    virtual void getPreferredPenetrationDirection(int, btVector3 &) const { btAssert(0); }
+    virtual void calculateLocalInertia(btScalar, btVector3 &inertia) const { inertia.setZero(); }
+    virtual const char *getName() const { return "CastHull"; }
+
+private:
+    const btConvexShape *m_shape;
+    btTransform m_fromToTo;
+};
+
+struct CandidateCollector : public btBroadphaseAabbCallback {
+    std::vector<const btCollisionObject *> &m_out;
+    const std::vector<const btCollisionObject *> &m_excluded;
+    CandidateCollector(std::vector<const btCollisionObject *> &out, const std::vector<const btCollisionObject *> &excluded) :
+        m_out(out), m_excluded(excluded) { }
+    virtual bool process(const btBroadphaseProxy *proxy) {
+        const btCollisionObject *obj = static_cast<const btCollisionObject *>(proxy->m_clientObject);
+        if (!std::binary_search(m_excluded.begin(), m_excluded.end(), obj))
+            m_out.push_back(obj);
+        return true;
+    }
+};
+
+// Time of impact of convex a, moving from `from` with velocities linVel, angVel
+// for a unit of time, with the static shape b, by conservative advancement:
+// no point of a moves faster than motionBound, so a can safely advance by its
+// distance to b divided by it. Only impacts before `before` are searched for.
+bool timeOfImpact(const btConvexShape *a, const btTransform &from, const btVector3 &linVel, const btVector3 &angVel,
+                  btScalar motionBound, const btCollisionShape *b, const btTransform &tb, btScalar before,
+                  btScalar &fraction, DistanceQuery::Result &contact) {
+    btScalar lambda = 0;
+    for (int i = 0; i < MAX_ITERATIONS; ++i) {
+        btTransform t;
+        btTransformUtil::integrateTransform(from, linVel, angVel, lambda, t);
+        btScalar reach = motionBound * (before - lambda);
+        if (!DistanceQuery::computePair(a, t, b, tb, reach + TOLERANCE, contact))
+            return false;
+        if (contact.distance <= TOLERANCE)
+            break;
+        lambda += contact.distance / motionBound;
+        if (lambda >= before)
+            return false;
+    }
+    // on running out of iterations, a is still closer than it could travel,
+    // so the earliest possible impact is reported
+    fraction = lambda;
+    return true;
+}
+}
+
+ContinuousCaster::ContinuousCaster(ThreadPool::Ptr pool) : m_pool(pool) {
+    m_candidates.resize(m_pool->size());
+}
+
+void ContinuousCaster::castConvex(const btConvexShape *shape, const btTransform &from, const btTransform &to,
+                                  btCollisionWorld *world, std::vector<const btCollisionObject *> &candidates, Hit &hit) {
+    btVector3 linVel, angVel;
+    btTransformUtil::calculateVelocity(from, to, 1, linVel, angVel);
+    btVector3 sweptMin, sweptMax;
+    shape->calculateTemporalAabb(from, linVel, angVel, 1, sweptMin, sweptMax);
+    candidates.clear();
+    CandidateCollector collector(candidates, m_excluded);
+    world->getBroadphase()->aabbTest(sweptMin, sweptMax, collector);
+    if (candidates.empty()) return;
+
+    // points of the rotating shape move along arcs, which bulge out of the
+    // hull of the end poses by at most r (1 - cos(angle/2))
+    btScalar angle = btMin(angVel.length(), SIMD_PI);
+    btScalar bulge = shape->getAngularMotionDisc() * (1 - btCos(angle / 2));
+    CastHullShape hull(shape, from.inverseTimes(to));
+
+    btScalar motionBound = linVel.length() + angVel.length() * shape->getAngularMotionDisc();
+    for (int i = 0; i < candidates.size(); ++i) {
+        const btCollisionObject *obj = candidates[i];
+        DistanceQuery::Result contact;
+        if (!DistanceQuery::computePair(&hull, from, obj->getCollisionShape(), obj->getWorldTransform(), bulge, contact))
+            continue;
+        btScalar fraction;
+        if (timeOfImpact(shape, from, linVel, angVel, motionBound, obj->getCollisionShape(), obj->getWorldTransform(),
+                         hit.fraction, fraction, contact) && (!hit.obstacle || fraction < hit.fraction)) {
+            hit.obstacle = obj;
+            hit.fraction = fraction;
+            hit.point = contact.ptB;
+            hit.normal = contact.normalB2A;
+        }
+    }
+}
+
+void ContinuousCaster::castShape(const btCollisionShape *shape, const btTransform &from, const btTransform &to,
+                                 btCollisionWorld *world, std::vector<const btCollisionObject *> &candidates, Hit &hit) {
+    if (shape->isCompound()) {
+        const btCompoundShape *compound = static_cast<const btCompoundShape *>(shape);
+        for (int i = 0; i < compound->getNumChildShapes(); ++i)
+            castShape(compound->getChildShape(i), from * compound->getChildTransform(i),
+                      to * compound->getChildTransform(i), world, candidates, hit);
+    } else if (shape->isConvex()) {
+        castConvex(static_cast<const btConvexShape *>(shape), from, to, world, candidates, hit);
+    }
+    // moving concave shapes are not supported
+}
+
+void ContinuousCaster::castSegment(int segment, int threadIndex, const Batch &b) {
+    const std::vector<btCollisionObject *> &moving = *b.moving;
+    Hit &hit = b.hits[segment];
+    hit.object = -1;
+    hit.obstacle = NULL;
+    hit.fraction = 1;
+    hit.point.setZero();
+    hit.normal.setZero();
+    for (int i = 0; i < moving.size(); ++i) {
+        const btCollisionObject *prevObstacle = hit.obstacle;
+        btScalar prevFraction = hit.fraction;
+        int k = segment * moving.size() + i;
+        castShape(moving[i]->getCollisionShape(), b.from[k], b.to[k], b.world, m_candidates[threadIndex], hit);
+        if (hit.obstacle != prevObstacle || hit.fraction < prevFraction)
+            hit.object = i;
+    }
+}
+
+void ContinuousCaster::cast(btCollisionWorld *world, const std::vector<btCollisionObject *> &moving,
+                            const std::vector<const btCollisionObject *> &ignored,
+                            int n, const btTransform *from, const btTransform *to, Hit *hits) {
+    m_excluded.assign(moving.begin(), moving.end());
+    m_excluded.insert(m_excluded.end(), ignored.begin(), ignored.end());
+    std::sort(m_excluded.begin(), m_excluded.end());
+    Batch b = { world, &moving, from, to, hits };
+    m_pool->parallelFor(n, boost::bind(&ContinuousCaster::castSegment, this, _1, _2, boost::cref(b)));
+}
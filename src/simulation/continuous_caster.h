@@ -0,0 +1,57 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <vector>
+#include "thread_pool.h"
+
+// Continuous collision checking of moving objects (e.g. the links of a robot
+// between two waypoints) against the rest of a btCollisionWorld.
+// For every convex piece of a moving object, the swept volume is approximated
+// by the convex hull of the piece at the start and end poses, padded by how far
+// a rotating point can stray from that hull. Obstacles come from the world's
+// broadphase, queried with the piece's swept AABB; for the ones the hull touches,
+// conservative advancement finds the first time the piece comes within 1e-3 world
+// units of them. It never steps past a contact, so grazing motions may be reported
+// as hits but collisions are not missed.
+// Segments are swept concurrently on a ThreadPool.
+class ContinuousCaster {
+public:
+    typedef boost::shared_ptr<ContinuousCaster> Ptr;
+
+    struct Hit {
+        int object; // index into the moving objects of the one that hits first, -1 if the segment is free
+        const btCollisionObject *obstacle;
+        btScalar fraction; // time of impact in [0, 1], 1 if the segment is free
+        btVector3 point; // world contact point on the obstacle
+        btVector3 normal; // unit normal on the obstacle, towards the moving object
+    };
+
+    // segments are swept on pool, which may be shared with other users
+    explicit ContinuousCaster(ThreadPool::Ptr pool);
+
+    // Moves moving[i] linearly from from[s*m + i] to to[s*m + i] (m = moving.size())
+    // for each segment s in [0, n) and writes the earliest hit of the segment to hits[s].
+    // A segment that starts in collision has fraction 0.
+    // The moving objects and the ignored ones are not obstacles.
+    // Obstacles are found with the broadphase AABBs, which must be up to date.
+    void cast(btCollisionWorld *world, const std::vector<btCollisionObject *> &moving,
+              const std::vector<const btCollisionObject *> &ignored,
+              int n, const btTransform *from, const btTransform *to, Hit *hits);
+
+private:
+    struct Batch {
+        btCollisionWorld *world;
+        const std::vector<btCollisionObject *> *moving;
+        const btTransform *from, *to;
+        Hit *hits;
+    };
+
+    ThreadPool::Ptr m_pool;
+    std::vector<const btCollisionObject *> m_excluded; // sorted, per call
+    std::vector<std::vector<const btCollisionObject *> > m_candidates; // per pool thread
+
+    void castSegment(int segment, int threadIndex, const Batch &batch);
+    void castShape(const btCollisionShape *shape, const btTransform &from, const btTransform &to,
+                   btCollisionWorld *world, std::vector<const btCollisionObject *> &candidates, Hit &hit);
+    void castConvex(const btConvexShape *shape, const btTransform &from, const btTransform &to,
+                    btCollisionWorld *world, std::vector<const btCollisionObject *> &candidates, Hit &hit);
+};
@@ -0,0 +1,235 @@
+#include "depth_renderer.h"
+#include <BulletSoftBody/btSoftBody.h>
+#include <LinearMath/btConvexHullComputer.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace {
+const int TILE_SIZE = 32;
+// near clipping plane, in output units (e.g. 1cm for meters)
+const float NEAR_DEPTH = .01;
+// concave shapes like btStaticPlaneShape are unbounded; only draw this much of them
+const btScalar MAX_EXTENT = 1e4;
+
+// directions for sampling the surface of curved convex shapes
+const std::vector<btVector3> &sphereDirections() {
+    static std::vector<btVector3> dirs;
+    if (dirs.empty()) {
+        const int rings = 12, segments = 24;
+        dirs.push_back(btVector3(0, 0, 1));
+        dirs.push_back(btVector3(0, 0, -1));
+        for (int i = 1; i < rings; ++i) {
+            btScalar theta = SIMD_PI * i / rings;
+            for (int j = 0; j < segments; ++j) {
+                btScalar phi = SIMD_2_PI * j / segments;
+                dirs.push_back(btVector3(btSin(theta) * btCos(phi), btSin(theta) * btSin(phi), btCos(theta)));
+            }
+        }
+    }
+    return dirs;
+}
+
+struct TriangleCollector : public btTriangleCallback {
+    std::vector<btVector3> &m_out;
+    TriangleCollector(std::vector<btVector3> &out) : m_out(out) { }
+    virtual void processTriangle(btVector3 *triangle, int, int) {
+        m_out.push_back(triangle[0]);
+        m_out.push_back(triangle[1]);
+        m_out.push_back(triangle[2]);
+    }
+};
+}
+
+DepthRenderer::DepthRenderer(ThreadPool::Ptr pool) :
+    m_pool(pool), m_tilesX(0), m_tilesY(0) {
+}
+
+const std::vector<btVector3> &DepthRenderer::getTriangles(const btCollisionShape *shape) {
+    std::map<const btCollisionShape *, std::vector<btVector3> >::const_iterator i = m_shapeCache.find(shape);
+    if (i != m_shapeCache.end())
+        return i->second;
+
+    std::vector<btVector3> &tris = m_shapeCache[shape];
+    if (shape->isConvex()) {
+        btAlignedObjectArray<btVector3> pts;
+        if (shape->isPolyhedral()) {
+            const btPolyhedralConvexShape *poly = static_cast<const btPolyhedralConvexShape *>(shape);
+            pts.resize(poly->getNumVertices());
+            for (int j = 0; j < pts.size(); ++j)
+                poly->getVertex(j, pts[j]);
+        } else {
+            const btConvexShape *convex = static_cast<const btConvexShape *>(shape);
+            const std::vector<btVector3> &dirs = sphereDirections();
+            pts.resize(dirs.size());
+            for (int j = 0; j < dirs.size(); ++j)
+                pts[j] = convex->localGetSupportingVertex(dirs[j]);
+        }
+        if (pts.size() == 0)
+            return tris;
+        btConvexHullComputer hull;
+        hull.compute(pts[0].m_floats, sizeof(btVector3), pts.size(), 0, 0);
+        // faces are planar polygons; fan them into triangles
+        for (int f = 0; f < hull.faces.size(); ++f) {
+            const btConvexHullComputer::Edge *first = &hull.edges[hull.faces[f]];
+            int v0 = first->getSourceVertex();
+            for (const btConvexHullComputer::Edge *e = first->getNextEdgeOfFace(); e->getTargetVertex() != v0; e = e->getNextEdgeOfFace()) {
+                tris.push_back(hull.vertices[v0]);
+                tris.push_back(hull.vertices[e->getSourceVertex()]);
+                tris.push_back(hull.vertices[e->getTargetVertex()]);
+            }
+        }
+    } else if (shape->isConcave()) {
+        btVector3 aabbMin, aabbMax;
+        shape->getAabb(btTransform::getIdentity(), aabbMin, aabbMax);
+        aabbMin.setMax(btVector3(-MAX_EXTENT, -MAX_EXTENT, -MAX_EXTENT));
+        aabbMax.setMin(btVector3(MAX_EXTENT, MAX_EXTENT, MAX_EXTENT));
+        TriangleCollector collector(tris);
+        static_cast<const btConcaveShape *>(shape)->processAllTriangles(&collector, aabbMin, aabbMax);
+    }
+    return tris;
+}
+
+void DepthRenderer::addShape(const btCollisionShape *shape, const btTransform &toCam) {
+    if (shape->isCompound()) {
+        const btCompoundShape *compound = static_cast<const btCompoundShape *>(shape);
+        for (int i = 0; i < compound->getNumChildShapes(); ++i)
+            addShape(compound->getChildShape(i), toCam * compound->getChildTransform(i));
+        return;
+    }
+    const std::vector<btVector3> &tris = getTriangles(shape);
+    for (int i = 0; i + 2 < tris.size(); i += 3)
+        addTriangle(toCam * tris[i], toCam * tris[i+1], toCam * tris[i+2]);
+}
+
+// clips a camera frame triangle against the near plane
+void DepthRenderer::addTriangle(const btVector3 &a, const btVector3 &b, const btVector3 &c) {
+    btScalar near = m_frame.near;
+    if (a.z() < near && b.z() < near && c.z() < near)
+        return;
+    if (a.z() >= near && b.z() >= near && c.z() >= near) {
+        projectTriangle(a, b, c);
+        return;
+    }
+    const btVector3 *in[3] = { &a, &b, &c };
+    btVector3 poly[4];
+    int n = 0;
+    for (int i = 0; i < 3; ++i) {
+        const btVector3 &p = *in[i], &q = *in[(i+1) % 3];
+        if (p.z() >= near)
+            poly[n++] = p;
+        if ((p.z() >= near) != (q.z() >= near))
+            poly[n++] = p.lerp(q, (near - p.z()) / (q.z() - p.z()));
+    }
+    for (int i = 1; i + 1 < n; ++i)
+        projectTriangle(poly[0], poly[i], poly[i+1]);
+}
+
+void DepthRenderer::projectTriangle(const btVector3 &a, const btVector3 &b, const btVector3 &c) {
+    const Frame &f = m_frame;
+    const btVector3 *p[3] = { &a, &b, &c };
+    ScreenTriangle t;
+    for (int i = 0; i < 3; ++i) {
+        float invZ = 1 / p[i]->z();
+        t.x[i] = f.fx * p[i]->x() * invZ + f.cx;
+        t.y[i] = f.fy * p[i]->y() * invZ + f.cy;
+        t.invZ[i] = invZ * f.scale; // 1/depth in output units
+    }
+    // pixel (i, j) samples the image point (i, j)
+    t.minX = std::max(0, (int) std::ceil(std::min(t.x[0], std::min(t.x[1], t.x[2]))));
+    t.maxX = std::min(f.width - 1, (int) std::floor(std::max(t.x[0], std::max(t.x[1], t.x[2]))));
+    t.minY = std::max(0, (int) std::ceil(std::min(t.y[0], std::min(t.y[1], t.y[2]))));
+    t.maxY = std::min(f.height - 1, (int) std::floor(std::max(t.y[0], std::max(t.y[1], t.y[2]))));
+    if (t.minX > t.maxX || t.minY > t.maxY)
+        return;
+    float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+    if (area == 0)
+        return;
+    m_triangles.push_back(t);
+}
+
+void DepthRenderer::rasterizeTile(int tile, int threadIndex) {
+    const Frame &f = m_frame;
+    int x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+    int x1 = std::min(f.width, x0 + TILE_SIZE), y1 = std::min(f.height, y0 + TILE_SIZE);
+    const float inf = std::numeric_limits<float>::infinity();
+    float depth[TILE_SIZE * TILE_SIZE];
+    std::fill(depth, depth + TILE_SIZE * TILE_SIZE, inf);
+
+    const std::vector<int> &bin = m_bins[tile];
+    for (int k = 0; k < bin.size(); ++k) {
+        const ScreenTriangle &t = m_triangles[bin[k]];
+        int bx0 = std::max(x0, t.minX), bx1 = std::min(x1 - 1, t.maxX);
+        int by0 = std::max(y0, t.minY), by1 = std::min(y1 - 1, t.maxY);
+        if (bx0 > bx1 || by0 > by1)
+            continue;
+        // edge function i is zero on the edge opposite vertex i; normalized
+        // by the area, the three are the barycentric coordinates
+        float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+        float invArea = 1 / area;
+        float stepX[3], stepY[3], rowStart[3];
+        for (int i = 0; i < 3; ++i) {
+            int j = (i + 1) % 3, l = (i + 2) % 3;
+            stepX[i] = -(t.y[l] - t.y[j]) * invArea;
+            stepY[i] = (t.x[l] - t.x[j]) * invArea;
+            rowStart[i] = ((t.x[l] - t.x[j]) * (by0 - t.y[j]) - (t.y[l] - t.y[j]) * (bx0 - t.x[j])) * invArea;
+        }
+        for (int y = by0; y <= by1; ++y) {
+            float b0 = rowStart[0], b1 = rowStart[1], b2 = rowStart[2];
+            float *row = depth + (y - y0) * TILE_SIZE - x0;
+            for (int x = bx0; x <= bx1; ++x) {
+                if (b0 >= 0 && b1 >= 0 && b2 >= 0) {
+                    float d = 1 / (b0 * t.invZ[0] + b1 * t.invZ[1] + b2 * t.invZ[2]);
+                    if (d < row[x]) row[x] = d;
+                }
+                b0 += stepX[0]; b1 += stepX[1]; b2 += stepX[2];
+            }
+            for (int i = 0; i < 3; ++i) rowStart[i] += stepY[i];
+        }
+    }
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            float d = depth[(y - y0) * TILE_SIZE + (x - x0)];
+            f.out[y * f.width + x] = d == inf ? nan : d;
+        }
+}
+
+void DepthRenderer::render(btCollisionWorld *world, const btTransform &camToWorld,
+                           float fx, float fy, float cx, float cy, int width, int height,
+                           float *out, btScalar scale) {
+    Frame f = { fx, fy, cx, cy, NEAR_DEPTH * scale, width, height, scale, out };
+    m_frame = f;
+
+    m_triangles.clear();
+    btTransform worldToCam = camToWorld.inverse();
+    const btCollisionObjectArray &objs = world->getCollisionObjectArray();
+    for (int i = 0; i < objs.size(); ++i) {
+        const btSoftBody *psb = btSoftBody::upcast(objs[i]);
+        if (psb) {
+            for (int j = 0; j < psb->m_faces.size(); ++j) {
+                const btSoftBody::Face &face = psb->m_faces[j];
+                addTriangle(worldToCam * face.m_n[0]->m_x, worldToCam * face.m_n[1]->m_x, worldToCam * face.m_n[2]->m_x);
+            }
+        } else {
+            addShape(objs[i]->getCollisionShape(), worldToCam * objs[i]->getWorldTransform());
+        }
+    }
+
+    // bin triangles by the tiles their bounding boxes overlap
+    m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    m_bins.resize(m_tilesX * m_tilesY);
+    for (int i = 0; i < m_bins.size(); ++i)
+        m_bins[i].clear();
+    for (int i = 0; i < m_triangles.size(); ++i) {
+        const ScreenTriangle &t = m_triangles[i];
+        for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ++ty)
+            for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; ++tx)
+                m_bins[ty * m_tilesX + tx].push_back(i);
+    }
+
+    m_pool->parallelFor(m_bins.size(), boost::bind(&DepthRenderer::rasterizeTile, this, _1, _2));
+}
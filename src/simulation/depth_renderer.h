@@ -0,0 +1,60 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <vector>
+#include <map>
+#include "thread_pool.h"
+
+// CPU rasterizer that renders a depth image of the collision shapes in a
+// btCollisionWorld, like a simulated Kinect.
+// Convex shapes are drawn as their convex hulls (curved shapes are tessellated
+// from support points), concave shapes as their triangles, compounds child by
+// child and soft bodies as their faces. Tessellations are cached per shape, so
+// call clearShapeCache() after deleting shapes.
+// The image is split into tiles that are rasterized concurrently on a ThreadPool.
+class DepthRenderer {
+public:
+    typedef boost::shared_ptr<DepthRenderer> Ptr;
+
+    // tiles are rasterized on pool, which may be shared with other users
+    explicit DepthRenderer(ThreadPool::Ptr pool);
+
+    // Pinhole camera with focal lengths fx, fy and principal point cx, cy in pixels,
+    // looking along +z of camToWorld with x right and y down (the OpenCV convention).
+    // Writes width*height depths (camera z, not ray length) to out, row by row.
+    // Pixels that see nothing are NaN.
+    // Depths are divided by scale and camToWorld's origin is in world units.
+    void render(btCollisionWorld *world, const btTransform &camToWorld,
+                float fx, float fy, float cx, float cy, int width, int height,
+                float *out, btScalar scale=1);
+
+    void clearShapeCache() { m_shapeCache.clear(); }
+
+    int getNumThreads() const { return m_pool->size(); }
+
+private:
+    struct ScreenTriangle {
+        float x[3], y[3], invZ[3];
+        int minX, maxX, minY, maxY; // pixel bounds, clamped to the image
+    };
+    struct Frame {
+        float fx, fy, cx, cy, near;
+        int width, height;
+        btScalar scale;
+        float *out;
+    };
+
+    ThreadPool::Ptr m_pool;
+    // triangle soups in shape coordinates, 3 vertices per triangle
+    std::map<const btCollisionShape *, std::vector<btVector3> > m_shapeCache;
+    // per frame; kept to reuse their memory
+    std::vector<ScreenTriangle> m_triangles;
+    std::vector<std::vector<int> > m_bins; // triangle indices per tile
+    int m_tilesX, m_tilesY;
+    Frame m_frame;
+
+    const std::vector<btVector3> &getTriangles(const btCollisionShape *shape);
+    void addShape(const btCollisionShape *shape, const btTransform &toCam);
+    void addTriangle(const btVector3 &a, const btVector3 &b, const btVector3 &c);
+    void projectTriangle(const btVector3 &a, const btVector3 &b, const btVector3 &c);
+    void rasterizeTile(int tile, int threadIndex);
+};
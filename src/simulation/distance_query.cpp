@@ -0,0 +1,230 @@
+#include "distance_query.h"
+#include <BulletCollision/CollisionShapes/btTriangleShape.h>
+#include <BulletCollision/CollisionShapes/btStaticPlaneShape.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkEpaPenetrationDepthSolver.h>
+#include <LinearMath/btAabbUtil2.h>
+#include <boost/bind.hpp>
+
+namespace {
+// closest points found so far for one pair of shapes
+struct Closest {
+    bool found;
+    btScalar distance;
+    btVector3 ptA, ptB, normalB2A;
+    btVector3 axis; // GJK separating axis that produced them, in world coordinates
+    Closest() : found(false) { }
+
+    void offer(const Closest &c) {
+        if (c.found && (!found || c.distance < distance))
+            *this = c;
+    }
+    Closest flipped() const {
+        Closest c(*this);
+        c.ptA = ptB; c.ptB = ptA;
+        c.normalB2A = -normalB2A;
+        c.axis = -axis;
+        return c;
+    }
+};
+
+// keeps the deepest point the pair detector reports
+struct GjkResult : public btDiscreteCollisionDetectorInterface::Result {
+    bool found;
+    btScalar depth;
+    btVector3 normalOnB, pointOnB;
+    GjkResult() : found(false) { }
+    virtual void setShapeIdentifiersA(int, int) { }
+    virtual void setShapeIdentifiersB(int, int) { }
+    virtual void addContactPoint(const btVector3 &normalOnBInWorld, const btVector3 &pointInWorld, btScalar d) {
+        if (found && d >= depth) return;
+        found = true;
+        depth = d;
+        normalOnB = normalOnBInWorld;
+        pointOnB = pointInWorld;
+    }
+};
+
+bool aabbsWithin(const btCollisionShape *a, const btTransform &ta,
+                 const btCollisionShape *b, const btTransform &tb, btScalar maxDist) {
+    btVector3 minA, maxA, minB, maxB;
+    a->getAabb(ta, minA, maxA);
+    b->getAabb(tb, minB, maxB);
+    btVector3 pad(maxDist, maxDist, maxDist);
+    minA -= pad;
+    maxA += pad;
+    return TestAabbAgainstAabb2(minA, maxA, minB, maxB);
+}
+
+void convexConvex(const btConvexShape *a, const btTransform &ta, const btConvexShape *b, const btTransform &tb,
+                  btScalar maxDist, const btVector3 &seed, Closest &best) {
+    btVoronoiSimplexSolver simplex;
+    btGjkEpaPenetrationDepthSolver epa;
+    btGjkPairDetector gjk(a, b, &simplex, &epa);
+    gjk.setCachedSeperatingAxis(seed);
+    btGjkPairDetector::ClosestPointInput input;
+    input.m_transformA = ta;
+    input.m_transformB = tb;
+    // GJK measures the distance between the shapes without their margins
+    btScalar bound = maxDist + a->getMargin() + b->getMargin();
+    input.m_maximumDistanceSquared = bound * bound;
+    GjkResult r;
+    gjk.getClosestPoints(input, r, NULL);
+    if (!r.found || r.depth > maxDist) return;
+
+    Closest c;
+    c.found = true;
+    c.distance = r.depth;
+    c.ptB = r.pointOnB;
+    c.ptA = r.pointOnB + r.normalOnB * r.depth;
+    c.normalB2A = r.normalOnB;
+    c.axis = gjk.getCachedSeparatingAxis();
+    best.offer(c);
+}
+
+// convex a against the triangles of concave b that lie near it
+struct TriangleDistanceCallback : public btTriangleCallback {
+    const btConvexShape *m_convex;
+    const btTransform &m_ta, &m_tb;
+    btScalar m_maxDist, m_margin;
+    const btVector3 &m_seed;
+    Closest &m_best;
+    TriangleDistanceCallback(const btConvexShape *convex, const btTransform &ta, const btTransform &tb,
+                             btScalar maxDist, btScalar margin, const btVector3 &seed, Closest &best) :
+        m_convex(convex), m_ta(ta), m_tb(tb), m_maxDist(maxDist), m_margin(margin), m_seed(seed), m_best(best) { }
+    virtual void processTriangle(btVector3 *triangle, int, int) {
+        btTriangleShape tri(triangle[0], triangle[1], triangle[2]);
+        tri.setMargin(m_margin);
+        convexConvex(m_convex, m_ta, &tri, m_tb, m_maxDist, m_seed, m_best);
+    }
+};
+
+void convexConcave(const btConvexShape *a, const btTransform &ta, const btConcaveShape *b, const btTransform &tb,
+                   btScalar maxDist, const btVector3 &seed, Closest &best) {
+    // triangles are enumerated in b's frame
+    btVector3 aabbMin, aabbMax;
+    a->getAabb(tb.inverseTimes(ta), aabbMin, aabbMax);
+    btVector3 pad(maxDist + b->getMargin(), maxDist + b->getMargin(), maxDist + b->getMargin());
+    TriangleDistanceCallback cb(a, ta, tb, maxDist, b->getMargin(), seed, best);
+    b->processAllTriangles(&cb, aabbMin - pad, aabbMax + pad);
+}
+
+// planes are half spaces, so unlike triangles they give the full penetration depth
+void convexPlane(const btConvexShape *a, const btTransform &ta, const btStaticPlaneShape *b, const btTransform &tb,
+                 btScalar maxDist, Closest &best) {
+    const btVector3 &n = b->getPlaneNormal();
+    btTransform aInB = tb.inverseTimes(ta);
+    btVector3 deepest = aInB(a->localGetSupportingVertex(-n * aInB.getBasis()));
+    btScalar distance = n.dot(deepest) - b->getPlaneConstant();
+    if (distance > maxDist) return;
+
+    Closest c;
+    c.found = true;
+    c.distance = distance;
+    c.ptA = tb(deepest);
+    c.ptB = tb(deepest - n * distance);
+    c.normalB2A = tb.getBasis() * n;
+    c.axis = c.normalB2A;
+    best.offer(c);
+}
+
+void closestShapes(const btCollisionShape *a, const btTransform &ta, const btCollisionShape *b, const btTransform &tb,
+                   btScalar maxDist, const btVector3 &seed, Closest &best) {
+    if (a->isCompound()) {
+        const btCompoundShape *compound = static_cast<const btCompoundShape *>(a);
+        for (int i = 0; i < compound->getNumChildShapes(); ++i) {
+            btTransform t = ta * compound->getChildTransform(i);
+            if (aabbsWithin(compound->getChildShape(i), t, b, tb, maxDist))
+                closestShapes(compound->getChildShape(i), t, b, tb, maxDist, seed, best);
+        }
+    } else if (b->isCompound()) {
+        const btCompoundShape *compound = static_cast<const btCompoundShape *>(b);
+        for (int i = 0; i < compound->getNumChildShapes(); ++i) {
+            btTransform t = tb * compound->getChildTransform(i);
+            if (aabbsWithin(a, ta, compound->getChildShape(i), t, maxDist))
+                closestShapes(a, ta, compound->getChildShape(i), t, maxDist, seed, best);
+        }
+    } else if (a->isConvex() && b->isConvex()) {
+        convexConvex(static_cast<const btConvexShape *>(a), ta, static_cast<const btConvexShape *>(b), tb, maxDist, seed, best);
+    } else if (a->isConvex() && b->getShapeType() == STATIC_PLANE_PROXYTYPE) {
+        convexPlane(static_cast<const btConvexShape *>(a), ta, static_cast<const btStaticPlaneShape *>(b), tb, maxDist, best);
+    } else if (a->getShapeType() == STATIC_PLANE_PROXYTYPE && b->isConvex()) {
+        Closest swapped;
+        convexPlane(static_cast<const btConvexShape *>(b), tb, static_cast<const btStaticPlaneShape *>(a), ta, maxDist, swapped);
+        if (swapped.found)
+            best.offer(swapped.flipped());
+    } else if (a->isConvex() && b->isConcave()) {
+        convexConcave(static_cast<const btConvexShape *>(a), ta, static_cast<const btConcaveShape *>(b), tb, maxDist, seed, best);
+    } else if (a->isConcave() && b->isConvex()) {
+        Closest swapped;
+        convexConcave(static_cast<const btConvexShape *>(b), tb, static_cast<const btConcaveShape *>(a), ta, maxDist, -seed, swapped);
+        if (swapped.found)
+            best.offer(swapped.flipped());
+    }
+    // concave against concave: no volume to measure penetration with
+}
+}
+
+DistanceQuery::DistanceQuery(ThreadPool::Ptr pool) :
+    m_pool(pool), m_pairs(NULL), m_maxDist(0) {
+}
+
+bool DistanceQuery::computePair(const btCollisionShape *a, const btTransform &ta,
+                                const btCollisionShape *b, const btTransform &tb,
+                                btScalar maxDist, Result &out) {
+    Closest best;
+    closestShapes(a, ta, b, tb, maxDist, btVector3(0, 1, 0), best);
+    if (!best.found) return false;
+    out.pair = 0;
+    out.distance = best.distance;
+    out.ptA = best.ptA;
+    out.ptB = best.ptB;
+    out.normalB2A = best.normalB2A;
+    return true;
+}
+
+void DistanceQuery::computeCandidate(int i, int threadIndex) {
+    const ObjectPair &p = (*m_pairs)[m_candidates[i]];
+    Closest best;
+    closestShapes(p.first->getCollisionShape(), p.first->getWorldTransform(),
+                  p.second->getCollisionShape(), p.second->getWorldTransform(),
+                  m_maxDist, m_axes[i], best);
+    m_found[i] = best.found;
+    if (!best.found) return;
+    Result &r = m_results[i];
+    r.pair = m_candidates[i];
+    r.distance = best.distance;
+    r.ptA = best.ptA;
+    r.ptB = best.ptB;
+    r.normalB2A = best.normalB2A;
+    if (best.axis.length2() > SIMD_EPSILON)
+        m_axes[i] = best.axis;
+}
+
+void DistanceQuery::compute(const std::vector<ObjectPair> &pairs, btScalar maxDist, std::vector<Result> &out) {
+    m_pairs = &pairs;
+    m_maxDist = maxDist;
+    m_candidates.clear();
+    m_axes.clear();
+    for (int i = 0; i < pairs.size(); ++i) {
+        const btCollisionObject *a = pairs[i].first, *b = pairs[i].second;
+        if (!aabbsWithin(a->getCollisionShape(), a->getWorldTransform(),
+                         b->getCollisionShape(), b->getWorldTransform(), maxDist))
+            continue;
+        m_candidates.push_back(i);
+        std::map<ObjectPair, btVector3>::const_iterator cached = m_axisCache.find(pairs[i]);
+        m_axes.push_back(cached != m_axisCache.end() ? cached->second : btVector3(0, 1, 0));
+    }
+    m_results.resize(m_candidates.size());
+    m_found.assign(m_candidates.size(), 0);
+
+    m_pool->parallelFor(m_candidates.size(), boost::bind(&DistanceQuery::computeCandidate, this, _1, _2));
+
+    for (int i = 0; i < m_candidates.size(); ++i) {
+        if (!m_found[i]) continue;
+        m_axisCache[pairs[m_candidates[i]]] = m_axes[i];
+        out.push_back(m_results[i]);
+    }
+    m_pairs = NULL;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <vector>
+#include <map>
+#include "thread_pool.h"
+
+// Closest points / penetration depth between pairs of collision objects,
+// computed from scratch with GJK/EPA on every call. Unlike the contact
+// manifolds of the dynamics world, results depend only on the current poses.
+// The separating axis found for each object pair is kept and used to seed
+// GJK on the next call, which makes repeated queries on slowly moving
+// objects (e.g. trajectory optimization iterations) converge faster.
+// Convex, compound and concave (triangle mesh, plane) shapes are supported;
+// pairs of two concave shapes are skipped. Static planes are treated as half
+// spaces; against other concave shapes the penetration depth is per triangle,
+// so it is only meaningful near the surface.
+class DistanceQuery {
+public:
+    typedef boost::shared_ptr<DistanceQuery> Ptr;
+    typedef std::pair<btCollisionObject *, btCollisionObject *> ObjectPair;
+
+    struct Result {
+        int pair; // index into the queried pairs
+        btScalar distance; // negative for penetration
+        btVector3 ptA, ptB; // closest points on A and B in world coordinates
+        btVector3 normalB2A; // unit vector from B towards A
+    };
+
+    // pairs are processed on pool, which may be shared with other users
+    explicit DistanceQuery(ThreadPool::Ptr pool);
+
+    // Appends a Result for every pair whose distance is at most maxDist, in pair order.
+    // Pairs whose AABBs are farther apart than maxDist are culled before the narrowphase.
+    void compute(const std::vector<ObjectPair> &pairs, btScalar maxDist, std::vector<Result> &out);
+
+    // closest points of two shapes at the given poses, without culling or caching;
+    // false if they are farther apart than maxDist. Safe to call from any thread
+    static bool computePair(const btCollisionShape *a, const btTransform &ta,
+                            const btCollisionShape *b, const btTransform &tb,
+                            btScalar maxDist, Result &out);
+
+    // forgets the cached separating axes, e.g. after a large jump in configuration
+    void clearCache() { m_axisCache.clear(); }
+
+private:
+    ThreadPool::Ptr m_pool;
+    std::map<ObjectPair, btVector3> m_axisCache;
+
+    // per call
+    const std::vector<ObjectPair> *m_pairs;
+    btScalar m_maxDist;
+    std::vector<int> m_candidates; // indices of pairs that passed the AABB test
+    std::vector<btVector3> m_axes; // per candidate, in and out
+    std::vector<Result> m_results; // per candidate
+    std::vector<char> m_found;
+
+    void computeCandidate(int i, int threadIndex);
+};
@@ -1,15 +1,47 @@
 #include "environment.h"
 #include "openravesupport.h"
 #include "config_bullet.h"
+#include "island_solver.h"
+#include "soft_body_solver.h"
+#include <BulletSoftBody/btSoftBody.h>
+#include <BulletMultiThreaded/PosixThreadSupport.h>
+#include <BulletMultiThreaded/SpuGatheringCollisionDispatcher.h>
+#include <BulletMultiThreaded/SpuNarrowPhaseCollisionTask/SpuGatheringCollisionTask.h>
 
 BulletInstance::BulletInstance() {
+    construct(BulletConfig::numDispatcherThreads, BulletConfig::numSolverThreads,
+              BulletConfig::numSoftBodyThreads, BulletConfig::softBodySimd);
+}
+
+BulletInstance::BulletInstance(int numDispatcherThreads, int numSolverThreads, int numSoftBodyThreads, bool softBodySimd) {
+    construct(numDispatcherThreads, numSolverThreads, numSoftBodyThreads, softBodySimd);
+}
+
+void BulletInstance::construct(int numDispatcherThreads, int numSolverThreads, int numSoftBodyThreads, bool softBodySimd) {
   broadphase = new btDbvtBroadphase();
   //    broadphase = new btAxisSweep3(btVector3(-2*METERS, -2*METERS, -1*METERS), btVector3(2*METERS, 2*METERS, 3*METERS));
     collisionConfiguration = new btSoftBodyRigidBodyCollisionConfiguration();
-    dispatcher = new btCollisionDispatcher(collisionConfiguration);
-    solver = new btSequentialImpulseConstraintSolver;
-    dynamicsWorld = new btSoftRigidDynamicsWorld(dispatcher, broadphase, solver, collisionConfiguration);
+    collisionThreadSupport = NULL;
+    if (numDispatcherThreads > 0) {
+        // pairs the SPU dispatcher can't handle (e.g. soft bodies) fall back to
+        // the regular btCollisionDispatcher path on the calling thread
+        PosixThreadSupport::ThreadConstructionInfo tci("collision", processCollisionTask,
+            createCollisionLocalStoreMemory, numDispatcherThreads);
+        collisionThreadSupport = new PosixThreadSupport(tci);
+        dispatcher = new SpuGatheringCollisionDispatcher(collisionThreadSupport, numDispatcherThreads, collisionConfiguration);
+    } else {
+        dispatcher = new btCollisionDispatcher(collisionConfiguration);
+    }
+    if (numSolverThreads > 0)
+        solver = new IslandParallelConstraintSolver(numSolverThreads);
+    else
+        solver = new btSequentialImpulseConstraintSolver;
+    softBodySolver = numSoftBodyThreads > 0 ? new ParallelSoftBodySolver(numSoftBodyThreads, softBodySimd) : NULL;
+    dynamicsWorld = new btSoftRigidDynamicsWorld(dispatcher, broadphase, solver, collisionConfiguration, softBodySolver);
     dynamicsWorld->getDispatchInfo().m_enableSPU = true;
+    if (numSolverThreads > 0)
+        // hand islands to the solver one at a time instead of merging small ones
+        dynamicsWorld->getSolverInfo().m_minimumSolverBatchSize = 1;
 
     softBodyWorldInfo = &dynamicsWorld->getWorldInfo();
     softBodyWorldInfo->m_broadphase = broadphase;
@@ -21,8 +53,10 @@ BulletInstance::BulletInstance() {
 
 BulletInstance::~BulletInstance() {
     delete dynamicsWorld;
+    delete softBodySolver;
     delete solver;
     delete dispatcher;
+    delete collisionThreadSupport;
     delete collisionConfiguration;
     delete broadphase;
 }
@@ -36,6 +70,14 @@ void BulletInstance::setDefaultGravity() {
   setGravity(BulletConfig::gravity * METERS);
 }
 
+void BulletInstance::updateDirtyAabbs() {
+    for (boost::unordered_set<btCollisionObject *>::iterator i = dirtyAabbs.begin(); i != dirtyAabbs.end(); ++i)
+        // objects that aren't in the world have no proxy
+        if ((*i)->getBroadphaseHandle())
+            dynamicsWorld->updateSingleAabb(*i);
+    dirtyAabbs.clear();
+}
+
 void BulletInstance::contactTest(btCollisionObject *obj,
                                 BulletInstance::CollisionObjectSet &out,
                                 const BulletInstance::CollisionObjectSet *ignore) {
@@ -68,18 +110,40 @@ void Environment::add(EnvironmentObject::Ptr obj) {
     objects.push_back(obj);
     // objects are reponsible for adding themselves
     // to the dynamics world and the osg root
+
+    string name = obj->getName();
+    if (!name.empty())
+        nameIndex.insert(make_pair(name, obj)); // keeps an earlier object with that name
 }
 
 void Environment::remove(EnvironmentObject::Ptr obj) {
     for (ObjectList::iterator i = objects.begin(); i != objects.end(); ++i) {
         if (obj == *i) {
+            string name = obj->getName();
             (*i)->destroy();
             objects.erase(i);
+
+            NameIndex::iterator n = name.empty() ? nameIndex.end() : nameIndex.find(name);
+            if (n != nameIndex.end() && n->second == obj) {
+                nameIndex.erase(n);
+                // fall back to the next object of the same name, if any
+                for (ObjectList::iterator j = objects.begin(); j != objects.end(); ++j) {
+                    if ((*j)->getName() == name) {
+                        nameIndex[name] = *j;
+                        break;
+                    }
+                }
+            }
             return;
         }
     }
 }
 
+EnvironmentObject::Ptr Environment::getObjectByName(const string &name) const {
+    NameIndex::const_iterator i = nameIndex.find(name);
+    return i == nameIndex.end() ? EnvironmentObject::Ptr() : i->second;
+}
+
 void Environment::addConstraint(EnvironmentObject::Ptr cnt) {
     cnt->setEnvironment(this);
     cnt->init();
@@ -106,6 +170,178 @@ void Environment::step(btScalar dt, int maxSubSteps, btScalar fixedTimeStep) {
     }
 }
 
+EnvironmentState::Ptr Environment::saveState() {
+    EnvironmentState::Ptr state(new EnvironmentState);
+    saveState(*state);
+    return state;
+}
+
+void Environment::saveState(EnvironmentState &state) {
+    btSoftRigidDynamicsWorld *world = bullet->dynamicsWorld;
+
+    btCollisionObjectArray &objs = world->getCollisionObjectArray();
+    state.objects.resize(objs.size());
+    state.rigidBodies.clear();
+    for (int i = 0; i < objs.size(); ++i) {
+        state.objects[i] = objs[i];
+        btRigidBody *rb = btRigidBody::upcast(objs[i]);
+        if (!rb) continue;
+        EnvironmentState::RigidBodyState s;
+        s.worldTransform = rb->getWorldTransform();
+        s.interpolationWorldTransform = rb->getInterpolationWorldTransform();
+        s.linearVelocity = rb->getLinearVelocity();
+        s.angularVelocity = rb->getAngularVelocity();
+        s.interpolationLinearVelocity = rb->getInterpolationLinearVelocity();
+        s.interpolationAngularVelocity = rb->getInterpolationAngularVelocity();
+        s.totalForce = rb->getTotalForce();
+        s.totalTorque = rb->getTotalTorque();
+        s.deactivationTime = rb->getDeactivationTime();
+        s.hitFraction = rb->getHitFraction();
+        s.activationState = rb->getActivationState();
+        if (rb->getMotionState())
+            rb->getMotionState()->getWorldTransform(s.motionStateTransform);
+        state.rigidBodies.push_back(s);
+    }
+
+    int numConstraints = world->getNumConstraints();
+    state.constraints.resize(numConstraints);
+    state.constraintStates.resize(numConstraints);
+    for (int i = 0; i < numConstraints; ++i) {
+        btTypedConstraint *cnt = world->getConstraint(i);
+        state.constraints[i] = cnt;
+        state.constraintStates[i].appliedImpulse = cnt->getAppliedImpulse();
+        state.constraintStates[i].enabled = cnt->isEnabled();
+    }
+
+    btDispatcher *dispatcher = world->getDispatcher();
+    int numManifolds = dispatcher->getNumManifolds();
+    state.manifolds.resize(numManifolds);
+    for (int i = 0; i < numManifolds; ++i) {
+        btPersistentManifold *m = dispatcher->getManifoldByIndexInternal(i);
+        EnvironmentState::ManifoldState &s = state.manifolds[i];
+        s.body0 = m->getBody0();
+        s.body1 = m->getBody1();
+        s.numContacts = m->getNumContacts();
+        for (int j = 0; j < s.numContacts; ++j) {
+            s.points[j] = m->getContactPoint(j);
+            s.points[j].m_userPersistentData = NULL;
+        }
+    }
+
+    btSoftBodyArray &softBodies = world->getSoftBodyArray();
+    state.softBodyNodeCounts.resize(softBodies.size());
+    state.softBodyNodes.clear();
+    for (int i = 0; i < softBodies.size(); ++i) {
+        btSoftBody::tNodeArray &nodes = softBodies[i]->m_nodes;
+        state.softBodyNodeCounts[i] = nodes.size();
+        for (int j = 0; j < nodes.size(); ++j) {
+            state.softBodyNodes.push_back(nodes[j].m_x);
+            state.softBodyNodes.push_back(nodes[j].m_q);
+            state.softBodyNodes.push_back(nodes[j].m_v);
+            state.softBodyNodes.push_back(nodes[j].m_f);
+        }
+    }
+}
+
+void Environment::restoreState(const EnvironmentState &state) {
+    btSoftRigidDynamicsWorld *world = bullet->dynamicsWorld;
+
+    // check everything before writing anything, so a refused restore leaves the world as it was
+    btCollisionObjectArray &objs = world->getCollisionObjectArray();
+    if (objs.size() != state.objects.size())
+        throw std::runtime_error("restoreState: collision objects were added or removed since the state was saved");
+    int numConstraints = world->getNumConstraints();
+    if (numConstraints != state.constraints.size())
+        throw std::runtime_error("restoreState: constraints were added or removed since the state was saved");
+    for (int i = 0; i < objs.size(); ++i)
+        if (objs[i] != state.objects[i])
+            throw std::runtime_error("restoreState: state was saved from a different world");
+    for (int i = 0; i < numConstraints; ++i)
+        if (world->getConstraint(i) != state.constraints[i])
+            throw std::runtime_error("restoreState: state was saved from a different world");
+    btSoftBodyArray &softBodies = world->getSoftBodyArray();
+    if (softBodies.size() != state.softBodyNodeCounts.size())
+        throw std::runtime_error("restoreState: soft bodies were added or removed since the state was saved");
+    int numNodes = 0;
+    for (int i = 0; i < softBodies.size(); ++i) {
+        if (softBodies[i]->m_nodes.size() != state.softBodyNodeCounts[i])
+            throw std::runtime_error("restoreState: soft body topology changed since the state was saved");
+        numNodes += state.softBodyNodeCounts[i];
+    }
+    if (4*numNodes != state.softBodyNodes.size())
+        throw std::runtime_error("restoreState: soft body nodes don't match the saved node counts");
+
+    int k = 0;
+    for (int i = 0; i < objs.size(); ++i) {
+        btRigidBody *rb = btRigidBody::upcast(objs[i]);
+        if (!rb) continue;
+        const EnvironmentState::RigidBodyState &s = state.rigidBodies[k++];
+        rb->setWorldTransform(s.worldTransform);
+        rb->setInterpolationWorldTransform(s.interpolationWorldTransform);
+        rb->setLinearVelocity(s.linearVelocity);
+        rb->setAngularVelocity(s.angularVelocity);
+        rb->setInterpolationLinearVelocity(s.interpolationLinearVelocity);
+        rb->setInterpolationAngularVelocity(s.interpolationAngularVelocity);
+        rb->clearForces();
+        rb->applyCentralForce(s.totalForce);
+        rb->applyTorque(s.totalTorque);
+        rb->setDeactivationTime(s.deactivationTime);
+        rb->setHitFraction(s.hitFraction);
+        rb->forceActivationState(s.activationState);
+        rb->updateInertiaTensor();
+        // BulletObject::MotionState ignores setWorldTransform on kinematic
+        // objects, so write the default motion state's transform directly
+        if (btDefaultMotionState *ms = dynamic_cast<btDefaultMotionState *>(rb->getMotionState()))
+            ms->m_graphicsWorldTrans = s.motionStateTransform;
+        else if (rb->getMotionState())
+            rb->getMotionState()->setWorldTransform(s.motionStateTransform);
+        world->updateSingleAabb(rb);
+    }
+
+    for (int i = 0; i < numConstraints; ++i) {
+        btTypedConstraint *cnt = world->getConstraint(i);
+        cnt->internalSetAppliedImpulse(state.constraintStates[i].appliedImpulse);
+        cnt->setEnabled(state.constraintStates[i].enabled);
+    }
+
+    // Manifolds come and go with overlapping pairs, so match them by body pair.
+    // A pair can own several manifolds (one per child shape of a compound);
+    // those are matched in dispatcher order. Manifolds that didn't exist at
+    // save time are emptied and get rebuilt on the next step.
+    typedef std::multimap<std::pair<const void *, const void *>, const EnvironmentState::ManifoldState *> ManifoldMap;
+    ManifoldMap saved;
+    for (int i = 0; i < state.manifolds.size(); ++i)
+        saved.insert(std::make_pair(std::make_pair(state.manifolds[i].body0, state.manifolds[i].body1), &state.manifolds[i]));
+    btDispatcher *dispatcher = world->getDispatcher();
+    for (int i = 0; i < dispatcher->getNumManifolds(); ++i) {
+        btPersistentManifold *m = dispatcher->getManifoldByIndexInternal(i);
+        m->clearManifold();
+        ManifoldMap::iterator it = saved.find(std::make_pair((const void *) m->getBody0(), (const void *) m->getBody1()));
+        if (it == saved.end()) continue;
+        for (int j = 0; j < it->second->numContacts; ++j)
+            m->addManifoldPoint(it->second->points[j]);
+        saved.erase(it);
+    }
+
+    k = 0;
+    for (int i = 0; i < softBodies.size(); ++i) {
+        btSoftBody *psb = softBodies[i];
+        btSoftBody::tNodeArray &nodes = psb->m_nodes;
+        for (int j = 0; j < nodes.size(); ++j) {
+            nodes[j].m_x = state.softBodyNodes[k++];
+            nodes[j].m_q = state.softBodyNodes[k++];
+            nodes[j].m_v = state.softBodyNodes[k++];
+            nodes[j].m_f = state.softBodyNodes[k++];
+        }
+        psb->updateNormals();
+        psb->updateBounds();
+        world->updateSingleAabb(psb);
+    }
+
+    for (ObjectList::iterator i = objects.begin(); i != objects.end(); ++i)
+        (*i)->postRestoreState();
+}
+
 Fork::Fork(const Environment *parentEnv_, BulletInstance::Ptr bullet) :
     parentEnv(parentEnv_), env(new Environment(bullet)) {
   copyObjects();
@@ -8,32 +8,65 @@
 #include <set>
 #include <map>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <iostream>
 #include <stdexcept>
 
 using namespace std;
 
+class btThreadSupportInterface;
+
 struct BulletInstance {
     typedef boost::shared_ptr<BulletInstance> Ptr;
 
     btBroadphaseInterface *broadphase;
     btSoftBodyRigidBodyCollisionConfiguration *collisionConfiguration;
     btCollisionDispatcher *dispatcher;
-    btSequentialImpulseConstraintSolver *solver;
+    btConstraintSolver *solver;
     btSoftRigidDynamicsWorld *dynamicsWorld;
     btSoftBodyWorldInfo *softBodyWorldInfo;
-
+    // worker threads for the narrowphase; NULL when the dispatcher is single-threaded
+    btThreadSupportInterface *collisionThreadSupport;
+    // NULL when the world uses its own btDefaultSoftBodySolver
+    btSoftBodySolver *softBodySolver;
+
+    // numDispatcherThreads > 0 replaces the btCollisionDispatcher with a
+    // SpuGatheringCollisionDispatcher running on that many posix threads.
+    // numSolverThreads > 0 replaces the btSequentialImpulseConstraintSolver with
+    // an IslandParallelConstraintSolver that solves islands concurrently.
+    // numSoftBodyThreads > 0 solves soft body links with a ParallelSoftBodySolver,
+    // on SSE kernels over struct-of-arrays node copies if softBodySimd is set
     BulletInstance();
+    BulletInstance(int numDispatcherThreads, int numSolverThreads=0, int numSoftBodyThreads=0, bool softBodySimd=false);
     ~BulletInstance();
 
+    bool isMultithreaded() const { return collisionThreadSupport != NULL; }
+
     void setGravity(const btVector3 &gravity);
     void setDefaultGravity();
 
+    // Objects moved between simulation steps (e.g. kinematic links positioned by
+    // BulletObject::MotionState::setKinematicPos) leave stale AABBs in the broadphase.
+    // They are marked dirty instead, and updateDirtyAabbs() refreshes the proxies of
+    // just those objects, so collision checks after moving a few links don't pay for
+    // dynamicsWorld->updateAabbs() over the whole world.
+    void markAabbDirty(btCollisionObject *obj) { dirtyAabbs.insert(obj); }
+    // must be called before a dirty object leaves the world
+    void forgetAabbDirty(btCollisionObject *obj) { dirtyAabbs.erase(obj); }
+    void updateDirtyAabbs();
+
     // Populates out with all objects colliding with obj, possibly ignoring some objects
-    // dynamicsWorld->updateAabbs() must be called before contactTest
+    // the broadphase AABBs must be up to date before contactTest
+    // (updateDirtyAabbs() or dynamicsWorld->updateAabbs())
     // see http://bulletphysics.org/Bullet/phpBB3/viewtopic.php?t=4850
     typedef std::set<const btCollisionObject *> CollisionObjectSet;
     void contactTest(btCollisionObject *obj, CollisionObjectSet &out, const CollisionObjectSet *ignore=NULL);
+
+private:
+    boost::unordered_set<btCollisionObject *> dirtyAabbs;
+
+    void construct(int numDispatcherThreads, int numSolverThreads, int numSoftBodyThreads, bool softBodySimd);
 };
 
 struct Environment;
@@ -45,7 +78,7 @@ private:
 public:
     typedef boost::shared_ptr<EnvironmentObject> Ptr;
 
-    EnvironmentObject() { }
+    EnvironmentObject() : env(NULL) { }
     EnvironmentObject(Environment *env_) : env(env_) { }
     virtual ~EnvironmentObject() { }
 
@@ -62,21 +95,76 @@ public:
     // You're free to use f.forkOf()  or f.copyOf() to get equivalent objects in the new env.
     virtual void postCopy(EnvironmentObject::Ptr copy, Fork &f) const { }
 
+    // name under which Environment::getObjectByName finds this object;
+    // empty for anonymous objects. must not change while the object is added
+    virtual std::string getName() const { return std::string(); }
+
     // methods only to be called by the Environment
     void setEnvironment(Environment *env_) { env = env_; }
     virtual void init() { }
     virtual void prePhysics() { }
     virtual void destroy() { }
+    // called after Environment::restoreState has rolled the world back, for
+    // anything cached from the previous poses
+    virtual void postRestoreState() { }
 
 		//gets the index of the closest part of the object (face, capsule, rigid_body, etc)
 		//for rigid bodies, there is only one index so this will always return 0
 		virtual int getIndex(const btTransform& transform) { throw std::runtime_error("getIndex() hasn't been defined yet"); return 0;}
 		virtual int getIndexSize() { std::runtime_error("getIndex() hasn't been defined yet"); return 0;}
+		//getIndex for each of the transforms; objects with many parts answer these from a shared search structure
+		virtual vector<int> getIndices(const vector<btTransform>& transforms) {
+			vector<int> indices(transforms.size());
+			for (int k=0; k<transforms.size(); k++)
+				indices[k] = getIndex(transforms[k]);
+			return indices;
+		}
 		//gets the transform of the indexed part
 		//for rigid bodies, this just returns the rigid body's transform
 		virtual btTransform getIndexTransform(int index) { std::runtime_error("getIndexTransform() hasn't been defined yet"); return btTransform();}
 };
 
+// Snapshot of the simulation state of an Environment, for rolling back in place
+// instead of building a Fork: rigid body poses and velocities, constraint
+// warm-start impulses, contact manifold caches and soft body nodes.
+// A state can only be restored into the Environment that saved it, and only
+// while the same collision objects and constraints are in the world and the
+// soft bodies have as many nodes as when it was saved.
+// OpenRAVE-side state is not included. Replays are exact until new contact
+// pairs appear, since the order of overlapping pairs isn't part of the state.
+struct EnvironmentState {
+    typedef boost::shared_ptr<EnvironmentState> Ptr;
+
+    struct RigidBodyState {
+        btTransform worldTransform, interpolationWorldTransform;
+        btTransform motionStateTransform; // kinematic bodies read their pose from here
+        btVector3 linearVelocity, angularVelocity;
+        btVector3 interpolationLinearVelocity, interpolationAngularVelocity;
+        btVector3 totalForce, totalTorque;
+        btScalar deactivationTime, hitFraction;
+        int activationState;
+    };
+    struct ConstraintState {
+        btScalar appliedImpulse;
+        bool enabled;
+    };
+    struct ManifoldState {
+        const void *body0, *body1;
+        int numContacts;
+        btManifoldPoint points[MANIFOLD_CACHE_SIZE];
+    };
+
+    // collision objects and constraints at save time, to validate restores
+    std::vector<const btCollisionObject *> objects;
+    std::vector<const btTypedConstraint *> constraints;
+
+    std::vector<RigidBodyState> rigidBodies; // one per btRigidBody in objects, in order
+    std::vector<ConstraintState> constraintStates;
+    std::vector<ManifoldState> manifolds;
+    std::vector<int> softBodyNodeCounts; // one per soft body in the world, in order
+    std::vector<btVector3> softBodyNodes; // x, q, v, f for every node of every soft body
+};
+
 class RaveInstance;
 typedef boost::shared_ptr<RaveInstance> RaveInstancePtr;
 struct Environment {
@@ -90,16 +178,28 @@ struct Environment {
     typedef std::vector<EnvironmentObject::Ptr> ConstraintList;
     ConstraintList constraints;
 
+    // named objects, maintained by add/remove. if several objects share a
+    // name, the one added first is indexed
+    typedef boost::unordered_map<std::string, EnvironmentObject::Ptr> NameIndex;
+    NameIndex nameIndex;
+
     Environment(BulletInstance::Ptr bullet_) : bullet(bullet_) { }
     ~Environment();
 
     void add(EnvironmentObject::Ptr obj);
     void remove(EnvironmentObject::Ptr obj);
+    // NULL if there's no object with that name
+    EnvironmentObject::Ptr getObjectByName(const std::string &name) const;
 
     void addConstraint(EnvironmentObject::Ptr cnt);
     void removeConstraint(EnvironmentObject::Ptr cnt);
 
     void step(btScalar dt, int maxSubSteps, btScalar fixedTimeStep);
+
+    EnvironmentState::Ptr saveState();
+    // reuses the buffers in state, so repeated saves don't allocate
+    void saveState(EnvironmentState &state);
+    void restoreState(const EnvironmentState &state);
 };
 
 // An Environment Fork is a wrapper around an Environment with an operator
@@ -119,11 +219,15 @@ public:
 
     typedef std::map<const void *, void *> DataMap;
     DataMap dataMap;
+
     void registerCopy(const void *orig, void *copy) {
         BOOST_ASSERT(copyOf(orig) == NULL && orig && copy);
         dataMap.insert(std::make_pair(orig, copy));
     }
 
+    // Without rave_, the first RaveObject copied clones the OpenRAVE environment
+    // into rave and all others use that clone, so grabbed and grabbing bodies
+    // stay in one environment.
     Fork(const Environment *parentEnv_, BulletInstance::Ptr bullet);
     Fork(const Environment::Ptr parentEnv_, BulletInstance::Ptr bullet);
     Fork(const Environment::Ptr parentEnv_, const RaveInstancePtr rave_, BulletInstance::Ptr bullet);
@@ -198,6 +302,13 @@ public:
                 (*i)->destroy();
     }
 
+    virtual void postRestoreState() {
+        typename ChildVector::iterator i;
+        for (i = children.begin(); i != children.end(); ++i)
+            if (*i)
+                (*i)->postRestoreState();
+    }
+
 		int getIndex(const btTransform& transform) {
 			const btVector3 pos = transform.getOrigin();
 			int j_nearest = -1;
@@ -214,6 +325,24 @@ public:
 			return j_nearest;
 		}
 
+		vector<int> getIndices(const vector<btTransform>& transforms) {
+			vector<int> indices(transforms.size(), -1);
+			vector<float> nearest_length2(transforms.size(), DBL_MAX);
+			for (int i=0; i<children.size(); i++) {
+				const int index_size = children[i]->getIndexSize();
+				const vector<int> child_indices = children[i]->getIndices(transforms);
+				for (int k=0; k<transforms.size(); k++) {
+					const btVector3 center = children[i]->getIndexTransform(child_indices[k]).getOrigin();
+					const float length2 = (transforms[k].getOrigin() - center).length2();
+					if (length2 < nearest_length2[k]) {
+						indices[k] = i*index_size + child_indices[k];
+						nearest_length2[k] = length2;
+					}
+				}
+			}
+			return indices;
+		}
+
 		int getIndexSize() {
 			return children.size() * children[0]->getIndexSize();
 		}
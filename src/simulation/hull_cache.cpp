@@ -0,0 +1,243 @@
+#include "hull_cache.h"
+#include "logging.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char MAGIC[8] = { 'B', 'S', 'H', 'U', 'L', 'L', 'S', '\0' };
+const uint32_t VERSION = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version, numEntries;
+};
+
+uint64_t fnv1a(uint64_t h, const void *data, size_t size) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+}
+
+HullCache::Ptr HullCache::forFile(const std::string &path) {
+    static boost::mutex registryMutex;
+    static std::map<std::string, Ptr> registry;
+    boost::mutex::scoped_lock lock(registryMutex);
+    Ptr &cache = registry[path];
+    if (!cache)
+        cache.reset(new HullCache(path));
+    return cache;
+}
+
+HullCache::HullCache(const std::string &path) :
+    m_path(path), m_data(NULL), m_size(0), m_entries(NULL), m_numEntries(0), m_points(NULL), m_writeFailed(false) {
+    map();
+}
+
+HullCache::~HullCache() {
+    unmap();
+}
+
+uint64_t HullCache::key(const std::vector<btVector3> &vertices, btScalar padding, btScalar margin) {
+    std::vector<float> params(2);
+    params[0] = padding;
+    params[1] = margin;
+    return key(vertices, params);
+}
+
+uint64_t HullCache::key(const std::vector<btVector3> &vertices, const std::vector<float> &params) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint32_t n = vertices.size();
+    h = fnv1a(h, &n, sizeof(n));
+    for (uint32_t i = 0; i < n; ++i) {
+        const float v[3] = { vertices[i].x(), vertices[i].y(), vertices[i].z() };
+        h = fnv1a(h, v, sizeof(v));
+    }
+    return params.empty() ? h : fnv1a(h, &params[0], params.size() * sizeof(float));
+}
+
+void HullCache::map() {
+    int fd = open(m_path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(Header)) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = data;
+            m_size = st.st_size;
+        }
+    }
+    close(fd);
+    if (!m_data) return;
+
+    // check that the file is one of ours and that everything in it is in bounds
+    const Header *header = static_cast<const Header *>(m_data);
+    const size_t entriesEnd = sizeof(Header) + (size_t) header->numEntries * sizeof(Entry);
+    bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 && header->version == VERSION && entriesEnd <= m_size;
+    if (valid) {
+        m_entries = reinterpret_cast<const Entry *>(header + 1);
+        m_numEntries = header->numEntries;
+        m_points = reinterpret_cast<const float *>(static_cast<const char *>(m_data) + entriesEnd);
+        const size_t numPoints = (m_size - entriesEnd) / (3 * sizeof(float));
+        for (uint32_t i = 0; i < m_numEntries && valid; ++i)
+            valid = (uint64_t) m_entries[i].offset + m_entries[i].numPoints <= numPoints &&
+                    (i == 0 || m_entries[i-1].key < m_entries[i].key);
+    }
+    if (!valid) {
+        LOG_WARN("ignoring invalid hull cache " << m_path);
+        unmap();
+    }
+}
+
+void HullCache::unmap() {
+    if (m_data)
+        munmap(m_data, m_size);
+    m_data = NULL;
+    m_size = 0;
+    m_entries = NULL;
+    m_numEntries = 0;
+    m_points = NULL;
+}
+
+const HullCache::Entry *HullCache::findEntry(uint64_t key) const {
+    uint32_t lo = 0, hi = m_numEntries;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (m_entries[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < m_numEntries && m_entries[lo].key == key ? &m_entries[lo] : NULL;
+}
+
+bool HullCache::find(uint64_t key, std::vector<btVector3> &points) const {
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::map<uint64_t, std::vector<btVector3> >::const_iterator pending = m_pending.find(key);
+    if (pending != m_pending.end()) {
+        points = pending->second;
+        return true;
+    }
+    const Entry *entry = findEntry(key);
+    if (!entry) return false;
+    const float *p = m_points + 3 * (size_t) entry->offset;
+    points.resize(entry->numPoints);
+    for (uint32_t i = 0; i < entry->numPoints; ++i, p += 3)
+        points[i].setValue(p[0], p[1], p[2]);
+    return true;
+}
+
+void HullCache::insert(uint64_t key, const std::vector<btVector3> &points) {
+    if (points.empty()) return;
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (!findEntry(key))
+        m_pending[key] = points;
+}
+
+static uint64_t partKey(uint64_t key, uint32_t part) {
+    return fnv1a(fnv1a(14695981039346656037ULL, &key, sizeof(key)), &part, sizeof(part));
+}
+
+bool HullCache::findParts(uint64_t key, std::vector<std::vector<btVector3> > &parts) const {
+    parts.clear();
+    std::vector<btVector3> points;
+    for (uint32_t i = 0; find(partKey(key, i), points); ++i) {
+        if (points.empty()) return true;
+        parts.push_back(points);
+    }
+    return false;
+}
+
+void HullCache::insertParts(uint64_t key, const std::vector<std::vector<btVector3> > &parts) {
+    if (parts.empty()) return;
+    for (uint32_t i = 0; i < parts.size(); ++i)
+        if (parts[i].empty()) return;
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (uint32_t i = 0; i <= parts.size(); ++i) {
+        const uint64_t k = partKey(key, i);
+        if (!findEntry(k))
+            m_pending[k] = i < parts.size() ? parts[i] : std::vector<btVector3>();
+    }
+}
+
+int HullCache::size() const {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_numEntries + m_pending.size();
+}
+
+bool HullCache::flush() {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_pending.empty()) return true;
+    // don't rewrite the whole file for every body loaded after a failure
+    if (m_writeFailed) return false;
+
+    // merge the mapped entries with the pending ones, which are never in the file already
+    std::vector<Entry> entries;
+    entries.reserve(m_numEntries + m_pending.size());
+    std::vector<float> points;
+    std::map<uint64_t, std::vector<btVector3> >::const_iterator pending = m_pending.begin();
+    uint32_t i = 0;
+    while (i < m_numEntries || pending != m_pending.end()) {
+        Entry e;
+        if (pending == m_pending.end() || (i < m_numEntries && m_entries[i].key < pending->first)) {
+            e.key = m_entries[i].key;
+            e.numPoints = m_entries[i].numPoints;
+            const float *p = m_points + 3 * (size_t) m_entries[i].offset;
+            e.offset = points.size() / 3;
+            points.insert(points.end(), p, p + 3 * e.numPoints);
+            ++i;
+        }
+        else {
+            e.key = pending->first;
+            e.numPoints = pending->second.size();
+            e.offset = points.size() / 3;
+            for (uint32_t j = 0; j < e.numPoints; ++j) {
+                const btVector3 &v = pending->second[j];
+                points.push_back(v.x());
+                points.push_back(v.y());
+                points.push_back(v.z());
+            }
+            ++pending;
+        }
+        entries.push_back(e);
+    }
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.numEntries = entries.size();
+
+    // write to a temporary file and rename it over the cache, so that readers
+    // (also in other processes) see either the old or the new file
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp%d", (int) getpid());
+    const std::string tmpPath = m_path + suffix;
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    bool ok = f != NULL;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        ok = ok && (entries.empty() || fwrite(&entries[0], sizeof(Entry), entries.size(), f) == entries.size());
+        ok = ok && (points.empty() || fwrite(&points[0], sizeof(float), points.size(), f) == points.size());
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && rename(tmpPath.c_str(), m_path.c_str()) == 0;
+        if (!ok)
+            remove(tmpPath.c_str());
+    }
+    if (!ok) {
+        LOG_WARN("couldn't write hull cache " << m_path << ", keeping its new hulls in memory");
+        m_writeFailed = true;
+        return false;
+    }
+    LOG_DEBUG("wrote " << m_pending.size() << " new hulls to " << m_path);
+
+    unmap();
+    m_pending.clear();
+    map();
+    return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <LinearMath/btVector3.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Persistent cache of the convex hulls built from trimeshes, so that loading
+// the same model again skips btShapeHull. Hulls are keyed by a hash of the
+// mesh vertices and of the padding and margin they were built with, and are
+// kept in a binary file (e.g. next to the model) that is memory-mapped:
+// a header, the keys sorted with the offset and size of their points, then
+// the points as float triples. New hulls are kept in memory until flush()
+// merges them into the file, which is replaced atomically.
+// Lookups and insertions may come from several threads.
+class HullCache {
+public:
+    typedef boost::shared_ptr<HullCache> Ptr;
+
+    // the cache stored in path, which is created by the first flush() if
+    // missing. There is one HullCache per path in the process.
+    static Ptr forFile(const std::string &path);
+    ~HullCache();
+
+    static uint64_t key(const std::vector<btVector3> &vertices, btScalar padding, btScalar margin);
+    // for hulls that depend on more parameters than padding and margin
+    static uint64_t key(const std::vector<btVector3> &vertices, const std::vector<float> &params);
+
+    // sets points to the cached hull and returns true if there is one for key
+    bool find(uint64_t key, std::vector<btVector3> &points) const;
+    // empty hulls aren't cached
+    void insert(uint64_t key, const std::vector<btVector3> &points);
+    // Several hulls under one key, e.g. the parts of a convex decomposition.
+    // They are stored as single hulls under keys derived from key, followed
+    // by an empty hull that marks the end, so parts with an empty hull (or no
+    // parts at all) aren't cached.
+    bool findParts(uint64_t key, std::vector<std::vector<btVector3> > &parts) const;
+    void insertParts(uint64_t key, const std::vector<std::vector<btVector3> > &parts);
+    // writes the hulls inserted since the last flush; false if that failed,
+    // in which case they're still served from memory and later flushes
+    // don't try again
+    bool flush();
+
+    const std::string &getPath() const { return m_path; }
+    int size() const;
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint32_t offset, numPoints; // in points from the start of the point data
+    };
+
+    std::string m_path;
+    // the mapped file
+    void *m_data;
+    size_t m_size;
+    const Entry *m_entries;
+    uint32_t m_numEntries;
+    const float *m_points;
+
+    std::map<uint64_t, std::vector<btVector3> > m_pending;
+    bool m_writeFailed; // stop trying to write the file
+    mutable boost::mutex m_mutex;
+
+    explicit HullCache(const std::string &path);
+    void map();
+    void unmap();
+    const Entry *findEntry(uint64_t key) const;
+};
@@ -0,0 +1,71 @@
+#include "island_solver.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace {
+template <typename T>
+void copyArray(btAlignedObjectArray<T>& dst, T* src, int n) {
+    dst.resize(n);
+    for (int i = 0; i < n; ++i) dst[i] = src[i];
+}
+
+struct CostGreater {
+    template <typename IslandPtr>
+    bool operator()(const IslandPtr a, const IslandPtr b) const { return a->cost() > b->cost(); }
+};
+}
+
+IslandParallelConstraintSolver::IslandParallelConstraintSolver(int numThreads) :
+    m_pool(std::max(1, numThreads)), m_numIslands(0), m_debugDrawer(NULL), m_dispatcher(NULL) {
+    for (int i = 0; i < m_pool.size(); ++i)
+        m_solvers.push_back(new btSequentialImpulseConstraintSolver);
+}
+
+IslandParallelConstraintSolver::~IslandParallelConstraintSolver() {
+    for (int i = 0; i < m_solvers.size(); ++i) delete m_solvers[i];
+    for (int i = 0; i < m_islands.size(); ++i) delete m_islands[i];
+}
+
+void IslandParallelConstraintSolver::prepareSolve(int numBodies, int numManifolds) {
+    m_numIslands = 0;
+}
+
+btScalar IslandParallelConstraintSolver::solveGroup(btCollisionObject** bodies, int numBodies,
+                                                    btPersistentManifold** manifolds, int numManifolds,
+                                                    btTypedConstraint** constraints, int numConstraints,
+                                                    const btContactSolverInfo& info, btIDebugDraw* debugDrawer,
+                                                    btStackAlloc* stackAlloc, btDispatcher* dispatcher) {
+    // the island manager reuses its body buffer for every island, so copy everything
+    if (m_numIslands == m_islands.size())
+        m_islands.push_back(new Island);
+    Island* island = m_islands[m_numIslands++];
+    copyArray(island->bodies, bodies, numBodies);
+    copyArray(island->manifolds, manifolds, numManifolds);
+    copyArray(island->constraints, constraints, numConstraints);
+    m_info = info;
+    m_debugDrawer = debugDrawer;
+    m_dispatcher = dispatcher;
+    return 0;
+}
+
+void IslandParallelConstraintSolver::solveIsland(int i, int threadIndex) {
+    Island* island = m_order[i];
+    m_solvers[threadIndex]->solveGroup(
+        island->bodies.size() ? &island->bodies[0] : 0, island->bodies.size(),
+        island->manifolds.size() ? &island->manifolds[0] : 0, island->manifolds.size(),
+        island->constraints.size() ? &island->constraints[0] : 0, island->constraints.size(),
+        m_info, m_debugDrawer, NULL, m_dispatcher);
+}
+
+void IslandParallelConstraintSolver::allSolved(const btContactSolverInfo& info, btIDebugDraw* debugDrawer, btStackAlloc* stackAlloc) {
+    if (m_numIslands == 0) return;
+    // biggest islands first so a large rope doesn't end up as the last item on one thread
+    m_order.assign(m_islands.begin(), m_islands.begin() + m_numIslands);
+    std::sort(m_order.begin(), m_order.end(), CostGreater());
+    m_pool.parallelFor(m_numIslands, boost::bind(&IslandParallelConstraintSolver::solveIsland, this, _1, _2));
+    m_numIslands = 0;
+}
+
+void IslandParallelConstraintSolver::reset() {
+    for (int i = 0; i < m_solvers.size(); ++i) m_solvers[i]->reset();
+}
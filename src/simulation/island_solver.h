@@ -0,0 +1,48 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <vector>
+#include "thread_pool.h"
+
+// Constraint solver that solves independent simulation islands concurrently.
+// solveGroup() only records the island; the islands collected during one
+// btDiscreteDynamicsWorld::solveConstraints are solved in allSolved(), largest
+// first, on a ThreadPool with one btSequentialImpulseConstraintSolver per thread.
+// Islands never share dynamic bodies, and static/kinematic bodies are only read
+// by the solver, so no synchronization is needed between islands.
+// Set btContactSolverInfo::m_minimumSolverBatchSize to 1 so that the world hands
+// over islands one by one instead of merging them into batches.
+class IslandParallelConstraintSolver : public btConstraintSolver {
+public:
+    explicit IslandParallelConstraintSolver(int numThreads);
+    virtual ~IslandParallelConstraintSolver();
+
+    virtual void prepareSolve(int numBodies, int numManifolds);
+    virtual btScalar solveGroup(btCollisionObject** bodies, int numBodies,
+                                btPersistentManifold** manifolds, int numManifolds,
+                                btTypedConstraint** constraints, int numConstraints,
+                                const btContactSolverInfo& info, btIDebugDraw* debugDrawer,
+                                btStackAlloc* stackAlloc, btDispatcher* dispatcher);
+    virtual void allSolved(const btContactSolverInfo& info, btIDebugDraw* debugDrawer, btStackAlloc* stackAlloc);
+    virtual void reset();
+
+    int getNumThreads() const { return m_pool.size(); }
+
+private:
+    struct Island {
+        btAlignedObjectArray<btCollisionObject*> bodies;
+        btAlignedObjectArray<btPersistentManifold*> manifolds;
+        btAlignedObjectArray<btTypedConstraint*> constraints;
+        int cost() const { return bodies.size() + manifolds.size() + constraints.size(); }
+    };
+
+    ThreadPool m_pool;
+    std::vector<btSequentialImpulseConstraintSolver*> m_solvers; // one per pool thread
+    std::vector<Island*> m_islands; // reused across steps; only the first m_numIslands are pending
+    std::vector<Island*> m_order;
+    int m_numIslands;
+    btContactSolverInfo m_info;
+    btIDebugDraw* m_debugDrawer;
+    btDispatcher* m_dispatcher;
+
+    void solveIsland(int i, int threadIndex);
+};
@@ -0,0 +1,154 @@
+#include "mesh_util.h"
+#include <LinearMath/btConvexHull.h>
+#include <hacdHACD.h>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
+using namespace std;
+
+namespace {
+struct VertexKey {
+    btScalar x, y, z;
+    explicit VertexKey(const btVector3 &v) : x(v.x()), y(v.y()), z(v.z()) {}
+    bool operator==(const VertexKey &o) const {
+        return x == o.x && y == o.y && z == o.z;
+    }
+};
+
+size_t hash_value(const VertexKey &k) {
+    size_t seed = 0;
+    boost::hash_combine(seed, k.x);
+    boost::hash_combine(seed, k.y);
+    boost::hash_combine(seed, k.z);
+    return seed;
+}
+}
+
+void weldVertices(const vector<btVector3> &triangles, vector<btVector3> &points, vector<int> &indices) {
+    points.clear();
+    indices.clear();
+    boost::unordered_map<VertexKey, int> pointIndex;
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+        int tri[3];
+        for (int c = 0; c < 3; ++c) {
+            const btVector3 &v = triangles[t+c];
+            int &i = pointIndex.insert(make_pair(VertexKey(v), (int) points.size())).first->second;
+            if (i == (int) points.size())
+                points.push_back(v);
+            tri[c] = i;
+        }
+        if (tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0])
+            indices.insert(indices.end(), tri, tri + 3);
+    }
+}
+
+WeldedTriangleMesh::WeldedTriangleMesh(const vector<btVector3> &triangles) {
+    weldVertices(triangles, m_points, m_indices);
+    if (m_indices.empty())
+        return;
+    btIndexedMesh mesh;
+    mesh.m_numTriangles = m_indices.size() / 3;
+    mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char *>(&m_indices[0]);
+    mesh.m_triangleIndexStride = 3 * sizeof(int);
+    mesh.m_numVertices = m_points.size();
+    mesh.m_vertexBase = reinterpret_cast<const unsigned char *>(&m_points[0]);
+    mesh.m_vertexStride = sizeof(btVector3);
+    addIndexedMesh(mesh, PHY_INTEGER);
+}
+
+// direction i of n spread evenly over the sphere along a spiral
+static btVector3 sphereDirection(int i, int n) {
+    const btScalar goldenAngle = SIMD_PI * (3 - btSqrt(btScalar(5)));
+    const btScalar z = 1 - (2*i + 1) / btScalar(n);
+    const btScalar r = btSqrt(1 - z*z);
+    return btVector3(r * btCos(goldenAngle*i), r * btSin(goldenAngle*i), z);
+}
+
+vector<btVector3> limitedHull(const btConvexShape *shape, int maxVertices) {
+    maxVertices = max(maxVertices, 4);
+    const int numDirections = 4 * maxVertices;
+    vector<btVector3> supportPoints(numDirections);
+    for (int i = 0; i < numDirections; ++i)
+        supportPoints[i] = shape->localGetSupportingVertex(sphereDirection(i, numDirections));
+
+    HullDesc desc;
+    desc.mFlags = QF_TRIANGLES;
+    desc.mVcount = numDirections;
+    desc.mVertices = &supportPoints[0];
+    desc.mVertexStride = sizeof(btVector3);
+    desc.mMaxVertices = maxVertices;
+    HullLibrary hullLibrary;
+    HullResult result;
+    vector<btVector3> hull;
+    if (hullLibrary.CreateConvexHull(desc, result) == QE_OK) {
+        hull.assign(&result.m_OutputVertices[0], &result.m_OutputVertices[0] + result.mNumOutputVertices);
+        hullLibrary.ReleaseResult(result);
+    }
+    return hull;
+}
+
+vector<btVector3> extremePoints(const vector<btVector3> &points, int maxPoints) {
+    if ((int) points.size() <= maxPoints)
+        return points;
+    vector<char> taken(points.size(), 0);
+    vector<btVector3> out;
+    const int numDirections = 4 * maxPoints;
+    for (int d = 0; d < numDirections && (int) out.size() < maxPoints; ++d) {
+        const btVector3 dir = sphereDirection(d, numDirections);
+        int best = 0;
+        for (int i = 1; i < points.size(); ++i)
+            if (dir.dot(points[i]) > dir.dot(points[best]))
+                best = i;
+        if (!taken[best])
+            out.push_back(points[best]);
+        taken[best] = 1;
+    }
+    return out;
+}
+
+vector<vector<btVector3> > decomposeConvex(const vector<btVector3> &triangles, float concavity, int maxPartVertices) {
+    vector<btVector3> points;
+    vector<int> indices;
+    weldVertices(triangles, points, indices);
+    vector<vector<btVector3> > parts;
+    if (points.empty())
+        return parts;
+
+    // HACD needs the triangles to share vertices to know which are adjacent
+    vector<HACD::Vec3<HACD::Real> > hacdPoints(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+        hacdPoints[i] = HACD::Vec3<HACD::Real>(points[i].x(), points[i].y(), points[i].z());
+    vector<HACD::Vec3<long> > hacdTriangles(indices.size() / 3);
+    for (size_t t = 0; t < hacdTriangles.size(); ++t)
+        hacdTriangles[t] = HACD::Vec3<long>(indices[3*t], indices[3*t+1], indices[3*t+2]);
+
+    HACD::HACD hacd;
+    if (!hacdTriangles.empty()) {
+        hacd.SetPoints(&hacdPoints[0]);
+        hacd.SetNPoints(hacdPoints.size());
+        hacd.SetTriangles(&hacdTriangles[0]);
+        hacd.SetNTriangles(hacdTriangles.size());
+        hacd.SetCompacityWeight(0.1);
+        hacd.SetVolumeWeight(0.0);
+        // don't split meshes that are convex enough already
+        hacd.SetNClusters(1);
+        hacd.SetNVerticesPerCH(maxPartVertices);
+        // HACD works on the mesh scaled to a bounding box diagonal of 2*scale factor
+        hacd.SetConcavity(concavity * 2 * hacd.GetScaleFactor());
+    }
+    if (!hacdTriangles.empty() && hacd.Compute()) {
+        for (size_t c = 0; c < hacd.GetNClusters(); ++c) {
+            const size_t numPoints = hacd.GetNPointsCH(c), numTriangles = hacd.GetNTrianglesCH(c);
+            if (numPoints == 0) continue;
+            vector<HACD::Vec3<HACD::Real> > partPoints(numPoints);
+            vector<HACD::Vec3<long> > partTriangles(max<size_t>(numTriangles, 1));
+            hacd.GetCH(c, &partPoints[0], &partTriangles[0]);
+            parts.push_back(vector<btVector3>(numPoints));
+            for (size_t i = 0; i < numPoints; ++i)
+                parts.back()[i].setValue(partPoints[i].X(), partPoints[i].Y(), partPoints[i].Z());
+        }
+    }
+    if (parts.empty())
+        parts.push_back(points);
+    return parts;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <BulletCollision/CollisionShapes/btTriangleIndexVertexArray.h>
+#include <BulletCollision/CollisionShapes/btConvexShape.h>
+#include <LinearMath/btVector3.h>
+#include <vector>
+
+// Helpers for turning the trimeshes of OpenRAVE links into convex shapes.
+// Meshes come in as triangle soups: three consecutive vertices per triangle.
+
+// Merges the equal vertices of a triangle soup into points, with indices
+// holding three point indices per triangle. Triangles that collapse to an
+// edge or a point are dropped.
+void weldVertices(const std::vector<btVector3> &triangles,
+                  std::vector<btVector3> &points, std::vector<int> &indices);
+
+// A triangle mesh made of the welded vertices of a triangle soup, which it
+// owns, e.g. for btBvhTriangleMeshShape
+class WeldedTriangleMesh : public btTriangleIndexVertexArray {
+public:
+    explicit WeldedTriangleMesh(const std::vector<btVector3> &triangles);
+
+    const std::vector<btVector3> &getPoints() const { return m_points; }
+    const std::vector<int> &getIndices() const { return m_indices; }
+
+private:
+    std::vector<btVector3> m_points;
+    std::vector<int> m_indices;
+};
+
+// The vertices of the hull of shape, margin included, with at most
+// maxVertices points (and at least 4). Support points of shape are sampled
+// in several times as many directions, and the hull is grown from the ones
+// farthest out until it has maxVertices points.
+// Empty if HullLibrary fails, which it may on degenerate shapes.
+std::vector<btVector3> limitedHull(const btConvexShape *shape, int maxVertices);
+
+// At most maxPoints of points: the ones farthest out along directions spread
+// over the sphere, or all of them if there are no more than maxPoints.
+// A cheap stand-in for a hull when no hull can be built.
+std::vector<btVector3> extremePoints(const std::vector<btVector3> &points, int maxPoints);
+
+// Splits a triangle soup into approximately convex parts with HACD and
+// returns the vertices of the parts' hulls, each with at most
+// maxPartVertices points. concavity is the largest allowed distance between
+// the mesh and a part's hull, as a fraction of the diagonal of the mesh's
+// bounding box. A mesh HACD can't handle comes back as a single part.
+std::vector<std::vector<btVector3> > decomposeConvex(const std::vector<btVector3> &triangles,
+                                                     float concavity, int maxPartVertices);
@@ -5,6 +5,11 @@
 #include "bullet_io.h"
 #include "logging.h"
 #include "config_bullet.h"
+#include "hull_cache.h"
+#include "shape_registry.h"
+#include "thread_pool.h"
+#include "mesh_util.h"
+#include <boost/bind.hpp>
 
 #include <set>
 
@@ -59,12 +64,36 @@ void RaveLinkObject::init() {
   BulletObject::init();
 	rave->rave2bulletsim_links[link] = rigidBody.get();
   rave->bulletsim2rave_links[rigidBody.get()] = link;
+  rigidBody->setUserPointer(this);
 }
 
 void RaveLinkObject::destroy() {
   BulletObject::destroy();
   rave->rave2bulletsim_links.erase(link);
   rave->bulletsim2rave_links.erase(rigidBody.get());
+  rigidBody->setUserPointer(NULL);
+}
+
+static TrimeshMode loadTrimeshMode() {
+  return BulletConfig::convexDecomposition ? CONVEX_DECOMPOSITION : CONVEX_HULL;
+}
+
+// the parallel phase of loading: builds the shapes of all links of the bodies.
+// They stay in the ShapeRegistry while the returned pointers are alive, so the
+// objects created afterwards find them there.
+static std::vector<SharedShape::Ptr> prebuildForLoading(const std::vector<KinBodyPtr> &bodies) {
+  return PrebuildLinkShapes(bodies, loadTrimeshMode(), BulletConfig::numLoadThreads);
+}
+
+static void addBody(Environment::Ptr env, RaveInstance::Ptr rave, OpenRAVE::KinBodyPtr body, bool isKinematic) {
+  if (body->IsRobot()) {
+    LOG_INFO("loading robot " << body->GetName());
+    env->add(RaveRobotObject::Ptr(new RaveRobotObject(
+      rave, boost::dynamic_pointer_cast<RobotBase>(body), loadTrimeshMode(), isKinematic)));
+  } else {
+    LOG_INFO("loading " << body->GetName());
+    env->add(RaveObject::Ptr(new RaveObject(rave, body, loadTrimeshMode(), isKinematic)));
+  }
 }
 
 void LoadFromRave(Environment::Ptr env, RaveInstance::Ptr rave) {
@@ -75,19 +104,17 @@ void LoadFromRave(Environment::Ptr env, RaveInstance::Ptr rave) {
     if (robj) bodiesAlreadyLoaded.insert(robj->body->GetName());
   }
 
-  std::vector<boost::shared_ptr<OpenRAVE::KinBody> > bodies;
+  std::vector<boost::shared_ptr<OpenRAVE::KinBody> > bodies, toLoad;
   rave->env->GetBodies(bodies);
   BOOST_FOREACH(OpenRAVE::KinBodyPtr body, bodies) {
-    if (bodiesAlreadyLoaded.find(body->GetName()) == bodiesAlreadyLoaded.end()) {
-      if (body->IsRobot()) env->add(RaveRobotObject::Ptr(new RaveRobotObject(
-				rave, boost::dynamic_pointer_cast<RobotBase>(body), CONVEX_HULL, BulletConfig::kinematicPolicy <= 1)));
-      else {
-        LOG_INFO("loading " << body->GetName());
-        env->add(RaveObject::Ptr(new RaveObject(rave, body, CONVEX_HULL, BulletConfig::kinematicPolicy == 0)));
-      }
-    }
+    if (bodiesAlreadyLoaded.find(body->GetName()) == bodiesAlreadyLoaded.end())
+      toLoad.push_back(body);
   }
 
+  std::vector<SharedShape::Ptr> shapes = prebuildForLoading(toLoad);
+  BOOST_FOREACH(OpenRAVE::KinBodyPtr body, toLoad)
+    addBody(env, rave, body, body->IsRobot() ? BulletConfig::kinematicPolicy <= 1 : BulletConfig::kinematicPolicy == 0);
+
 }
 
 void GetLoadedBodies(Environment::Ptr env, std::set<string> &bodiesAlreadyLoaded) {
@@ -110,14 +137,8 @@ void LoadFromRaveSingle(Environment::Ptr env, RaveInstance::Ptr rave, OpenRAVE::
     }
   }
 
-  if (body->IsRobot()) {
-    LOG_INFO("loading robot " << body->GetName());
-    env->add(RaveRobotObject::Ptr(new RaveRobotObject(
-      rave, boost::dynamic_pointer_cast<RobotBase>(body), CONVEX_HULL, isKinematic)));
-  } else {
-    LOG_INFO("loading " << body->GetName());
-    env->add(RaveObject::Ptr(new RaveObject(rave, body, CONVEX_HULL, isKinematic)));
-  }
+  std::vector<SharedShape::Ptr> shapes = prebuildForLoading(std::vector<KinBodyPtr>(1, body));
+  addBody(env, rave, body, isKinematic);
 }
 
 // explicit kinematic policy
@@ -128,9 +149,10 @@ void LoadFromRaveExplicit(Environment::Ptr env, RaveInstance::Ptr rave, const ve
   }
   std::vector<boost::shared_ptr<OpenRAVE::KinBody> > bodies;
   rave->env->GetBodies(bodies);
+  std::vector<SharedShape::Ptr> shapes = prebuildForLoading(bodies);
   BOOST_FOREACH(OpenRAVE::KinBodyPtr body, bodies) {
     bool isKinematic = std::find(dynamicNames.begin(), dynamicNames.end(), body->GetName()) == dynamicNames.end();
-    LoadFromRaveSingle(env, rave, body, isKinematic, false);
+    addBody(env, rave, body, isKinematic);
   }
 }
 
@@ -146,13 +168,7 @@ void Load(Environment::Ptr env, RaveInstance::Ptr rave, const string& filename)
 
 
 RaveObject::Ptr getObjectByName(Environment::Ptr env, RaveInstance::Ptr rave, const string& name) {
-  BOOST_FOREACH(EnvironmentObject::Ptr obj, env->objects) {
-    RaveObject::Ptr maybeRO = boost::dynamic_pointer_cast<RaveObject>(obj);
-    if (maybeRO && maybeRO->body->GetName() == name) {
-      return maybeRO;
-    }
-  }
-  return RaveObject::Ptr();
+  return boost::dynamic_pointer_cast<RaveObject>(env->getObjectByName(name));
 }
 
 std::vector<RaveRobotObject::Ptr> getRobots(Environment::Ptr env, RaveInstance::Ptr rave) {
@@ -199,103 +215,196 @@ void RaveObject::destroy() {
 }
 
 
-static RaveLinkObject::Ptr createFromLink(RaveInstance::Ptr rave, KinBody::LinkPtr link,
-        std::vector<boost::shared_ptr<btCollisionShape> >& subshapes,
-        std::vector<boost::shared_ptr<btStridingMeshInterface> >& meshes,
-         TrimeshMode trimeshMode,
-        bool isKinematic) {
-
-  LOG_DEBUG("creating link from " << link->GetName());
-
-#if OPENRAVE_VERSION_MINOR>6
-  const std::vector<boost::shared_ptr<OpenRAVE::KinBody::Link::GEOMPROPERTIES> > & geometries=link->GetGeometries();
-#else
-  const std::list<KinBody::Link::GEOMPROPERTIES> &geometries =link->GetGeometries();
-#endif
-  // sometimes the OpenRAVE link might not even have any geometry data associated with it
-  // (this is the case with the PR2 model). therefore just add an empty BulletObject
-  // pointer so we know to skip it in the future
-  if (geometries.empty()) {
-  	return RaveLinkObject::Ptr();
+typedef KinBody::Link::GEOMPROPERTIES Geometry;
+
+// the triangles of geom's trimesh as consecutive vertices, scaled; empty for
+// other geometries. Shapes are built from these welded into an indexed mesh.
+static std::vector<btVector3> trimeshVertices(const Geometry &geom) {
+  const KinBody::Link::TRIMESH &mesh = geom.GetCollisionMesh();
+  std::vector<btVector3> vertices;
+  if (geom.GetType() != Geometry::GeomTrimesh || mesh.indices.size() < 3)
+    return vertices;
+  vertices.reserve(mesh.indices.size() / 3 * 3);
+  int numBad = 0;
+  for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+    const int *tri = &mesh.indices[t];
+    if (std::min(tri[0], std::min(tri[1], tri[2])) < 0 ||
+        std::max(tri[0], std::max(tri[1], tri[2])) >= (int) mesh.vertices.size()) {
+      ++numBad;
+      continue;
+    }
+    for (int c = 0; c < 3; ++c)
+      vertices.push_back(util::toBtVector(mesh.vertices[tri[c]])*METERS);
   }
+  if (numBad > 0)
+    LOG_WARN("skipped " << numBad << " triangles with invalid vertex indices");
+  return vertices;
+}
 
-//	bool useCompound = geometries.size() > 1;
-	bool useCompound = true;
-  bool useGraphicsMesh = false;
+// everything the shape built by createLinkShape depends on
+static ShapeKey linkShapeKey(const std::vector<const Geometry *> &geoms,
+        const std::vector<std::vector<btVector3> > &vertices, TrimeshMode trimeshMode) {
+  ShapeKey key;
+  key << (int) trimeshMode << (float) METERS << BulletConfig::linkPadding << BulletConfig::margin
+      << BulletConfig::maxHullVertices;
+  if (trimeshMode == CONVEX_DECOMPOSITION)
+    key << BulletConfig::decompositionConcavity;
+  for (int i = 0; i < geoms.size(); ++i) {
+    const Geometry &geom = *geoms[i];
+    key << (int) geom.GetType() << util::toBtTransform(geom.GetTransform(), GeneralConfig::scale);
+    switch (geom.GetType()) {
+    case Geometry::GeomBox:
+      key << util::toBtVector(geom.GetBoxExtents());
+      break;
+    case Geometry::GeomSphere:
+      key << (double) geom.GetSphereRadius();
+      break;
+    case Geometry::GeomCylinder:
+      key << (double) geom.GetCylinderRadius() << (double) geom.GetCylinderHeight();
+      break;
+    case Geometry::GeomTrimesh:
+      key.addVertices(vertices[i].empty() ? NULL : &vertices[i][0], vertices[i].size());
+      break;
+    default:
+      break;
+    }
+  }
+  return key;
+}
 
-	btCompoundShape* compound;
-	if (useCompound) {
-    compound = new btCompoundShape();
-    compound->setMargin(1e-5*METERS); //margin: compound. seems to have no effect when positive but has an effect when negative
-	}
+// the points of the hull of points, padded by linkPadding, with at most maxHullVertices
+// points (at most the 42 directions btShapeHull samples if that's 0). Never empty for
+// nonempty points: if HullLibrary fails on a degenerate point set, the extreme points
+// within that budget stand in for the hull, unpadded.
+static std::vector<btVector3> paddedHull(const std::vector<btVector3> &points) {
+  if (points.empty())
+    return points;
+  btConvexHullShape shape(&points[0].getX(), points.size());
+  shape.setMargin(BulletConfig::linkPadding*METERS); // margin: hull padding
+  std::vector<btVector3> hullPoints;
+  if (BulletConfig::maxHullVertices > 0)
+    hullPoints = limitedHull(&shape, BulletConfig::maxHullVertices);
+  if (hullPoints.empty()) {
+    btShapeHull hull(&shape);
+    hull.buildHull(-666); // note: margin argument not used
+    hullPoints.assign(hull.getVertexPointer(), hull.getVertexPointer() + hull.numVertices());
+  }
+  if (hullPoints.empty()) {
+    const int maxPoints = BulletConfig::maxHullVertices > 0 ? BulletConfig::maxHullVertices : 42;
+    hullPoints = extremePoints(points, maxPoints);
+    LOG_WARN("couldn't build the hull of " << points.size() << " points, using " << hullPoints.size() << " extreme points unpadded");
+  }
+  return hullPoints;
+}
 
+// the hulls of the parts of a trimesh, from the hull cache if it has them
+static std::vector<std::vector<btVector3> > decomposedHulls(const std::vector<btVector3> &verts, HullCache *hullCache) {
+  const int maxPartVertices = 100;
+  std::vector<std::vector<btVector3> > parts;
+  uint64_t partsKey = 0;
+  if (hullCache) {
+    std::vector<float> params;
+    params.push_back(BulletConfig::linkPadding*METERS);
+    params.push_back(BulletConfig::margin*METERS);
+    params.push_back(BulletConfig::decompositionConcavity);
+    params.push_back(maxPartVertices);
+    params.push_back(BulletConfig::maxHullVertices);
+    partsKey = HullCache::key(verts, params);
+    if (hullCache->findParts(partsKey, parts))
+      return parts;
+  }
+  parts = decomposeConvex(verts, BulletConfig::decompositionConcavity, maxPartVertices);
+  for (int i = 0; i < parts.size(); ++i)
+    parts[i] = paddedHull(parts[i]);
+  if (hullCache)
+    hullCache->insertParts(partsKey, parts);
+  return parts;
+}
 
+// the compound shape of a link's geometries
+static SharedShape::Ptr createLinkShape(const std::vector<const Geometry *> &geoms,
+        const std::vector<std::vector<btVector3> > &vertices, TrimeshMode trimeshMode, HullCache *hullCache) {
+  SharedShape::Ptr shared(new SharedShape);
 
-#if OPENRAVE_VERSION_MINOR>6
-	BOOST_FOREACH(const boost::shared_ptr<OpenRAVE::KinBody::Link::GEOMPROPERTIES>& geom, geometries) {
-#else
-	for (std::list<KinBody::Link::GEOMPROPERTIES>::const_iterator geom = geometries.begin(); geom != geometries.end(); ++geom) {
-#endif
+  btCompoundShape* compound = new btCompoundShape();
+  compound->setMargin(1e-5*METERS); //margin: compound. seems to have no effect when positive but has an effect when negative
+  shared->shape.reset(compound);
 
-	  const KinBody::Link::TRIMESH &mesh = geom->GetCollisionMesh();
+  for (int g = 0; g < geoms.size(); ++g) {
+    const Geometry &geom = *geoms[g];
 		boost::shared_ptr<btCollisionShape> subshape;
+		std::vector<boost::shared_ptr<btCollisionShape> > parts; // of a decomposed trimesh
 
-		switch (geom->GetType()) {
-		case KinBody::Link::GEOMPROPERTIES::GeomBox:
+		switch (geom.GetType()) {
+		case Geometry::GeomBox:
       subshape.reset(new btBoxShape(
-        METERS*(util::toBtVector(geom->GetBoxExtents()) + btVector3(1,1,1)*BulletConfig::linkPadding)));
+        METERS*(util::toBtVector(geom.GetBoxExtents()) + btVector3(1,1,1)*BulletConfig::linkPadding)));
 			break;
 
-		case KinBody::Link::GEOMPROPERTIES::GeomSphere:
-      subshape.reset(new btSphereShape(geom->GetSphereRadius()*METERS + BulletConfig::linkPadding*METERS));
+		case Geometry::GeomSphere:
+      subshape.reset(new btSphereShape(geom.GetSphereRadius()*METERS + BulletConfig::linkPadding*METERS));
 			break;
 
-		case KinBody::Link::GEOMPROPERTIES::GeomCylinder:
+		case Geometry::GeomCylinder:
 			// cylinder axis aligned to Y
       subshape.reset(new btCylinderShapeZ(METERS* btVector3(
-        0*BulletConfig::linkPadding + geom->GetCylinderRadius(),
-        0*BulletConfig::linkPadding + geom->GetCylinderRadius(),
-        0*BulletConfig::linkPadding + geom->GetCylinderHeight() / 2.)));
+        0*BulletConfig::linkPadding + geom.GetCylinderRadius(),
+        0*BulletConfig::linkPadding + geom.GetCylinderRadius(),
+        0*BulletConfig::linkPadding + geom.GetCylinderHeight() / 2.)));
 			break;
 
-		case KinBody::Link::GEOMPROPERTIES::GeomTrimesh:
-			if (mesh.indices.size() < 3)
+		case Geometry::GeomTrimesh:
+			if (vertices[g].empty())
 				break;
       else {
-        btTriangleMesh* ptrimesh = new btTriangleMesh();
-        // for some reason adding indices makes everything crash
-        /*
-         printf("-----------\n");
-         for (int z = 0; z < mesh.indices.size(); ++z)
-         printf("%d\n", mesh.indices[z]);
-         printf("-----------\n");*/
-
-
-        for (size_t i = 0; i < mesh.indices.size(); i += 3)
-          ptrimesh->addTriangle(util::toBtVector(mesh.vertices[i])*METERS,
-                      util::toBtVector(mesh.vertices[i+1])*METERS,
-                      util::toBtVector(mesh.vertices[i+2])*METERS);
-        // store the trimesh somewhere so it doesn't get deallocated by the smart pointer
-        meshes.push_back(boost::shared_ptr<btStridingMeshInterface>(ptrimesh));
-
-        if (BulletConfig::graphicsMesh) useGraphicsMesh = true;
+        const std::vector<btVector3> &verts = vertices[g];
 
         if (trimeshMode == CONVEX_HULL) {
-          boost::shared_ptr<btConvexShape> pconvexbuilder(new btConvexTriangleMeshShape(ptrimesh));
-          pconvexbuilder->setMargin(BulletConfig::linkPadding*METERS); // margin: hull padding
-
-          //Create a hull shape to approximate Trimesh
-          boost::shared_ptr<btShapeHull> hull(new btShapeHull(pconvexbuilder.get()));
-          hull->buildHull(-666); // note: margin argument not used
+          std::vector<btVector3> hullPoints;
+          uint64_t hullKey = 0;
+          if (hullCache) {
+            if (BulletConfig::maxHullVertices > 0) {
+              std::vector<float> params;
+              params.push_back(BulletConfig::linkPadding*METERS);
+              params.push_back(BulletConfig::margin*METERS);
+              params.push_back(BulletConfig::maxHullVertices);
+              hullKey = HullCache::key(verts, params);
+            }
+            else hullKey = HullCache::key(verts, BulletConfig::linkPadding*METERS, BulletConfig::margin*METERS);
+          }
+          if (!hullCache || !hullCache->find(hullKey, hullPoints)) {
+            // the hull only depends on the distinct vertices
+            std::vector<btVector3> points;
+            std::vector<int> indices;
+            weldVertices(verts, points, indices);
+            if (points.empty())
+              break;
+            //Create a hull shape to approximate Trimesh
+            hullPoints = paddedHull(points);
+            if (hullCache)
+              hullCache->insert(hullKey, hullPoints);
+          }
 
           btConvexHullShape *convexShape = new btConvexHullShape();
-          for (int i = 0; i < hull->numVertices(); ++i)
-            convexShape->addPoint(hull->getVertexPointer()[i]);
+          for (int i = 0; i < hullPoints.size(); ++i)
+            convexShape->addPoint(hullPoints[i]);
 
           subshape.reset(convexShape);
 
+        } else if (trimeshMode == CONVEX_DECOMPOSITION) {
+          const std::vector<std::vector<btVector3> > hulls = decomposedHulls(verts, hullCache);
+          for (int i = 0; i < hulls.size(); ++i)
+            if (!hulls[i].empty())
+              parts.push_back(boost::shared_ptr<btCollisionShape>(
+                new btConvexHullShape(&hulls[i][0].getX(), hulls[i].size())));
+
         } else { // RAW
-          subshape.reset(new btBvhTriangleMeshShape(ptrimesh, true));
+          WeldedTriangleMesh *mesh = new WeldedTriangleMesh(verts);
+          // store the trimesh somewhere so it doesn't get deallocated by the smart pointer
+          shared->meshes.push_back(boost::shared_ptr<btStridingMeshInterface>(mesh));
+          if (mesh->getIndices().empty())
+            break;
+          subshape.reset(new btBvhTriangleMeshShape(mesh, true));
         }
       }
 			break;
@@ -304,35 +413,124 @@ static RaveLinkObject::Ptr createFromLink(RaveInstance::Ptr rave, KinBody::LinkP
 			break;
 		}
 
-		if (!subshape) {
-			cout << "did not create geom type %d\n", geom->GetType();
+		if (subshape)
+			parts.push_back(subshape);
+		if (parts.empty()) {
+			LOG_WARN("did not create geom type " << geom.GetType());
 			continue;
 		}
 
-		// store the subshape somewhere so it doesn't get deallocated by the smart pointer
-		subshapes.push_back(subshape);
-//		if (geom->GetType() == KinBody::Link::GEOMPROPERTIES::GeomTrimesh) subshape->setMargin(0);
-		subshape->setMargin(BulletConfig::margin*METERS);  //margin: subshape. seems to result in padding convex shape AND increases collision dist on top of that
-		btTransform geomTrans = util::toBtTransform(geom->GetTransform(),GeneralConfig::scale);
-		if (useCompound) compound->addChildShape(geomTrans, subshape.get());
+		btTransform geomTrans = util::toBtTransform(geom.GetTransform(),GeneralConfig::scale);
+		BOOST_FOREACH(boost::shared_ptr<btCollisionShape> &part, parts) {
+			// store the subshape somewhere so it doesn't get deallocated by the smart pointer
+			shared->subshapes.push_back(part);
+//			if (geom.GetType() == Geometry::GeomTrimesh) part->setMargin(0);
+			part->setMargin(BulletConfig::margin*METERS);  //margin: subshape. seems to result in padding convex shape AND increases collision dist on top of that
+			compound->addChildShape(geomTrans, part.get());
+		}
 	}
 
+  return shared;
+}
+
+// The shape of a link from the ShapeRegistry, built if it isn't there: links with
+// equal geometry share one shape, also across environments. NULL if the link has
+// no geometry. May be called from several threads.
+static SharedShape::Ptr getLinkShape(KinBody::LinkPtr link, TrimeshMode trimeshMode, HullCache *hullCache) {
+  std::vector<const Geometry *> geoms;
+#if OPENRAVE_VERSION_MINOR>6
+	BOOST_FOREACH(const boost::shared_ptr<OpenRAVE::KinBody::Link::GEOMPROPERTIES>& geom, link->GetGeometries())
+	  geoms.push_back(geom.get());
+#else
+	const std::list<KinBody::Link::GEOMPROPERTIES> &geometries = link->GetGeometries();
+	for (std::list<KinBody::Link::GEOMPROPERTIES>::const_iterator geom = geometries.begin(); geom != geometries.end(); ++geom)
+	  geoms.push_back(&*geom);
+#endif
+  if (geoms.empty())
+    return SharedShape::Ptr();
+
+  std::vector<std::vector<btVector3> > vertices(geoms.size());
+  for (int g = 0; g < geoms.size(); ++g)
+    vertices[g] = trimeshVertices(*geoms[g]);
+
+  const ShapeKey key = linkShapeKey(geoms, vertices, trimeshMode);
+  SharedShape::Ptr shape = ShapeRegistry::find(key);
+  if (!shape)
+    shape = ShapeRegistry::add(key, createLinkShape(geoms, vertices, trimeshMode, hullCache));
+  return shape;
+}
+
+// hulls of a model built by earlier runs are kept next to the model file
+static HullCache::Ptr hullCacheFor(KinBodyPtr body, TrimeshMode trimeshMode) {
+  if (!BulletConfig::hullCache || trimeshMode == RAW || body->GetXMLFilename().empty())
+    return HullCache::Ptr();
+  return HullCache::forFile(body->GetXMLFilename() + ".hulls");
+}
+
+// linkShapes keeps the link's shape alive
+static RaveLinkObject::Ptr createFromLink(RaveInstance::Ptr rave, KinBody::LinkPtr link,
+        std::vector<SharedShape::Ptr>& linkShapes,
+        TrimeshMode trimeshMode,
+        bool isKinematic,
+        HullCache *hullCache) {
+
+  LOG_DEBUG("creating link from " << link->GetName());
+
+  SharedShape::Ptr shape = getLinkShape(link, trimeshMode, hullCache);
+  // sometimes the OpenRAVE link might not even have any geometry data associated with it
+  // (this is the case with the PR2 model). therefore just add an empty BulletObject
+  // pointer so we know to skip it in the future
+  if (!shape) {
+  	return RaveLinkObject::Ptr();
+  }
+  linkShapes.push_back(shape);
 
 	float mass = isKinematic ? 0 : link->GetMass();
 	if (mass==0 && !isKinematic) LOG_WARN_FMT("warning: link %s is non-kinematic but mass is zero", link->GetName().c_str());
-	RaveLinkObject::Ptr child;
-	if (useCompound) {
-    btTransform childTrans = util::toBtTransform(link->GetTransform(),GeneralConfig::scale);
-	  child.reset(new RaveLinkObject(rave, link, mass, compound, childTrans,isKinematic));
-	}
-	else {
-	  btTransform geomTrans = util::toBtTransform(link->GetTransform() * link->GetGeometry(0)->GetTransform(),METERS);
-    child.reset(new RaveLinkObject(rave, link, mass, subshapes.back(), geomTrans, isKinematic));
-    if (useGraphicsMesh) child->graphicsShape.reset(new btBvhTriangleMeshShape(meshes.back().get(), true));
-	}
+  btTransform childTrans = util::toBtTransform(link->GetTransform(),GeneralConfig::scale);
+  return RaveLinkObject::Ptr(new RaveLinkObject(rave, link, mass, shape->shape, childTrans, isKinematic));
+}
 
-	return child;
+namespace {
+struct LinkShapeJob {
+  KinBody::LinkPtr link;
+  HullCache *hullCache;
+};
 
+void buildLinkShape(int i, const std::vector<LinkShapeJob> &jobs, TrimeshMode trimeshMode,
+                    std::vector<SharedShape::Ptr> &shapes) {
+  shapes[i] = getLinkShape(jobs[i].link, trimeshMode, jobs[i].hullCache);
+}
+}
+
+std::vector<SharedShape::Ptr> PrebuildLinkShapes(const std::vector<KinBodyPtr> &bodies, TrimeshMode trimeshMode, int numThreads) {
+  std::vector<HullCache::Ptr> hullCaches;
+  std::vector<LinkShapeJob> jobs;
+  BOOST_FOREACH(KinBodyPtr body, bodies) {
+    HullCache::Ptr hullCache = hullCacheFor(body, trimeshMode);
+    if (hullCache) hullCaches.push_back(hullCache);
+    BOOST_FOREACH(KinBody::LinkPtr link, body->GetLinks()) {
+      LinkShapeJob job = { link, hullCache.get() };
+      jobs.push_back(job);
+    }
+  }
+
+  std::vector<SharedShape::Ptr> shapes(jobs.size());
+  if (numThreads <= 0)
+    numThreads = std::max(1u, boost::thread::hardware_concurrency());
+  numThreads = std::min<int>(numThreads, jobs.size());
+  if (numThreads > 1) {
+    ThreadPool pool(numThreads);
+    pool.parallelFor(jobs.size(), boost::bind(buildLinkShape, _1, boost::cref(jobs), trimeshMode, boost::ref(shapes)));
+  }
+  else {
+    for (int i = 0; i < jobs.size(); ++i)
+      buildLinkShape(i, jobs, trimeshMode, shapes);
+  }
+
+  BOOST_FOREACH(HullCache::Ptr &hullCache, hullCaches)
+    hullCache->flush();
+  return shapes;
 }
 
 BulletConstraint::Ptr createFromJoint(KinBody::JointPtr joint, std::map<KinBody::LinkPtr, RaveLinkObject::Ptr> linkMap) {
@@ -430,10 +628,14 @@ void RaveObject::initRaveObject(RaveInstance::Ptr rave_, KinBodyPtr body_,
 
 void RaveObject::initRaveObject(RaveInstance::Ptr rave_, KinBodyPtr body_,
 		TrimeshMode trimeshMode, bool isKinematic_) {
+  HullCache::Ptr hullCache = hullCacheFor(body_, trimeshMode);
+
   vector<RaveLinkObject::Ptr> bulletLinks;
   BOOST_FOREACH(KinBody::LinkPtr link, body_->GetLinks()) {
-    bulletLinks.push_back(createFromLink(rave_, link, subshapes, meshes, trimeshMode, isKinematic_));
+    bulletLinks.push_back(createFromLink(rave_, link, linkShapes, trimeshMode, isKinematic_, hullCache.get()));
   }
+  if (hullCache)
+    hullCache->flush();
 
   vector<BulletConstraint::Ptr> constraints_;
   if (!isKinematic_) {
@@ -454,7 +656,8 @@ void RaveObject::initRaveObject(RaveInstance::Ptr rave_, KinBodyPtr body_,
 }
 
 bool RaveObject::detectCollisions() {
-	getEnvironment()->bullet->dynamicsWorld->updateAabbs();
+	// only the links moved since the last check need their AABBs refreshed
+	getEnvironment()->bullet->updateDirtyAabbs();
 
 	BulletInstance::CollisionObjectSet objs;
 	for (int i = 0; i < getChildren().size(); ++i) {
@@ -472,6 +675,101 @@ bool RaveObject::detectCollisions() {
 	return false;
 }
 
+const vector<int> &RaveObject::childrenMovedBy(const vector<int> &dofIndices) {
+	std::map<vector<int>, vector<int> >::const_iterator cached = movedChildrenCache.find(dofIndices);
+	if (cached != movedChildrenCache.end())
+		return cached->second;
+
+	std::set<int> joints;
+	for (int j = 0; j < dofIndices.size(); ++j) {
+		if (dofIndices[j] < 0 || dofIndices[j] >= body->GetDOF())
+			throw runtime_error((boost::format("DOF index %d out of range for %s with %d DOFs")
+					% dofIndices[j] % body->GetName() % body->GetDOF()).str());
+		joints.insert(body->GetJointFromDOFIndex(dofIndices[j])->GetJointIndex());
+	}
+	vector<int> &moved = movedChildrenCache[dofIndices];
+	for (int i = 0; i < children.size(); ++i) {
+		int link = children[i]->link->GetIndex();
+		for (std::set<int>::const_iterator j = joints.begin(); j != joints.end(); ++j) {
+			if (body->DoesAffect(*j, link)) {
+				moved.push_back(i);
+				break;
+			}
+		}
+	}
+	return moved;
+}
+
+namespace {
+// puts the DOF values of a body back when it goes out of scope
+class DOFValuesRestorer {
+public:
+	explicit DOFValuesRestorer(KinBodyPtr body) : m_body(body) { m_body->GetDOFValues(m_saved); }
+	~DOFValuesRestorer() {
+		try {
+			m_body->SetDOFValues(m_saved);
+		} catch (const std::exception &e) {
+			LOG_WARN("failed to restore the DOF values of " << m_body->GetName() << ": " << e.what());
+		}
+	}
+	const vector<dReal> &saved() const { return m_saved; }
+private:
+	KinBodyPtr m_body;
+	vector<dReal> m_saved;
+};
+}
+
+void RaveObject::movedChildPoses(const vector<int> &dofIndices, int n, const dReal *vals, btTransform *out) {
+	const vector<int> &moved = childrenMovedBy(dofIndices);
+	int m = moved.size(), k = dofIndices.size();
+	OpenRAVE::EnvironmentMutex::scoped_lock lock(body->GetEnv()->GetMutex());
+	DOFValuesRestorer restorer(body);
+	vector<dReal> dofs = restorer.saved();
+	for (int s = 0; s < n; ++s) {
+		for (int j = 0; j < k; ++j)
+			dofs[dofIndices[j]] = vals[s * k + j];
+		body->SetDOFValues(dofs);
+		for (int i = 0; i < m; ++i)
+			out[s * m + i] = util::toBtTransform(children[moved[i]]->link->GetTransform(), GeneralConfig::scale);
+	}
+}
+
+void RaveObject::getIgnoredObstacles(vector<const btCollisionObject *> &out) const {
+	out.insert(out.end(), ignoreCollisionObjs.begin(), ignoreCollisionObjs.end());
+}
+
+void RaveRobotObject::getIgnoredObstacles(vector<const btCollisionObject *> &out) const {
+	RaveObject::getIgnoredObstacles(out);
+	typedef map<RaveObject::Ptr, KinBody::LinkPtr>::value_type Targ2GrabberPair;
+	BOOST_FOREACH(const Targ2GrabberPair &targ_grabber, m_targ2grabber)
+		for (int i = 0; i < targ_grabber.first->children.size(); ++i)
+			out.push_back(targ_grabber.first->children[i]->rigidBody.get());
+}
+
+void RaveObject::filterCollisionFree(const vector<int> &dofIndices, int n, const dReal *vals,
+		PoseChecker &checker, vector<bool> &free) {
+	const vector<int> &moved = childrenMovedBy(dofIndices);
+	int m = moved.size();
+
+	// link poses of every configuration, read from OpenRAVE up front so that
+	// the checks can run in parallel
+	vector<btTransform> poses(n * m);
+	movedChildPoses(dofIndices, n, vals, poses.data());
+
+	vector<btCollisionObject *> moving(m);
+	for (int i = 0; i < m; ++i)
+		moving[i] = children[moved[i]]->rigidBody.get();
+	vector<const btCollisionObject *> ignored;
+	for (int i = 0; i < children.size(); ++i)
+		ignored.push_back(children[i]->rigidBody.get());
+	getIgnoredObstacles(ignored);
+
+	vector<char> isFree(n);
+	getEnvironment()->bullet->updateDirtyAabbs();
+	checker.check(getEnvironment()->bullet->dynamicsWorld, moving, ignored, n, poses.data(), isFree.data());
+	free.assign(isFree.begin(), isFree.end());
+}
+
 void RaveRobotObject::setDOFValues(const vector<int> &indices, const vector<dReal> &vals) {
 	robot->SetActiveDOFs(indices);
   robot->SetActiveDOFValues(vals);
@@ -522,12 +820,14 @@ vector<double> RaveRobotObject::getDOFValues() {
 void RaveObject::internalCopy(RaveObject::Ptr o, Fork &f) const {
 	CompoundObject<RaveLinkObject>::internalCopy(o, f); // copies all children
 
-	if (f.rave) {
-	  o->rave = f.rave;
-	}
-	else {
-	  o->rave.reset(new RaveInstance(*rave, OpenRAVE::Clone_Bodies));
-	}
+	// clone the OpenRAVE environment once for the whole fork, not once per object
+	if (!f.rave)
+	  f.rave.reset(new RaveInstance(*rave, OpenRAVE::Clone_Bodies));
+	o->rave = f.rave;
+
+	// the copied children share collision shapes with ours
+	o->linkShapes = linkShapes;
+	o->isKinematic = isKinematic;
 
 	// now we need to set up mappings in the copied robot
 	for (std::map<KinBody::LinkPtr, RaveLinkObject::Ptr>::const_iterator i =
@@ -538,6 +838,8 @@ void RaveObject::internalCopy(RaveObject::Ptr o, Fork &f) const {
 		const int j = childPosMap.find(i->second)->second;
 		const RaveLinkObject::Ptr bulletObj = o->getChildren()[j];
 
+		bulletObj->rave = o->rave;
+		bulletObj->link = raveObj;
 		o->linkMap.insert(std::make_pair(raveObj, bulletObj));
 		o->collisionObjMap.insert(std::make_pair(bulletObj->rigidBody.get(),
 				raveObj));
@@ -550,6 +852,8 @@ void RaveObject::internalCopy(RaveObject::Ptr o, Fork &f) const {
 	}
 
 	o->body = o->rave->env->GetKinBody(body->GetName());
+	o->rave->rave2bulletsim[o->body] = o.get();
+	o->rave->bulletsim2rave[o.get()] = o->body;
 }
 
 EnvironmentObject::Ptr RaveObject::copy(Fork &f) const {
@@ -702,6 +1006,19 @@ bool RobotManipulator::moveByIKUnscaled(
 	return true;
 }
 
+void RobotManipulator::filterCollisionFree(const vector<vector<dReal> > &solutions, PoseChecker &checker, vector<bool> &valid) {
+	const vector<int> &armIndices = manip->GetArmIndices();
+	vector<dReal> vals;
+	vals.reserve(solutions.size() * armIndices.size());
+	for (int i = 0; i < solutions.size(); ++i) {
+		if (solutions[i].size() != armIndices.size())
+			throw runtime_error((boost::format("solution %d has %d values, expected %d for %s")
+					% i % solutions[i].size() % armIndices.size() % manip->GetName()).str());
+		vals.insert(vals.end(), solutions[i].begin(), solutions[i].end());
+	}
+	robot->filterCollisionFree(armIndices, solutions.size(), vals.data(), checker, valid);
+}
+
 float RobotManipulator::getGripperAngle() {
 	vector<int> inds = manip->GetGripperIndices();
 	vector<double> vals = robot->getDOFValues(inds);
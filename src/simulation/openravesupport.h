@@ -4,11 +4,14 @@
 #include <openrave/openrave.h>
 #include <btBulletDynamicsCommon.h>
 #include <vector>
+#include <boost/unordered_map.hpp>
 #include "environment.h"
 #include "basicobjects.h"
 #include "util.h"
 #include "simulation_fwd.h"
 #include "config_bullet.h"
+#include "pose_checker.h"
+#include "shape_registry.h"
 
 using namespace std;
 using namespace OpenRAVE;
@@ -24,8 +27,9 @@ struct RaveInstance {
   std::map<KinBodyPtr, RaveObject*> rave2bulletsim;
   std::map<RaveObject*, KinBodyPtr> bulletsim2rave;
 
-  std::map<KinBody::LinkPtr, btRigidBody*> rave2bulletsim_links;
-  std::map<btRigidBody*, KinBody::LinkPtr> bulletsim2rave_links;
+  // for lookups from a collision object, prefer getRaveLinkObject()
+  boost::unordered_map<KinBody::LinkPtr, btRigidBody*> rave2bulletsim_links;
+  boost::unordered_map<btRigidBody*, KinBody::LinkPtr> bulletsim2rave_links;
 
   RaveInstance();
   RaveInstance(OpenRAVE::EnvironmentBasePtr);
@@ -33,7 +37,9 @@ struct RaveInstance {
   ~RaveInstance();
 };
 
-// Corresponds to an OpenRAVE link
+// Corresponds to an OpenRAVE link.
+// While it is in an environment, its rigid body's user pointer points back to
+// it (see getRaveLinkObject), so no other code may set that user pointer.
 class RaveLinkObject : public BulletObject {
 public:
   typedef boost::shared_ptr<RaveLinkObject> Ptr;
@@ -45,9 +51,22 @@ public:
   RaveLinkObject(RaveInstance::Ptr rave_, KinBody::LinkPtr link_, btScalar mass, boost::shared_ptr<btCollisionShape> cs, const btTransform &initTrans, bool isKinematic_=false);
   void init();
   void destroy();
-  // copying doesn't work!
+
+  // the copy still refers to the parent's rave and link;
+  // RaveObject::internalCopy points it at the fork's
+  EnvironmentObject::Ptr copy(Fork &f) const {
+    Ptr o(new RaveLinkObject(*this));
+    internalCopy(o, f);
+    return o;
+  }
 };
 
+// the RaveLinkObject a collision object belongs to, or NULL if it isn't an
+// OpenRAVE link. O(1), meant for contact and ray callbacks
+inline RaveLinkObject *getRaveLinkObject(const btCollisionObject *obj) {
+  return static_cast<RaveLinkObject *>(obj->getUserPointer());
+}
+
 void LoadFromRave(Environment::Ptr env, RaveInstance::Ptr rave);
 void LoadFromRaveSingle(Environment::Ptr env, RaveInstance::Ptr rave, OpenRAVE::KinBodyPtr body, bool isKinematic, bool checkLoaded=true);
 void LoadFromRaveExplicit(Environment::Ptr env, RaveInstance::Ptr rave, const vector<string> &dynamicNames);
@@ -57,8 +76,15 @@ void GetLoadedBodies(Environment::Ptr env, std::set<string> &bodiesAlreadyLoaded
 enum TrimeshMode {
   CONVEX_HULL, // use btShapeHull
   RAW, // use btBvhTriangleMeshShape (not recommended, makes simulation very slow)
+  CONVEX_DECOMPOSITION, // split into convex parts with HACD, for concave objects
 };
 
+// Builds the shapes of all links of bodies on numThreads threads (0: one per
+// hardware thread) and registers them in the ShapeRegistry, where objects
+// created from the bodies find them while the returned pointers are alive.
+// The Load functions above do this before adding the bodies one by one.
+std::vector<SharedShape::Ptr> PrebuildLinkShapes(const std::vector<KinBodyPtr> &bodies, TrimeshMode trimeshMode, int numThreads);
+
 typedef CompoundObject<RaveLinkObject> CompoundRaveLinkObject;
 // Corresponds to an OpenRAVE KinBody
 class RaveObject : public CompoundRaveLinkObject {
@@ -77,6 +103,7 @@ public:
   void init();
   void destroy();
   void prePhysics();
+  std::string getName() const { return body->GetName(); }
 
   // forking
   EnvironmentObject::Ptr copy(Fork &f) const;
@@ -102,7 +129,7 @@ public:
 
   void ignoreCollisionWith(const btCollisionObject *obj) { ignoreCollisionObjs.insert(obj); }
   // Returns true if the robot's current pose collides with anything in the environment
-  // (this will call updateAabbs() on the dynamicsWorld)
+  // (this refreshes the broadphase AABBs of objects moved since the last check)
   bool detectCollisions();
 
   // Positions the robot according to DOF values in the OpenRAVE model
@@ -111,13 +138,33 @@ public:
   // update's openrave stuff based on bullet
   void updateRave();
 
+  // indices into children of the links whose poses depend on any of the given DOFs
+  // (cached per set of DOFs)
+  const vector<int> &childrenMovedBy(const vector<int> &dofIndices);
+  // Link poses of n configurations, each setting the DOFs dofIndices to a row of vals
+  // (dofIndices.size() values per row): out[s*m + i] is the pose of child
+  // childrenMovedBy(dofIndices)[i] in configuration s, with m children moved. The poses
+  // are read from OpenRAVE under its environment mutex, and the body gets its previous
+  // DOF values back even if OpenRAVE throws.
+  void movedChildPoses(const vector<int> &dofIndices, int n, const dReal *vals, btTransform *out);
+  // Collision check of n configurations, each setting the DOFs dofIndices to a row of
+  // vals (dofIndices.size() values per row), against the rest of the environment:
+  // free[s] is true if configuration s is collision free. Link poses come from OpenRAVE,
+  // which is left in its previous configuration; the Bullet objects aren't moved.
+  // Only the links the DOFs move are checked, in parallel by checker. The object's own
+  // links and the objects from getIgnoredObstacles() aren't obstacles.
+  void filterCollisionFree(const vector<int> &dofIndices, int n, const dReal *vals,
+                           PoseChecker &checker, vector<bool> &free);
+  // objects that collision checks of the moving links don't treat as obstacles,
+  // besides the children
+  virtual void getIgnoredObstacles(vector<const btCollisionObject *> &out) const;
+
   bool getIsKinematic() const { return isKinematic; }
 
 protected:
-  // these two containers just keep track of the smart pointers
-  // so that the objects get deallocated on destruction
-  std::vector<boost::shared_ptr<btStridingMeshInterface> > meshes;
-  std::vector<boost::shared_ptr<btCollisionShape> > subshapes;
+  // the link shapes from the ShapeRegistry, with the meshes and subshapes
+  // they point to. these are shared with forks and other environments
+  std::vector<SharedShape::Ptr> linkShapes;
 
   // for looking up the associated Bullet object for an OpenRAVE link
   std::map<KinBody::LinkPtr, RaveLinkObject::Ptr> linkMap;
@@ -133,6 +180,9 @@ protected:
   // vector of objects to ignore collision with
   BulletInstance::CollisionObjectSet ignoreCollisionObjs;
 
+  // DOF indices -> childrenMovedBy
+  std::map<vector<int>, vector<int> > movedChildrenCache;
+
   // initializes the children vector with pre-created BulletObjects (bulletLinks.size() == body_->GetLinks().size()) and arbitrary constraints
   void initRaveObject(RaveInstance::Ptr rave_, KinBodyPtr body_, const vector<RaveLinkObject::Ptr> &bulletLinks, const vector<BulletConstraint::Ptr> &constraints_, bool isKinematic_);
   // for the loaded robot, this will create BulletObjects
@@ -184,6 +234,8 @@ public:
 protected:
   std::vector<RobotManipulatorPtr> createdManips;
   RaveRobotObject() {}
+  // grabbed objects move with the robot
+  void getIgnoredObstacles(vector<const btCollisionObject *> &out) const;
 };
 
 struct RobotManipulator {
@@ -220,6 +272,13 @@ struct RobotManipulator {
   vector<double> getDOFValues();
   void setDOFValues(const vector<double>& vals);
 
+  // Validity mask of many arm configurations, e.g. all solutions from solveAllIK:
+  // valid[i] is true if the arm links at solutions[i] don't collide with the environment.
+  // Unlike setDOFValues + detectCollisions per solution, the Bullet links aren't moved and
+  // links the arm doesn't move aren't checked (see RaveObject::filterCollisionFree).
+  // Solutions are checked in parallel by checker, e.g. one on the environment's query pool.
+  void filterCollisionFree(const vector<vector<dReal> > &solutions, PoseChecker &checker, vector<bool> &valid);
+
   // Moves the manipulator with IK to targetTrans in unscaled coordinates
   // Returns false if IK cannot find a solution
   // If checkCollisions is true, then this will return false if the new
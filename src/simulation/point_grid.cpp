@@ -0,0 +1,166 @@
+#include "point_grid.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+PointGrid::PointGrid() : m_min(0, 0, 0), m_max(0, 0, 0), m_invCellSize(0), m_cellSize(0) {
+    m_dims[0] = m_dims[1] = m_dims[2] = 1;
+    m_cellStarts.assign(2, 0);
+}
+
+int PointGrid::cellCoord(btScalar x, int axis) const {
+    btScalar c = std::floor((x - m_min[axis]) * m_invCellSize);
+    if (c < 0) return 0;
+    if (c >= m_dims[axis]) return m_dims[axis] - 1;
+    return (int) c;
+}
+
+btScalar PointGrid::boxDist2(btScalar x, int cell, int axis) const {
+    const btScalar lo = m_min[axis] + cell * m_cellSize;
+    if (x < lo) return (lo - x) * (lo - x);
+    const btScalar hi = cell == m_dims[axis] - 1 ? m_max[axis] : lo + m_cellSize;
+    if (x > hi) return (x - hi) * (x - hi);
+    return 0;
+}
+
+int PointGrid::cellOf(const btVector3 &p) const {
+    return (cellCoord(p.z(), 2) * m_dims[1] + cellCoord(p.y(), 1)) * m_dims[0] + cellCoord(p.x(), 0);
+}
+
+void PointGrid::build(const std::vector<btVector3> &points) {
+    const int n = points.size();
+    m_dims[0] = m_dims[1] = m_dims[2] = 1;
+    m_cellSize = m_invCellSize = 0;
+    m_min.setValue(0, 0, 0);
+    m_max.setValue(0, 0, 0);
+
+    if (n > 0) {
+        m_min = m_max = points[0];
+        for (int i = 1; i < n; ++i) {
+            m_min.setMin(points[i]);
+            m_max.setMax(points[i]);
+        }
+        const btVector3 extent = m_max - m_min;
+        const btScalar maxExtent = extent[extent.maxAxis()];
+
+        // about two points per cell, spread over the axes along which the points
+        // extend by at least a cell (so a cloth lying flat gets a flat grid)
+        if (maxExtent > 0) {
+            bool spread[3] = { true, true, true };
+            for (bool changed = true; changed; ) {
+                btScalar volume = 1;
+                int numAxes = 0;
+                for (int a = 0; a < 3; ++a) {
+                    if (spread[a] && extent[a] > 0) {
+                        volume *= extent[a];
+                        ++numAxes;
+                    }
+                    else spread[a] = false;
+                }
+                m_cellSize = std::pow(volume / btMax(n / 2, 1), btScalar(1) / numAxes);
+                changed = false;
+                for (int a = 0; a < 3; ++a) {
+                    if (spread[a] && extent[a] < m_cellSize && a != extent.maxAxis()) {
+                        spread[a] = false;
+                        changed = true;
+                    }
+                }
+            }
+            m_cellSize = btMin(m_cellSize, maxExtent);
+            m_invCellSize = 1 / m_cellSize;
+            for (int a = 0; a < 3; ++a)
+                m_dims[a] = std::min((int) (extent[a] * m_invCellSize) + 1, n);
+        }
+    }
+
+    // counting sort of the points by cell
+    const int numCells = m_dims[0] * m_dims[1] * m_dims[2];
+    std::vector<int> cells(n);
+    m_cellStarts.assign(numCells + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        cells[i] = cellOf(points[i]);
+        ++m_cellStarts[cells[i] + 1];
+    }
+    for (int c = 0; c < numCells; ++c)
+        m_cellStarts[c + 1] += m_cellStarts[c];
+    std::vector<int> fill(m_cellStarts.begin(), m_cellStarts.end() - 1);
+    m_points.resize(n);
+    m_index.resize(n);
+    for (int i = 0; i < n; ++i) {
+        const int k = fill[cells[i]]++;
+        m_points[k] = points[i];
+        m_index[k] = i;
+    }
+}
+
+int PointGrid::nearest(const btVector3 &p) const {
+    if (m_points.empty()) return -1;
+
+    int c[3];
+    for (int a = 0; a < 3; ++a)
+        c[a] = cellCoord(p[a], a);
+
+    // how far p is outside the bounds of the points along each axis
+    btScalar outside[3], outside2 = 0;
+    for (int a = 0; a < 3; ++a) {
+        outside[a] = btMax(btMax(m_min[a] - p[a], p[a] - m_max[a]), btScalar(0));
+        outside2 += outside[a] * outside[a];
+    }
+
+    int best = -1;
+    btScalar bestDist2 = std::numeric_limits<btScalar>::max();
+    for (int r = 0; ; ++r) {
+        // the cells at Chebyshev distance r from c
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = std::max(c[a] - r, 0);
+            hi[a] = std::min(c[a] + r, m_dims[a] - 1);
+        }
+        for (int z = lo[2]; z <= hi[2]; ++z) {
+            const bool zShell = std::abs(z - c[2]) == r;
+            const btScalar dz2 = boxDist2(p.z(), z, 2);
+            if (dz2 > bestDist2) continue;
+            for (int y = lo[1]; y <= hi[1]; ++y) {
+                const bool yzShell = zShell || std::abs(y - c[1]) == r;
+                const btScalar dyz2 = dz2 + boxDist2(p.y(), y, 1);
+                if (dyz2 > bestDist2) continue;
+                const int row = (z * m_dims[1] + y) * m_dims[0];
+                // off the shell in y and z only the ends of the row are at distance r
+                const int xStep = yzShell || r == 0 ? 1 : 2 * r;
+                for (int x = c[0] - r; x <= c[0] + r; x += xStep) {
+                    if (x < lo[0] || x > hi[0] || dyz2 + boxDist2(p.x(), x, 0) > bestDist2) continue;
+                    const int cell = row + x;
+                    for (int k = m_cellStarts[cell]; k < m_cellStarts[cell + 1]; ++k) {
+                        const btScalar d2 = p.distance2(m_points[k]);
+                        if (d2 < bestDist2 || (d2 == bestDist2 && m_index[k] < best)) {
+                            bestDist2 = d2;
+                            best = m_index[k];
+                        }
+                    }
+                }
+            }
+        }
+
+        // any point not visited yet is beyond one of the faces of the searched
+        // block that aren't on the boundary of the grid, and within the bounds
+        // of the points along the other axes
+        bool covered = true;
+        btScalar bound2 = std::numeric_limits<btScalar>::max();
+        for (int a = 0; a < 3; ++a) {
+            const btScalar others2 = outside2 - outside[a] * outside[a];
+            if (c[a] - r > 0) {
+                covered = false;
+                const btScalar d = p[a] - (m_min[a] + (c[a] - r) * m_cellSize);
+                bound2 = btMin(bound2, others2 + (d > 0 ? d * d : 0));
+            }
+            if (c[a] + r < m_dims[a] - 1) {
+                covered = false;
+                const btScalar d = m_min[a] + (c[a] + r + 1) * m_cellSize - p[a];
+                bound2 = btMin(bound2, others2 + (d > 0 ? d * d : 0));
+            }
+        }
+        if (covered || bound2 > bestDist2)
+            break;
+    }
+    return best;
+}
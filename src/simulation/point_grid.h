@@ -0,0 +1,33 @@
+#pragma once
+#include <LinearMath/btVector3.h>
+#include <vector>
+
+// Uniform grid over a set of points for nearest-point queries, e.g. over the
+// face centroids of a soft body. The grid is rebuilt from scratch in O(n) by
+// build(); cells are sized for a couple of points each over the extent of the
+// points (flat point sets get a flat grid). Queries search rings of cells
+// around the query point until no closer point can remain, so points far
+// outside the bounds of the set are answered too.
+class PointGrid {
+public:
+    PointGrid();
+
+    void build(const std::vector<btVector3> &points);
+    int size() const { return m_points.size(); }
+
+    // index of the point closest to p (the lowest one on ties), -1 if the grid is empty
+    int nearest(const btVector3 &p) const;
+
+private:
+    std::vector<btVector3> m_points; // in cell order
+    std::vector<int> m_index; // original index of m_points[i]
+    std::vector<int> m_cellStarts; // cell c holds [m_cellStarts[c], m_cellStarts[c+1])
+    btVector3 m_min, m_max; // bounds of the points
+    btScalar m_invCellSize, m_cellSize;
+    int m_dims[3];
+
+    int cellCoord(btScalar x, int axis) const;
+    int cellOf(const btVector3 &p) const;
+    // squared distance along axis from x to the part of the cell's slab within the bounds
+    btScalar boxDist2(btScalar x, int cell, int axis) const;
+};
@@ -0,0 +1,60 @@
+#include "pose_checker.h"
+#include "distance_query.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace {
+struct CandidateCollector : public btBroadphaseAabbCallback {
+    std::vector<const btCollisionObject *> &m_out;
+    const std::vector<const btCollisionObject *> &m_excluded;
+    CandidateCollector(std::vector<const btCollisionObject *> &out, const std::vector<const btCollisionObject *> &excluded) :
+        m_out(out), m_excluded(excluded) { }
+    virtual bool process(const btBroadphaseProxy *proxy) {
+        const btCollisionObject *obj = static_cast<const btCollisionObject *>(proxy->m_clientObject);
+        if (!std::binary_search(m_excluded.begin(), m_excluded.end(), obj))
+            m_out.push_back(obj);
+        return true;
+    }
+};
+}
+
+PoseChecker::PoseChecker(ThreadPool::Ptr pool) : m_pool(pool) {
+    m_candidates.resize(m_pool->size());
+}
+
+bool PoseChecker::collides(const btCollisionShape *shape, const btTransform &pose,
+                           btCollisionWorld *world, std::vector<const btCollisionObject *> &candidates) const {
+    btVector3 aabbMin, aabbMax;
+    shape->getAabb(pose, aabbMin, aabbMax);
+    candidates.clear();
+    CandidateCollector collector(candidates, m_excluded);
+    world->getBroadphase()->aabbTest(aabbMin, aabbMax, collector);
+    for (int i = 0; i < candidates.size(); ++i) {
+        DistanceQuery::Result r;
+        if (DistanceQuery::computePair(shape, pose, candidates[i]->getCollisionShape(),
+                                       candidates[i]->getWorldTransform(), 0, r) && r.distance < 0)
+            return true;
+    }
+    return false;
+}
+
+void PoseChecker::checkConfiguration(int s, int threadIndex, const Batch &b) {
+    const std::vector<btCollisionObject *> &moving = *b.moving;
+    b.free[s] = 1;
+    for (int i = 0; i < moving.size(); ++i) {
+        if (collides(moving[i]->getCollisionShape(), b.poses[s * moving.size() + i], b.world, m_candidates[threadIndex])) {
+            b.free[s] = 0;
+            return;
+        }
+    }
+}
+
+void PoseChecker::check(btCollisionWorld *world, const std::vector<btCollisionObject *> &moving,
+                        const std::vector<const btCollisionObject *> &ignored,
+                        int n, const btTransform *poses, char *free) {
+    m_excluded.assign(moving.begin(), moving.end());
+    m_excluded.insert(m_excluded.end(), ignored.begin(), ignored.end());
+    std::sort(m_excluded.begin(), m_excluded.end());
+    Batch b = { world, &moving, poses, free };
+    m_pool->parallelFor(n, boost::bind(&PoseChecker::checkConfiguration, this, _1, _2, boost::cref(b)));
+}
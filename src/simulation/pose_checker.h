@@ -0,0 +1,42 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <vector>
+#include "thread_pool.h"
+
+// Discrete collision checks of a set of objects (e.g. the links of a robot arm)
+// at many candidate poses against the rest of a btCollisionWorld, e.g. to pick
+// the collision-free ones among IK solutions. The objects are not moved: each
+// configuration reads its poses from an array, finds obstacles with the world's
+// broadphase and tests them with GJK/EPA, stopping at the first collision.
+// Configurations are checked concurrently on a ThreadPool.
+class PoseChecker {
+public:
+    typedef boost::shared_ptr<PoseChecker> Ptr;
+
+    // configurations are checked on pool, which may be shared with other users
+    explicit PoseChecker(ThreadPool::Ptr pool);
+
+    // Places moving[i] at poses[s*m + i] (m = moving.size()) for each configuration
+    // s in [0, n) and sets free[s] to 0 if any of them penetrates an obstacle, 1 otherwise.
+    // The moving objects and the ignored ones are not obstacles.
+    // Obstacles are found with the broadphase AABBs, which must be up to date.
+    void check(btCollisionWorld *world, const std::vector<btCollisionObject *> &moving,
+               const std::vector<const btCollisionObject *> &ignored,
+               int n, const btTransform *poses, char *free);
+
+private:
+    struct Batch {
+        btCollisionWorld *world;
+        const std::vector<btCollisionObject *> *moving;
+        const btTransform *poses;
+        char *free;
+    };
+
+    ThreadPool::Ptr m_pool;
+    std::vector<const btCollisionObject *> m_excluded; // sorted, per call
+    std::vector<std::vector<const btCollisionObject *> > m_candidates; // per pool thread
+
+    void checkConfiguration(int s, int threadIndex, const Batch &batch);
+    bool collides(const btCollisionShape *shape, const btTransform &pose,
+                  btCollisionWorld *world, std::vector<const btCollisionObject *> &candidates) const;
+};
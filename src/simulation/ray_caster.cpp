@@ -0,0 +1,127 @@
+#include "ray_caster.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace {
+// rays per work item; large enough to amortize claiming, small enough to balance
+// rays that hit the robot against rays that miss everything
+const int PACKET_SIZE = 256;
+// unbounded shapes like btStaticPlaneShape report AABBs of +-BT_LARGE_FLOAT,
+// which overflow the tree's volume heuristics in single precision
+const btScalar MAX_EXTENT = 1e8;
+
+// closest hit, remembering which of the RayCaster's objects it came from
+struct ClosestHitCallback : public btCollisionWorld::RayResultCallback {
+    int m_current, m_hitIndex;
+    btVector3 m_hitNormal;
+    ClosestHitCallback() : m_current(-1), m_hitIndex(-1) { }
+    virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult &rayResult, bool normalInWorldSpace) {
+        m_closestHitFraction = rayResult.m_hitFraction;
+        m_collisionObject = rayResult.m_collisionObject;
+        m_hitIndex = m_current;
+        m_hitNormal = normalInWorldSpace ? rayResult.m_hitNormalLocal
+            : m_collisionObject->getWorldTransform().getBasis() * rayResult.m_hitNormalLocal;
+        return rayResult.m_hitFraction;
+    }
+};
+}
+
+RayCaster::RayCaster(const std::vector<btCollisionObject *> &objects, ThreadPool::Ptr pool) :
+    m_objects(objects), m_pool(pool) {
+    m_leaves.resize(m_objects.size());
+    m_transforms.resize(m_objects.size());
+    for (int i = 0; i < m_objects.size(); ++i) {
+        m_transforms[i] = m_objects[i]->getWorldTransform();
+        m_leaves[i] = m_tree.insert(volumeOf(i), NULL);
+        m_leaves[i]->dataAsInt = i;
+    }
+    m_tree.optimizeTopDown();
+    m_stacks.resize(m_pool->size());
+}
+
+RayCaster::~RayCaster() {
+    m_tree.clear();
+}
+
+btDbvtVolume RayCaster::volumeOf(int i) const {
+    btVector3 aabbMin, aabbMax;
+    m_objects[i]->getCollisionShape()->getAabb(m_transforms[i], aabbMin, aabbMax);
+    aabbMin.setMax(btVector3(-MAX_EXTENT, -MAX_EXTENT, -MAX_EXTENT));
+    aabbMax.setMin(btVector3(MAX_EXTENT, MAX_EXTENT, MAX_EXTENT));
+    return btDbvtVolume::FromMM(aabbMin, aabbMax);
+}
+
+void RayCaster::update() {
+    for (int i = 0; i < m_objects.size(); ++i) {
+        const btTransform &t = m_objects[i]->getWorldTransform();
+        if (t == m_transforms[i]) continue;
+        m_transforms[i] = t;
+        btDbvtVolume vol = volumeOf(i);
+        m_tree.update(m_leaves[i], vol);
+    }
+}
+
+void RayCaster::castOne(const btVector3 &from, const btVector3 &to, btAlignedObjectArray<const btDbvtNode *> &stack,
+                        int &hitIndex, btVector3 &hitNormal, btScalar &hitFraction) const {
+    ClosestHitCallback cb;
+    if (m_tree.m_root) {
+        // parametrize by the unnormalized direction so the tree's ray parameter is the hit fraction
+        btVector3 dir = to - from;
+        btVector3 invDir(dir[0] == 0 ? BT_LARGE_FLOAT : 1 / dir[0],
+                         dir[1] == 0 ? BT_LARGE_FLOAT : 1 / dir[1],
+                         dir[2] == 0 ? BT_LARGE_FLOAT : 1 / dir[2]);
+        unsigned int signs[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
+        btTransform fromTrans(btMatrix3x3::getIdentity(), from), toTrans(btMatrix3x3::getIdentity(), to);
+
+        stack.resize(0);
+        stack.push_back(m_tree.m_root);
+        while (stack.size()) {
+            const btDbvtNode *node = stack[stack.size() - 1];
+            stack.pop_back();
+            btVector3 bounds[2] = { node->volume.Mins(), node->volume.Maxs() };
+            btScalar tmin;
+            // boxes beyond the closest hit so far can't contain a closer one
+            if (!btRayAabb2(from, invDir, signs, bounds, tmin, 0, cb.m_closestHitFraction))
+                continue;
+            if (node->isinternal()) {
+                stack.push_back(node->childs[0]);
+                stack.push_back(node->childs[1]);
+            } else {
+                int i = node->dataAsInt;
+                cb.m_current = i;
+                btCollisionWorld::rayTestSingle(fromTrans, toTrans, m_objects[i],
+                                                m_objects[i]->getCollisionShape(), m_transforms[i], cb);
+            }
+        }
+    }
+    hitIndex = cb.m_hitIndex;
+    hitFraction = cb.hasHit() ? cb.m_closestHitFraction : btScalar(1);
+    hitNormal = cb.hasHit() ? cb.m_hitNormal.normalized() : btVector3(0, 0, 0);
+}
+
+void RayCaster::castPacket(int packet, int threadIndex, const Batch &b) {
+    btAlignedObjectArray<const btDbvtNode *> &stack = m_stacks[threadIndex];
+    int end = std::min(b.n, (packet + 1) * PACKET_SIZE);
+    for (int i = packet * PACKET_SIZE; i < end; ++i) {
+        btVector3 from(b.from[3*i], b.from[3*i+1], b.from[3*i+2]);
+        btVector3 to(b.to[3*i], b.to[3*i+1], b.to[3*i+2]);
+        from *= b.scale;
+        to *= b.scale;
+        btVector3 normal;
+        castOne(from, to, stack, b.hitIndex[i], normal, b.hitFraction[i]);
+        btVector3 pt = b.hitIndex[i] >= 0 ? from.lerp(to, b.hitFraction[i]) / b.scale : btVector3(0, 0, 0);
+        for (int j = 0; j < 3; ++j) {
+            b.hitPoint[3*i + j] = pt[j];
+            b.hitNormal[3*i + j] = normal[j];
+        }
+    }
+}
+
+void RayCaster::cast(int n, const btScalar *from, const btScalar *to,
+                     int *hitIndex, btScalar *hitPoint, btScalar *hitNormal, btScalar *hitFraction,
+                     btScalar scale) {
+    update();
+    Batch b = { n, from, to, hitIndex, hitPoint, hitNormal, hitFraction, scale };
+    int numPackets = (n + PACKET_SIZE - 1) / PACKET_SIZE;
+    m_pool->parallelFor(numPackets, boost::bind(&RayCaster::castPacket, this, _1, _2, boost::cref(b)));
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <BulletCollision/BroadphaseCollision/btDbvt.h>
+#include <vector>
+#include "thread_pool.h"
+
+// Casts large batches of rays against a fixed set of collision objects, e.g.
+// the links of one robot. A btDbvt over the objects' AABBs culls the narrowphase
+// ray tests; it is built once and refit when objects move. Rays are split into
+// packets that are cast concurrently on a ThreadPool.
+// The collision objects must outlive the RayCaster and must not move during cast().
+class RayCaster {
+public:
+    typedef boost::shared_ptr<RayCaster> Ptr;
+
+    // rays are cast on pool, which may be shared with other users
+    RayCaster(const std::vector<btCollisionObject *> &objects, ThreadPool::Ptr pool);
+    ~RayCaster();
+
+    // Casts n rays from[i] -> to[i] (3 scalars each) and reports the closest hit of each:
+    // hitIndex[i]: index into objects of the hit object, -1 for a miss
+    // hitPoint[3*i], hitNormal[3*i]: world hit point and unit normal (zero for a miss)
+    // hitFraction[i]: in [0, 1], 1 for a miss
+    // Inputs are multiplied by scale and hit points divided by it, so callers can
+    // pass OpenRAVE units with scale = METERS.
+    void cast(int n, const btScalar *from, const btScalar *to,
+              int *hitIndex, btScalar *hitPoint, btScalar *hitNormal, btScalar *hitFraction,
+              btScalar scale=1);
+
+    // refits the tree to the objects' current transforms. cast() calls this
+    void update();
+
+    int getNumThreads() const { return m_pool->size(); }
+
+private:
+    struct Batch {
+        int n;
+        const btScalar *from, *to;
+        int *hitIndex;
+        btScalar *hitPoint, *hitNormal, *hitFraction;
+        btScalar scale;
+    };
+
+    std::vector<btCollisionObject *> m_objects;
+    std::vector<btDbvtNode *> m_leaves;
+    std::vector<btTransform> m_transforms; // transform each leaf volume was computed with
+    btDbvt m_tree;
+    ThreadPool::Ptr m_pool;
+    std::vector<btAlignedObjectArray<const btDbvtNode *> > m_stacks; // traversal stack per pool thread
+
+    btDbvtVolume volumeOf(int i) const;
+    void castPacket(int packet, int threadIndex, const Batch &batch);
+    void castOne(const btVector3 &from, const btVector3 &to, btAlignedObjectArray<const btDbvtNode *> &stack,
+                 int &hitIndex, btVector3 &hitNormal, btScalar &hitFraction) const;
+};
@@ -60,73 +60,101 @@ void CapsuleRope_createRopeTransforms(vector<btTransform>& transforms, vector<bt
 
 }
 
-vector<btVector3> CapsuleRope_getNodes(const vector<btRigidBody*> &capsules) { 
-  vector<btVector3> out(capsules.size());
-  for (int i=0; i < capsules.size(); i++)
-    out[i] = capsules[i]->getCenterOfMassPosition();
-  return out;
+void CapsuleRope_getNodesInto(const vector<btRigidBody*> &capsules, btScalar *out, btScalar scale) {
+  for (int i=0; i < capsules.size(); i++) {
+    const btVector3 &p = capsules[i]->getCenterOfMassPosition();
+    for (int j=0; j < 3; j++) out[3*i+j] = p[j]*scale;
+  }
 }
 
-vector<btVector3> CapsuleRope_getControlPoints(const vector<btRigidBody*> &capsules) { 
-  vector<btVector3> out;
-  out.reserve(capsules.size()+1);
+void CapsuleRope_getControlPointsInto(const vector<btRigidBody*> &capsules, btScalar *out, btScalar scale) {
   for (int i=0; i < capsules.size(); i++) {
     btRigidBody* body = capsules[i];
-    btCapsuleShape* capsule = dynamic_cast<btCapsuleShapeX*>(body->getCollisionShape());
-    btTransform tf = body->getCenterOfMassTransform();
-    if (i==0) out.push_back(tf.getOrigin() + btMatrix3x3(tf.getRotation())*btVector3(-capsule->getHalfHeight(),0,0));
-    out.push_back(tf.getOrigin() + btMatrix3x3(tf.getRotation())*btVector3(capsule->getHalfHeight(),0,0));
+    const btTransform &tf = body->getCenterOfMassTransform();
+    const btVector3 halfAxis = tf.getBasis().getColumn(0) * static_cast<btCapsuleShape*>(body->getCollisionShape())->getHalfHeight();
+    if (i==0) {
+      const btVector3 p = tf.getOrigin() - halfAxis;
+      for (int j=0; j < 3; j++) out[j] = p[j]*scale;
+    }
+    const btVector3 p = tf.getOrigin() + halfAxis;
+    for (int j=0; j < 3; j++) out[3*(i+1)+j] = p[j]*scale;
   }
-  return out;
 }
 
-vector<btMatrix3x3> CapsuleRope_getRotations(const vector<btRigidBody*> &capsules) {
-  vector<btMatrix3x3> out;
+void CapsuleRope_getRotationsInto(const vector<btRigidBody*> &capsules, btScalar *out) {
   for (int i=0; i < capsules.size(); i++) {
-    btRigidBody* body = capsules[i];
-//    btCapsuleShape* capsule = dynamic_cast<btCapsuleShapeX*>(body->getCollisionShape());
-    btTransform tf = body->getCenterOfMassTransform();
-    out.push_back(tf.getBasis());
+    const btMatrix3x3 &basis = capsules[i]->getCenterOfMassTransform().getBasis();
+    for (int j=0; j < 3; j++)
+      for (int k=0; k < 3; k++)
+        out[9*i+3*j+k] = basis[j][k];
   }
+}
+
+void CapsuleRope_getHalfHeightsInto(const vector<btRigidBody*> &capsules, btScalar *out, btScalar scale) {
+  for (int i=0; i < capsules.size(); i++)
+    out[i] = static_cast<btCapsuleShape*>(capsules[i]->getCollisionShape())->getHalfHeight()*scale;
+}
+
+static vector<btVector3> toVectors(const vector<btScalar> &buf) {
+  vector<btVector3> out(buf.size()/3);
+  for (int i=0; i < out.size(); i++)
+    out[i].setValue(buf[3*i], buf[3*i+1], buf[3*i+2]);
   return out;
 }
 
-void CapsuleRope_setRotations(const vector<btRigidBody*> &capsules, const vector<btMatrix3x3>& rots) {
+vector<btVector3> CapsuleRope_getNodes(const vector<btRigidBody*> &capsules) { 
+  vector<btScalar> buf(3*capsules.size());
+  if (!capsules.empty()) CapsuleRope_getNodesInto(capsules, &buf[0]);
+  return toVectors(buf);
+}
+
+vector<btVector3> CapsuleRope_getControlPoints(const vector<btRigidBody*> &capsules) { 
+  if (capsules.empty()) return vector<btVector3>();
+  vector<btScalar> buf(3*(capsules.size()+1));
+  CapsuleRope_getControlPointsInto(capsules, &buf[0]);
+  return toVectors(buf);
+}
+
+vector<btMatrix3x3> CapsuleRope_getRotations(const vector<btRigidBody*> &capsules) {
+  vector<btScalar> buf(9*capsules.size());
+  if (!capsules.empty()) CapsuleRope_getRotationsInto(capsules, &buf[0]);
+  vector<btMatrix3x3> out(capsules.size());
+  for (int i=0; i < capsules.size(); i++)
+    out[i].setValue(buf[9*i], buf[9*i+1], buf[9*i+2], buf[9*i+3], buf[9*i+4], buf[9*i+5], buf[9*i+6], buf[9*i+7], buf[9*i+8]);
+  return out;
+}
+
+static void setCapsuleTransform(btRigidBody* body, const btTransform& tf, BulletInstance *bullet) {
+  body->setCenterOfMassTransform(tf);
+  if (bullet) bullet->markAabbDirty(body);
+}
+
+void CapsuleRope_setRotations(const vector<btRigidBody*> &capsules, const vector<btMatrix3x3>& rots, BulletInstance *bullet) {
   for (int i=0; i < capsules.size(); i++) {
     btRigidBody* body = capsules[i];
     btTransform tf = body->getCenterOfMassTransform();
     tf.setBasis(rots[i]);
-    body->setCenterOfMassTransform(tf);
+    setCapsuleTransform(body, tf, bullet);
   }
 }
 
 vector<btVector3> CapsuleRope_getTranslations(const vector<btRigidBody*> &capsules) {
-  vector<btVector3> out;
-  for (int i=0; i < capsules.size(); i++) {
-    btRigidBody* body = capsules[i];
-    btTransform tf = body->getCenterOfMassTransform();
-    out.push_back(tf.getOrigin());
-  }
-  return out;
+  return CapsuleRope_getNodes(capsules);
 }
 
-void CapsuleRope_setTranslations(const vector<btRigidBody*> &capsules, const vector<btVector3>& trans) {
+void CapsuleRope_setTranslations(const vector<btRigidBody*> &capsules, const vector<btVector3>& trans, BulletInstance *bullet) {
   for (int i=0; i < capsules.size(); i++) {
     btRigidBody* body = capsules[i];
     btTransform tf = body->getCenterOfMassTransform();
     tf.setOrigin(trans[i]);
-    body->setCenterOfMassTransform(tf);
+    setCapsuleTransform(body, tf, bullet);
   }
 }
 
 vector<float> CapsuleRope_getHalfHeights(const vector<btRigidBody*> &capsules) {
-  vector<float> out;
-  for (int i=0; i < capsules.size(); i++) {
-    btRigidBody* body = capsules[i];
-    btCapsuleShape* capsule = dynamic_cast<btCapsuleShapeX*>(body->getCollisionShape());
-    out.push_back(capsule->getHalfHeight());
-  }
-  return out;
+  vector<btScalar> buf(capsules.size());
+  if (!capsules.empty()) CapsuleRope_getHalfHeightsInto(capsules, &buf[0]);
+  return vector<float>(buf.begin(), buf.end());
 }
 
 static vector<btRigidBody*> extractRigidBodies(const vector<BulletObject::Ptr> &children) {
@@ -213,7 +241,7 @@ vector<btMatrix3x3> CapsuleRope::getRotations() {
 }
 
 void CapsuleRope::setRotations(const vector<btMatrix3x3>& rots) {
-  return CapsuleRope_setRotations(children_rigidBodies, rots);
+  return CapsuleRope_setRotations(children_rigidBodies, rots, getEnvironment() ? getEnvironment()->bullet.get() : NULL);
 }
 
 vector<btVector3> CapsuleRope::getTranslations() {
@@ -221,7 +249,7 @@ vector<btVector3> CapsuleRope::getTranslations() {
 }
 
 void CapsuleRope::setTranslations(const vector<btVector3>& trans) {
-  return CapsuleRope_setTranslations(children_rigidBodies, trans);
+  return CapsuleRope_setTranslations(children_rigidBodies, trans, getEnvironment() ? getEnvironment()->bullet.get() : NULL);
 }
 
 vector<float> CapsuleRope::getHalfHeights() {
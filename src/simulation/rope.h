@@ -8,12 +8,21 @@
 boost::shared_ptr<btGeneric6DofSpringConstraint> CapsuleRope_createBendConstraint(btScalar len, const boost::shared_ptr<btRigidBody> rbA, const boost::shared_ptr<btRigidBody>& rbB, float damping, float stiffness, float limit);
 btMatrix3x3 CapsuleRope_makePerpBasis(const btVector3& a0);
 void CapsuleRope_createRopeTransforms(vector<btTransform>& transforms, vector<btScalar>& lengths, const vector<btVector3>& ctrlPoints);
+// The *Into variants write the values of the vector versions into out
+// (3 per point, 9 per rotation in row-major order), multiplied by scale.
+// The translations are the nodes.
+void CapsuleRope_getNodesInto(const vector<btRigidBody*> &capsules, btScalar *out, btScalar scale=1);
+void CapsuleRope_getControlPointsInto(const vector<btRigidBody*> &capsules, btScalar *out, btScalar scale=1);
+void CapsuleRope_getRotationsInto(const vector<btRigidBody*> &capsules, btScalar *out);
+void CapsuleRope_getHalfHeightsInto(const vector<btRigidBody*> &capsules, btScalar *out, btScalar scale=1);
 vector<btVector3> CapsuleRope_getNodes(const vector<btRigidBody*> &capsules);
 vector<btVector3> CapsuleRope_getControlPoints(const vector<btRigidBody*> &capsules);
 vector<btMatrix3x3> CapsuleRope_getRotations(const vector<btRigidBody*> &capsules);
-void CapsuleRope_setRotations(const vector<btRigidBody*> &capsules, const vector<btMatrix3x3>& rots);
+// The setters move the capsules between steps; pass the BulletInstance they are in,
+// if any, so their AABBs are marked for BulletInstance::updateDirtyAabbs().
+void CapsuleRope_setRotations(const vector<btRigidBody*> &capsules, const vector<btMatrix3x3>& rots, BulletInstance *bullet=NULL);
 vector<btVector3> CapsuleRope_getTranslations(const vector<btRigidBody*> &capsules);
-void CapsuleRope_setTranslations(const vector<btRigidBody*> &capsules, const vector<btVector3>& trans);
+void CapsuleRope_setTranslations(const vector<btRigidBody*> &capsules, const vector<btVector3>& trans, BulletInstance *bullet=NULL);
 vector<float> CapsuleRope_getHalfHeights(const vector<btRigidBody*> &capsules);
 
 class CapsuleRope : public CompoundObject<BulletObject> {
@@ -0,0 +1,71 @@
+#include "shape_registry.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+
+namespace {
+boost::mutex registryMutex;
+typedef std::map<std::string, boost::weak_ptr<SharedShape> > Registry;
+Registry registry;
+
+void pruneExpired() {
+    for (Registry::iterator i = registry.begin(); i != registry.end(); ) {
+        if (i->second.expired()) registry.erase(i++);
+        else ++i;
+    }
+}
+}
+
+ShapeKey &ShapeKey::append(const void *data, size_t size) {
+    m_bytes.append(static_cast<const char *>(data), size);
+    return *this;
+}
+
+ShapeKey &ShapeKey::operator<<(const btTransform &t) {
+    const btQuaternion q = t.getRotation();
+    return *this << t.getOrigin() << q.x() << q.y() << q.z() << q.w();
+}
+
+ShapeKey &ShapeKey::addVertices(const btVector3 *vertices, int n) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < n; ++i) {
+        const btScalar v[3] = { vertices[i].x(), vertices[i].y(), vertices[i].z() };
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(v);
+        for (size_t j = 0; j < sizeof(v); ++j) {
+            h ^= p[j];
+            h *= 1099511628211ULL;
+        }
+    }
+    *this << n;
+    return append(&h, sizeof(h));
+}
+
+SharedShape::Ptr ShapeRegistry::find(const ShapeKey &key) {
+    boost::mutex::scoped_lock lock(registryMutex);
+    Registry::const_iterator i = registry.find(key.str());
+    return i == registry.end() ? SharedShape::Ptr() : i->second.lock();
+}
+
+SharedShape::Ptr ShapeRegistry::add(const ShapeKey &key, SharedShape::Ptr shape) {
+    boost::mutex::scoped_lock lock(registryMutex);
+    boost::weak_ptr<SharedShape> &entry = registry[key.str()];
+    if (SharedShape::Ptr existing = entry.lock())
+        return existing;
+    entry = shape;
+    // keep the registry from filling up with the keys of shapes that are gone
+    static size_t pruneAt = 256;
+    if (registry.size() >= pruneAt) {
+        pruneExpired();
+        pruneAt = std::max<size_t>(256, 2 * registry.size());
+    }
+    return shape;
+}
+
+int ShapeRegistry::size() {
+    boost::mutex::scoped_lock lock(registryMutex);
+    pruneExpired();
+    return registry.size();
+}
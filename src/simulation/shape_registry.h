@@ -0,0 +1,47 @@
+#pragma once
+#include <btBulletDynamicsCommon.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+// A collision shape together with the child shapes and meshes it points to.
+// Registered shapes are shared by every object built from the same geometry,
+// in all environments and forks, so they must not be modified.
+struct SharedShape {
+    typedef boost::shared_ptr<SharedShape> Ptr;
+    boost::shared_ptr<btCollisionShape> shape;
+    std::vector<boost::shared_ptr<btCollisionShape> > subshapes;
+    std::vector<boost::shared_ptr<btStridingMeshInterface> > meshes;
+};
+
+// Identifies a shape by everything that went into building it: geometry
+// parameters, scale, margins etc. are appended as raw bytes, and big
+// vertex arrays as a 64 bit hash.
+class ShapeKey {
+public:
+    ShapeKey &operator<<(int x) { return append(&x, sizeof(x)); }
+    ShapeKey &operator<<(float x) { return append(&x, sizeof(x)); }
+    ShapeKey &operator<<(double x) { return append(&x, sizeof(x)); }
+    ShapeKey &operator<<(const btVector3 &v) { return *this << v.x() << v.y() << v.z(); }
+    ShapeKey &operator<<(const btTransform &t);
+    ShapeKey &addVertices(const btVector3 *vertices, int n);
+
+    const std::string &str() const { return m_bytes; }
+
+private:
+    std::string m_bytes;
+    ShapeKey &append(const void *data, size_t size);
+};
+
+// Process-wide registry of SharedShapes by key. It only holds weak
+// references: a shape goes away with the last object using it.
+class ShapeRegistry {
+public:
+    // the live shape registered under key, if any
+    static SharedShape::Ptr find(const ShapeKey &key);
+    // registers shape under key and returns it, or returns the shape another
+    // thread registered under key in the meantime
+    static SharedShape::Ptr add(const ShapeKey &key, SharedShape::Ptr shape);
+    // number of live shapes
+    static int size();
+};
@@ -6,6 +6,7 @@
  */
 
 #include "softBodyHelpers.h"
+#include "soft_body_topology.h"
 #include "util.h"
 #include <algorithm>
 #include "utils/utils_vector.h"
@@ -26,30 +27,12 @@ btSoftBody*	CreateFromSoftBodyExcludeNodes(btSoftBody* softBody, vector<int> exc
 	sort(exclude_nodes_idx.begin(), exclude_nodes_idx.end());
 
 	// compute face to nodes indices
-	vector<vector<int> > face2nodes(faces.size(), vector<int>(3,-1));
-	for (int i=0; i<nodes.size(); i++) {
-		int j,c;
-		for(j=0; j<faces.size(); j++) {
-			for(c=0; c<3; c++) {
-				if (&nodes[i] == faces[j].m_n[c]) {
-					face2nodes[j][c] = i;
-				}
-			}
-		}
-	}
+	vector<vector<int> > node2faces, face2nodes;
+	computeNodeFaceMapping(softBody, faces, node2faces, face2nodes);
 
 	// compute link to nodes indices
-	vector<vector<int> > link2nodes(links.size(), vector<int>(2,-1));
-	for (int i=0; i<nodes.size(); i++) {
-		int l,c;
-		for(l=0; l<links.size(); l++) {
-			for(c=0; c<2; c++) {
-				if (&nodes[i] == links[l].m_n[c]) {
-					link2nodes[l][c] = i;
-				}
-			}
-		}
-	}
+	vector<vector<int> > link2nodes;
+	computeLinkNodeMapping(softBody, link2nodes);
 
 	/* Create nodes	*/
 	const int	tot=nodes.size() - exclude_nodes_idx.size();
@@ -60,7 +43,7 @@ btSoftBody*	CreateFromSoftBodyExcludeNodes(btSoftBody* softBody, vector<int> exc
 	int idx=0;
 	vector<int> oldNodes2newNodes(nodes.size());
 	for (int i=0; i<nodes.size(); i++) {
-		if (exclude_nodes_idx[exclude_idx] == i) {
+		if (exclude_idx < exclude_nodes_idx.size() && exclude_nodes_idx[exclude_idx] == i) {
 			oldNodes2newNodes[i] = -1;
 			exclude_idx++;
 		} else {
@@ -109,22 +92,13 @@ btSoftBody*	CreateFromSoftBodyExcludeFaces(btSoftBody* softBody, vector<int> exc
 	btSoftBody::tLinkArray& links = softBody->m_links;
 
 	// compute faces to nodes indices and vice versa
-	vector<vector<int> > node2faces(nodes.size());
-	vector<vector<int> > face2nodes(faces.size(), vector<int>(3,-1));
-	for (int i=0; i<nodes.size(); i++) {
-		int j,c;
-		for(j=0; j<faces.size(); j++) {
-			for(c=0; c<3; c++) {
-				if (&nodes[i] == faces[j].m_n[c]) {
-					node2faces[i].push_back(j);
-					face2nodes[j][c] = i;
-				}
-			}
-		}
-	}
+	vector<vector<int> > node2faces, face2nodes;
+	computeNodeFaceMapping(softBody, faces, node2faces, face2nodes);
 	// remove all the instances of excluded faces from node2faces
 	// so, if all the faces attached to node are excluded, then
 	// node2faces[node].size()==0 and this node should be excluded
+	sort(exclude_faces_idx.begin(), exclude_faces_idx.end());
+	exclude_faces_idx.erase(unique(exclude_faces_idx.begin(), exclude_faces_idx.end()), exclude_faces_idx.end());
 	for (int j=0; j<exclude_faces_idx.size(); j++) {
 		for (int c=0; c<3; c++) {
 			int node = face2nodes[exclude_faces_idx[j]][c];
@@ -133,17 +107,8 @@ btSoftBody*	CreateFromSoftBodyExcludeFaces(btSoftBody* softBody, vector<int> exc
 	}
 
 	// compute link to nodes indices
-	vector<vector<int> > link2nodes(links.size(), vector<int>(2,-1));
-	for (int i=0; i<nodes.size(); i++) {
-		int l,c;
-		for(l=0; l<links.size(); l++) {
-			for(c=0; c<2; c++) {
-				if (&nodes[i] == links[l].m_n[c]) {
-					link2nodes[l][c] = i;
-				}
-			}
-		}
-	}
+	vector<vector<int> > link2nodes;
+	computeLinkNodeMapping(softBody, link2nodes);
 
 	/* Create nodes	*/
 	int exclude_nodes_size = 0;
@@ -176,7 +141,7 @@ btSoftBody*	CreateFromSoftBodyExcludeFaces(btSoftBody* softBody, vector<int> exc
 	int exclude_idx = 0;
 	idx = 0;
 	for (int j=0; j<faces.size(); j++) {
-		if (j == exclude_faces_idx[exclude_idx]) {
+		if (exclude_idx < exclude_faces_idx.size() && j == exclude_faces_idx[exclude_idx]) {
 			exclude_idx++;
 		} else {
 			assert(face2nodes[j].size() == 3);
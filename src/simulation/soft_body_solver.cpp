@@ -0,0 +1,390 @@
+#include "soft_body_solver.h"
+#include <BulletSoftBody/btSoftBodyInternals.h>
+#include <boost/bind.hpp>
+#include <set>
+
+#if defined(__SSE__) && !defined(BT_USE_DOUBLE_PRECISION)
+#include <xmmintrin.h>
+#define SOFT_BODY_SSE
+#endif
+
+namespace {
+// links per work item. Batches of at most one chunk are solved on the calling thread
+const int CHUNK_SIZE = 256;
+// colours fit in a 64 bit mask per node; links that need more go to a serial batch
+const int MAX_COLOURS = 64;
+
+#ifdef SOFT_BODY_SSE
+inline __m128 gather(const btScalar *v, const int *idx) {
+    return _mm_setr_ps(v[idx[0]], v[idx[1]], v[idx[2]], v[idx[3]]);
+}
+inline void scatter(btScalar *v, const int *idx, __m128 x) {
+    ATTRIBUTE_ALIGNED16(btScalar t[4]);
+    _mm_store_ps(t, x);
+    v[idx[0]] = t[0]; v[idx[1]] = t[1]; v[idx[2]] = t[2]; v[idx[3]] = t[3];
+}
+#endif
+}
+
+ParallelSoftBodySolver::ParallelSoftBodySolver(int numThreads, bool simd) :
+    m_pool(numThreads), m_simd(simd) {
+}
+
+void ParallelSoftBodySolver::optimize(btAlignedObjectArray<btSoftBody *> &softBodies, bool forceUpdate) {
+    btDefaultSoftBodySolver::optimize(softBodies, forceUpdate);
+    // forget bodies that left the world
+    std::set<const btSoftBody *> present;
+    for (int i = 0; i < softBodies.size(); ++i)
+        present.insert(softBodies[i]);
+    for (std::map<const btSoftBody *, LinkBatches>::iterator i = m_batches.begin(); i != m_batches.end();) {
+        if (present.count(i->first)) ++i;
+        else m_batches.erase(i++);
+    }
+}
+
+ParallelSoftBodySolver::LinkBatches &ParallelSoftBodySolver::batchesFor(btSoftBody *psb) {
+    LinkBatches &lb = m_batches[psb];
+    int numLinks = psb->m_links.size(), numNodes = psb->m_nodes.size();
+    const btSoftBody::Node *nodeBase = numNodes ? &psb->m_nodes[0] : NULL;
+    if (!lb.batchStarts.empty() && lb.numLinks == numLinks && lb.numNodes == numNodes && lb.nodeBase == nodeBase)
+        return lb;
+    lb.numLinks = numLinks;
+    lb.numNodes = numNodes;
+    lb.nodeBase = nodeBase;
+
+    // greedy colouring: every link takes the lowest colour free at both its nodes
+    std::vector<unsigned long long> used(numNodes, 0);
+    std::vector<int> colour(numLinks);
+    std::vector<int> count(MAX_COLOURS + 1, 0);
+    for (int i = 0; i < numLinks; ++i) {
+        const btSoftBody::Link &l = psb->m_links[i];
+        int a = int(l.m_n[0] - nodeBase), b = int(l.m_n[1] - nodeBase);
+        unsigned long long taken = used[a] | used[b];
+        int c = 0;
+        while (c < MAX_COLOURS && (taken & (1ULL << c)))
+            ++c;
+        if (c < MAX_COLOURS) {
+            used[a] |= 1ULL << c;
+            used[b] |= 1ULL << c;
+        }
+        colour[i] = c;
+        ++count[c];
+    }
+    lb.numColours = 0;
+    while (lb.numColours < MAX_COLOURS && count[lb.numColours])
+        ++lb.numColours;
+
+    // counting sort of the links by colour; the overflow colour, if any, comes last
+    lb.batchStarts.clear();
+    std::vector<int> next(MAX_COLOURS + 1);
+    int start = 0;
+    for (int c = 0; c <= MAX_COLOURS; ++c) {
+        if (!count[c]) continue;
+        lb.batchStarts.push_back(start);
+        next[c] = start;
+        start += count[c];
+    }
+    lb.batchStarts.push_back(numLinks);
+    lb.link.resize(numLinks);
+    lb.node0.resize(numLinks);
+    lb.node1.resize(numLinks);
+    for (int i = 0; i < numLinks; ++i) {
+        int k = next[colour[i]]++;
+        lb.link[k] = i;
+        lb.node0[k] = int(psb->m_links[i].m_n[0] - nodeBase);
+        lb.node1[k] = int(psb->m_links[i].m_n[1] - nodeBase);
+    }
+    lb.c0.resize(numLinks);
+    lb.c1.resize(numLinks);
+    lb.c2.resize(numLinks);
+    lb.c3x.resize(numLinks);
+    lb.c3y.resize(numLinks);
+    lb.c3z.resize(numLinks);
+    if (m_simd) {
+        lb.x.resize(numNodes);
+        lb.y.resize(numNodes);
+        lb.z.resize(numNodes);
+        lb.vx.resize(numNodes);
+        lb.vy.resize(numNodes);
+        lb.vz.resize(numNodes);
+        lb.im.resize(numNodes);
+    }
+    lb.positionsAhead = lb.velocitiesAhead = false;
+    return lb;
+}
+
+void ParallelSoftBodySolver::positionChunk(int chunk, int, const Sweep &s) {
+    const LinkBatches &lb = *s.batches;
+    int begin = s.begin + chunk * s.chunkSize, end = btMin(s.end, begin + s.chunkSize);
+    for (int i = begin; i < end; ++i) {
+        const btScalar c0 = lb.c0[i], c1 = lb.c1[i];
+        if (c0 <= 0) continue;
+        btSoftBody::Node &a = s.nodes[lb.node0[i]], &b = s.nodes[lb.node1[i]];
+        const btVector3 del = b.m_x - a.m_x;
+        const btScalar len = del.length2();
+        if (c1 + len > SIMD_EPSILON) {
+            const btScalar k = ((c1 - len) / (c0 * (c1 + len))) * s.kst;
+            a.m_x -= del * (k * a.m_im);
+            b.m_x += del * (k * b.m_im);
+        }
+    }
+}
+
+void ParallelSoftBodySolver::velocityChunk(int chunk, int, const Sweep &s) {
+    const LinkBatches &lb = *s.batches;
+    int begin = s.begin + chunk * s.chunkSize, end = btMin(s.end, begin + s.chunkSize);
+    for (int i = begin; i < end; ++i) {
+        btSoftBody::Node &a = s.nodes[lb.node0[i]], &b = s.nodes[lb.node1[i]];
+        const btVector3 c3(lb.c3x[i], lb.c3y[i], lb.c3z[i]);
+        const btScalar j = -btDot(c3, a.m_v - b.m_v) * lb.c2[i] * s.kst;
+        a.m_v += c3 * (j * a.m_im);
+        b.m_v -= c3 * (j * b.m_im);
+    }
+}
+
+// positionChunk on the node copies. Links of a batch don't share nodes, so
+// the four lanes never write the same node
+void ParallelSoftBodySolver::positionChunkSimd(int chunk, int, const Sweep &s) {
+    LinkBatches &lb = *s.batches;
+    int i = s.begin + chunk * s.chunkSize, end = btMin(s.end, i + s.chunkSize);
+    btScalar *x = &lb.x[0], *y = &lb.y[0], *z = &lb.z[0];
+    const btScalar *im = &lb.im[0];
+#ifdef SOFT_BODY_SSE
+    const __m128 zero = _mm_setzero_ps(), eps = _mm_set1_ps(SIMD_EPSILON), kst = _mm_set1_ps(s.kst);
+    for (; i + 4 <= end; i += 4) {
+        const int *a = &lb.node0[i], *b = &lb.node1[i];
+        __m128 ax = gather(x, a), ay = gather(y, a), az = gather(z, a);
+        __m128 bx = gather(x, b), by = gather(y, b), bz = gather(z, b);
+        const __m128 dx = _mm_sub_ps(bx, ax), dy = _mm_sub_ps(by, ay), dz = _mm_sub_ps(bz, az);
+        const __m128 len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        const __m128 c0 = _mm_loadu_ps(&lb.c0[i]), c1 = _mm_loadu_ps(&lb.c1[i]);
+        const __m128 sum = _mm_add_ps(c1, len);
+        // lanes that the scalar solver skips get k = 0, whatever the division gave
+        const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(c0, zero), _mm_cmpgt_ps(sum, eps));
+        const __m128 k = _mm_and_ps(valid, _mm_mul_ps(_mm_div_ps(_mm_sub_ps(c1, len), _mm_mul_ps(c0, sum)), kst));
+        const __m128 ka = _mm_mul_ps(k, gather(im, a)), kb = _mm_mul_ps(k, gather(im, b));
+        scatter(x, a, _mm_sub_ps(ax, _mm_mul_ps(dx, ka)));
+        scatter(y, a, _mm_sub_ps(ay, _mm_mul_ps(dy, ka)));
+        scatter(z, a, _mm_sub_ps(az, _mm_mul_ps(dz, ka)));
+        scatter(x, b, _mm_add_ps(bx, _mm_mul_ps(dx, kb)));
+        scatter(y, b, _mm_add_ps(by, _mm_mul_ps(dy, kb)));
+        scatter(z, b, _mm_add_ps(bz, _mm_mul_ps(dz, kb)));
+    }
+#endif
+    for (; i < end; ++i) {
+        const btScalar c0 = lb.c0[i], c1 = lb.c1[i];
+        if (c0 <= 0) continue;
+        const int a = lb.node0[i], b = lb.node1[i];
+        const btScalar dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a];
+        const btScalar len = dx * dx + dy * dy + dz * dz;
+        if (c1 + len > SIMD_EPSILON) {
+            const btScalar k = ((c1 - len) / (c0 * (c1 + len))) * s.kst;
+            const btScalar ka = k * im[a], kb = k * im[b];
+            x[a] -= dx * ka; y[a] -= dy * ka; z[a] -= dz * ka;
+            x[b] += dx * kb; y[b] += dy * kb; z[b] += dz * kb;
+        }
+    }
+}
+
+void ParallelSoftBodySolver::velocityChunkSimd(int chunk, int, const Sweep &s) {
+    LinkBatches &lb = *s.batches;
+    int i = s.begin + chunk * s.chunkSize, end = btMin(s.end, i + s.chunkSize);
+    btScalar *vx = &lb.vx[0], *vy = &lb.vy[0], *vz = &lb.vz[0];
+    const btScalar *im = &lb.im[0];
+#ifdef SOFT_BODY_SSE
+    const __m128 minusKst = _mm_set1_ps(-s.kst);
+    for (; i + 4 <= end; i += 4) {
+        const int *a = &lb.node0[i], *b = &lb.node1[i];
+        __m128 ax = gather(vx, a), ay = gather(vy, a), az = gather(vz, a);
+        __m128 bx = gather(vx, b), by = gather(vy, b), bz = gather(vz, b);
+        const __m128 cx = _mm_loadu_ps(&lb.c3x[i]), cy = _mm_loadu_ps(&lb.c3y[i]), cz = _mm_loadu_ps(&lb.c3z[i]);
+        const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_sub_ps(ax, bx)), _mm_mul_ps(cy, _mm_sub_ps(ay, by))),
+                                      _mm_mul_ps(cz, _mm_sub_ps(az, bz)));
+        const __m128 j = _mm_mul_ps(_mm_mul_ps(dot, _mm_loadu_ps(&lb.c2[i])), minusKst);
+        const __m128 ja = _mm_mul_ps(j, gather(im, a)), jb = _mm_mul_ps(j, gather(im, b));
+        scatter(vx, a, _mm_add_ps(ax, _mm_mul_ps(cx, ja)));
+        scatter(vy, a, _mm_add_ps(ay, _mm_mul_ps(cy, ja)));
+        scatter(vz, a, _mm_add_ps(az, _mm_mul_ps(cz, ja)));
+        scatter(vx, b, _mm_sub_ps(bx, _mm_mul_ps(cx, jb)));
+        scatter(vy, b, _mm_sub_ps(by, _mm_mul_ps(cy, jb)));
+        scatter(vz, b, _mm_sub_ps(bz, _mm_mul_ps(cz, jb)));
+    }
+#endif
+    for (; i < end; ++i) {
+        const int a = lb.node0[i], b = lb.node1[i];
+        const btScalar cx = lb.c3x[i], cy = lb.c3y[i], cz = lb.c3z[i];
+        const btScalar j = -(cx * (vx[a] - vx[b]) + cy * (vy[a] - vy[b]) + cz * (vz[a] - vz[b])) * lb.c2[i] * s.kst;
+        const btScalar ja = j * im[a], jb = j * im[b];
+        vx[a] += cx * ja; vy[a] += cy * ja; vz[a] += cz * ja;
+        vx[b] -= cx * jb; vy[b] -= cy * jb; vz[b] -= cz * jb;
+    }
+}
+
+void ParallelSoftBodySolver::syncNodes(btSoftBody *psb, LinkBatches &lb) {
+    if (lb.positionsAhead) {
+        for (int i = 0; i < lb.numNodes; ++i)
+            psb->m_nodes[i].m_x.setValue(lb.x[i], lb.y[i], lb.z[i]);
+        lb.positionsAhead = false;
+    }
+    if (lb.velocitiesAhead) {
+        for (int i = 0; i < lb.numNodes; ++i)
+            psb->m_nodes[i].m_v.setValue(lb.vx[i], lb.vy[i], lb.vz[i]);
+        lb.velocitiesAhead = false;
+    }
+}
+
+// one sweep over the links, equivalent to btSoftBody::PSolve_Links or VSolve_Links with kst = 1
+void ParallelSoftBodySolver::solveLinks(btSoftBody *psb, LinkBatches &lb, bool velocities) {
+    if (!lb.numLinks) return;
+    if (m_simd && velocities && !lb.velocitiesAhead) {
+        for (int i = 0; i < lb.numNodes; ++i) {
+            const btVector3 &v = psb->m_nodes[i].m_v;
+            lb.vx[i] = v.x(); lb.vy[i] = v.y(); lb.vz[i] = v.z();
+        }
+        lb.velocitiesAhead = true;
+    } else if (m_simd && !velocities && !lb.positionsAhead) {
+        for (int i = 0; i < lb.numNodes; ++i) {
+            const btVector3 &x = psb->m_nodes[i].m_x;
+            lb.x[i] = x.x(); lb.y[i] = x.y(); lb.z[i] = x.z();
+        }
+        lb.positionsAhead = true;
+    }
+    ChunkFn fn = velocities ? (m_simd ? &ParallelSoftBodySolver::velocityChunkSimd : &ParallelSoftBodySolver::velocityChunk)
+                            : (m_simd ? &ParallelSoftBodySolver::positionChunkSimd : &ParallelSoftBodySolver::positionChunk);
+
+    Sweep s;
+    s.batches = &lb;
+    s.nodes = &psb->m_nodes[0];
+    s.kst = 1;
+    for (int b = 0; b + 1 < lb.batchStarts.size(); ++b) {
+        s.begin = lb.batchStarts[b];
+        s.end = lb.batchStarts[b + 1];
+        // the overflow batch shares nodes between its links
+        if (b >= lb.numColours || s.end - s.begin <= CHUNK_SIZE) {
+            s.chunkSize = s.end - s.begin;
+            // lanes of the simd kernels must not share nodes either
+            if (b >= lb.numColours && m_simd) {
+                for (s.chunkSize = 1; s.begin < s.end; ++s.begin)
+                    (this->*fn)(0, 0, s);
+            } else {
+                (this->*fn)(0, 0, s);
+            }
+        } else {
+            s.chunkSize = CHUNK_SIZE;
+            m_pool.parallelFor((s.end - s.begin + CHUNK_SIZE - 1) / CHUNK_SIZE, boost::bind(fn, this, _1, _2, boost::cref(s)));
+        }
+    }
+}
+
+void ParallelSoftBodySolver::positionSolve(btSoftBody *psb, LinkBatches &lb, btSoftBody::ePSolver::_ solver, btScalar ti) {
+    if (solver == btSoftBody::ePSolver::Linear) {
+        solveLinks(psb, lb, false);
+        return;
+    }
+    // the other solvers have nothing to do without anchors or contacts,
+    // so the node copies can stay ahead
+    if ((solver == btSoftBody::ePSolver::Anchors && !psb->m_anchors.size()) ||
+        (solver == btSoftBody::ePSolver::RContacts && !psb->m_rcontacts.size()) ||
+        (solver == btSoftBody::ePSolver::SContacts && !psb->m_scontacts.size()))
+        return;
+    syncNodes(psb, lb);
+    btSoftBody::getSolver(solver)(psb, 1, ti);
+}
+
+// btSoftBody::solveConstraints, with the link solvers replaced by solveLinks
+void ParallelSoftBodySolver::solveBody(btSoftBody *psb) {
+    LinkBatches &lb = batchesFor(psb);
+    const btSoftBody::Config &cfg = psb->m_cfg;
+    const btSoftBody::SolverState &sst = psb->m_sst;
+
+    psb->applyClusters(false);
+
+    // prepare links
+    for (int i = 0; i < lb.numLinks; ++i) {
+        btSoftBody::Link &l = psb->m_links[i];
+        l.m_c3 = l.m_n[1]->m_q - l.m_n[0]->m_q;
+        l.m_c2 = 1 / (l.m_c3.length2() * l.m_c0);
+    }
+    for (int k = 0; k < lb.numLinks; ++k) {
+        const btSoftBody::Link &l = psb->m_links[lb.link[k]];
+        lb.c0[k] = l.m_c0;
+        lb.c1[k] = l.m_c1;
+        lb.c2[k] = l.m_c2;
+        lb.c3x[k] = l.m_c3.x();
+        lb.c3y[k] = l.m_c3.y();
+        lb.c3z[k] = l.m_c3.z();
+    }
+    if (m_simd)
+        for (int i = 0; i < lb.numNodes; ++i)
+            lb.im[i] = psb->m_nodes[i].m_im;
+    // prepare anchors
+    for (int i = 0; i < psb->m_anchors.size(); ++i) {
+        btSoftBody::Anchor &a = psb->m_anchors[i];
+        const btVector3 ra = a.m_body->getWorldTransform().getBasis() * a.m_local;
+        a.m_c0 = ImpulseMatrix(sst.sdt, a.m_node->m_im, a.m_body->getInvMass(),
+                               a.m_body->getInvInertiaTensorWorld(), ra);
+        a.m_c1 = ra;
+        a.m_c2 = sst.sdt * a.m_node->m_im;
+        a.m_body->activate();
+    }
+
+    // velocities
+    if (cfg.viterations > 0) {
+        for (int isolve = 0; isolve < cfg.viterations; ++isolve)
+            for (int iseq = 0; iseq < cfg.m_vsequence.size(); ++iseq) {
+                if (cfg.m_vsequence[iseq] == btSoftBody::eVSolver::Linear) {
+                    solveLinks(psb, lb, true);
+                } else {
+                    syncNodes(psb, lb);
+                    btSoftBody::getSolver(cfg.m_vsequence[iseq])(psb, 1);
+                }
+            }
+        syncNodes(psb, lb);
+        for (int i = 0; i < psb->m_nodes.size(); ++i) {
+            btSoftBody::Node &n = psb->m_nodes[i];
+            n.m_x = n.m_q + n.m_v * sst.sdt;
+        }
+    }
+    // positions
+    if (cfg.piterations > 0) {
+        for (int isolve = 0; isolve < cfg.piterations; ++isolve) {
+            const btScalar ti = isolve / (btScalar) cfg.piterations;
+            for (int iseq = 0; iseq < cfg.m_psequence.size(); ++iseq)
+                positionSolve(psb, lb, cfg.m_psequence[iseq], ti);
+        }
+        syncNodes(psb, lb);
+        const btScalar vc = sst.isdt * (1 - cfg.kDP);
+        for (int i = 0; i < psb->m_nodes.size(); ++i) {
+            btSoftBody::Node &n = psb->m_nodes[i];
+            n.m_v = (n.m_x - n.m_q) * vc;
+            n.m_f = btVector3(0, 0, 0);
+        }
+    }
+    // drift
+    if (cfg.diterations > 0) {
+        const btScalar vcf = cfg.kVCF * sst.isdt;
+        for (int i = 0; i < psb->m_nodes.size(); ++i) {
+            btSoftBody::Node &n = psb->m_nodes[i];
+            n.m_q = n.m_x;
+        }
+        for (int idrift = 0; idrift < cfg.diterations; ++idrift)
+            for (int iseq = 0; iseq < cfg.m_dsequence.size(); ++iseq)
+                positionSolve(psb, lb, cfg.m_dsequence[iseq], 0);
+        syncNodes(psb, lb);
+        for (int i = 0; i < psb->m_nodes.size(); ++i) {
+            btSoftBody::Node &n = psb->m_nodes[i];
+            n.m_v += (n.m_x - n.m_q) * vcf;
+        }
+    }
+
+    psb->dampClusters();
+    psb->applyClusters(true);
+}
+
+void ParallelSoftBodySolver::solveConstraints(float) {
+    for (int i = 0; i < m_softBodySet.size(); ++i) {
+        btSoftBody *psb = m_softBodySet[i];
+        if (psb->isActive())
+            solveBody(psb);
+    }
+}
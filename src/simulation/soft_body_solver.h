@@ -0,0 +1,75 @@
+#pragma once
+#include <BulletSoftBody/btSoftBody.h>
+#include <BulletSoftBody/btDefaultSoftBodySolver.h>
+#include <vector>
+#include <map>
+#include "thread_pool.h"
+
+// Soft body solver that solves the link constraints of each soft body in parallel.
+// Links are greedily graph-coloured so that no two links of a colour share a node,
+// and each colour is a batch whose links are solved concurrently on a ThreadPool.
+// Per body, the link node indices and coefficients are kept in struct-of-arrays
+// form ordered by batch; the batches are rebuilt when a body's links change.
+// Anchors, contacts and clusters are solved as in btDefaultSoftBodySolver.
+// Within an iteration links are visited batch by batch rather than in m_links
+// order, so results differ slightly from the default solver's.
+//
+// With simd set, the link sweeps also keep the node positions, velocities and
+// inverse masses in aligned struct-of-arrays copies and solve four links at a
+// time with SSE. The copies are synced with m_nodes only around solvers that
+// have work to do on the nodes, so a body without anchors or contacts runs all
+// its position iterations on the copies.
+class ParallelSoftBodySolver : public btDefaultSoftBodySolver {
+public:
+    ParallelSoftBodySolver(int numThreads, bool simd=false);
+
+    virtual void optimize(btAlignedObjectArray<btSoftBody *> &softBodies, bool forceUpdate=false);
+    virtual void solveConstraints(float solverdt);
+
+    int getNumThreads() const { return m_pool.size(); }
+    bool usesSimd() const { return m_simd; }
+
+private:
+    // the links of one soft body, ordered by batch
+    struct LinkBatches {
+        // what the batches were built for
+        int numLinks, numNodes;
+        const btSoftBody::Node *nodeBase;
+
+        std::vector<int> batchStarts; // batch b is [batchStarts[b], batchStarts[b+1])
+        int numColours; // batches past these hold the links that got no colour
+        std::vector<int> link; // index into m_links
+        std::vector<int> node0, node1; // indices into m_nodes
+        // copied from the links at the start of every step
+        btAlignedObjectArray<btScalar> c0, c1, c2, c3x, c3y, c3z;
+
+        // simd only: node copies in m_nodes order, and whether they are
+        // newer than m_nodes
+        btAlignedObjectArray<btScalar> x, y, z, vx, vy, vz, im;
+        bool positionsAhead, velocitiesAhead;
+    };
+
+    struct Sweep {
+        LinkBatches *batches;
+        btSoftBody::Node *nodes;
+        int begin, end, chunkSize;
+        btScalar kst;
+    };
+    typedef void (ParallelSoftBodySolver::*ChunkFn)(int, int, const Sweep &);
+
+    ThreadPool m_pool;
+    bool m_simd;
+    std::map<const btSoftBody *, LinkBatches> m_batches;
+
+    LinkBatches &batchesFor(btSoftBody *psb);
+    void solveBody(btSoftBody *psb);
+    void positionSolve(btSoftBody *psb, LinkBatches &lb, btSoftBody::ePSolver::_ solver, btScalar ti);
+    void solveLinks(btSoftBody *psb, LinkBatches &lb, bool velocities);
+    // writes the simd node copies that are ahead back to m_nodes
+    void syncNodes(btSoftBody *psb, LinkBatches &lb);
+
+    void positionChunk(int chunk, int threadIndex, const Sweep &sweep);
+    void velocityChunk(int chunk, int threadIndex, const Sweep &sweep);
+    void positionChunkSimd(int chunk, int threadIndex, const Sweep &sweep);
+    void velocityChunkSimd(int chunk, int threadIndex, const Sweep &sweep);
+};
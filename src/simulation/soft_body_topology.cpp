@@ -0,0 +1,111 @@
+#include "soft_body_topology.h"
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace {
+// node indices of a triangle, sorted
+struct FaceKey {
+    int n[3];
+    FaceKey(int a, int b, int c) {
+        n[0] = a; n[1] = b; n[2] = c;
+        if (n[0] > n[1]) swap(n[0], n[1]);
+        if (n[1] > n[2]) swap(n[1], n[2]);
+        if (n[0] > n[1]) swap(n[0], n[1]);
+    }
+    bool operator==(const FaceKey &o) const {
+        return n[0] == o.n[0] && n[1] == o.n[1] && n[2] == o.n[2];
+    }
+};
+
+size_t hash_value(const FaceKey &k) {
+    size_t seed = 0;
+    boost::hash_combine(seed, k.n[0]);
+    boost::hash_combine(seed, k.n[1]);
+    boost::hash_combine(seed, k.n[2]);
+    return seed;
+}
+}
+
+void computeNodeFaceMapping(const btSoftBody *psb, const btSoftBody::tFaceArray &faces,
+                            vector<vector<int> > &node2faces, vector<vector<int> > &face2nodes) {
+    node2faces = vector<vector<int> >(psb->m_nodes.size());
+    face2nodes = vector<vector<int> >(faces.size(), vector<int>(3, -1));
+    for (int j = 0; j < faces.size(); ++j) {
+        for (int c = 0; c < 3; ++c) {
+            const int i = nodeIndex(psb, faces[j].m_n[c]);
+            face2nodes[j][c] = i;
+            node2faces[i].push_back(j);
+        }
+    }
+}
+
+void computeLinkNodeMapping(const btSoftBody *psb, vector<vector<int> > &link2nodes) {
+    const btSoftBody::tLinkArray &links = psb->m_links;
+    link2nodes = vector<vector<int> >(links.size(), vector<int>(2, -1));
+    for (int l = 0; l < links.size(); ++l)
+        for (int c = 0; c < 2; ++c)
+            link2nodes[l][c] = nodeIndex(psb, links[l].m_n[c]);
+}
+
+void computeTetraFaces(const btSoftBody *psb, btSoftBody::tFaceArray &faces,
+                       vector<vector<int> > &face2tetras, vector<vector<int> > &tetra2faces) {
+    const btSoftBody::tTetraArray &tetras = psb->m_tetras;
+    faces.resize(0);
+    faces.reserve(2 * tetras.size() + 2);
+    face2tetras.clear();
+    face2tetras.reserve(2 * tetras.size() + 2);
+    tetra2faces = vector<vector<int> >(tetras.size());
+
+    boost::unordered_map<FaceKey, int> faceIndices;
+    faceIndices.rehash(4 * tetras.size());
+    for (int t = 0; t < tetras.size(); ++t) {
+        const btSoftBody::Tetra &tetra = tetras[t];
+        int n[4];
+        for (int d = 0; d < 4; ++d) {
+            assert(tetra.m_n[d] != 0);
+            n[d] = nodeIndex(psb, tetra.m_n[d]);
+        }
+        tetra2faces[t].reserve(4);
+        for (int c = 0; c < 4; ++c) {
+            for (int d = c + 1; d < 4; ++d) {
+                for (int e = d + 1; e < 4; ++e) {
+                    assert(n[c] != n[d] && n[d] != n[e] && n[c] != n[e]);
+                    const int j = faceIndices.insert(make_pair(FaceKey(n[c], n[d], n[e]), (int) faces.size())).first->second;
+                    if (j == faces.size()) {
+                        btSoftBody::Face face;
+                        face.m_n[0] = tetra.m_n[c];
+                        face.m_n[1] = tetra.m_n[d];
+                        face.m_n[2] = tetra.m_n[e];
+                        faces.push_back(face);
+                        face2tetras.push_back(vector<int>());
+                    }
+                    face2tetras[j].push_back(t);
+                    tetra2faces[t].push_back(j);
+                }
+            }
+        }
+    }
+
+    // order the nodes of the surface faces so that they are counterclockwise when looked at from outside
+    for (int j = 0; j < faces.size(); ++j) {
+        assert(face2tetras[j].size() == 1 || face2tetras[j].size() == 2);
+        if (face2tetras[j].size() != 1) continue;
+        btSoftBody::Face &face = faces[j];
+        const btSoftBody::Tetra &tetra = tetras[face2tetras[j][0]];
+        const btSoftBody::Node *other = NULL;
+        for (int d = 0; d < 4 && !other; ++d)
+            if (tetra.m_n[d] != face.m_n[0] && tetra.m_n[d] != face.m_n[1] && tetra.m_n[d] != face.m_n[2])
+                other = tetra.m_n[d];
+        assert(other != NULL);
+
+        // the normal should point away from the other node
+        const btVector3 normal = (face.m_n[1]->m_x - face.m_n[0]->m_x).cross(face.m_n[2]->m_x - face.m_n[0]->m_x);
+        const btVector3 center3 = face.m_n[0]->m_x + face.m_n[1]->m_x + face.m_n[2]->m_x;
+        if (normal.dot(3 * other->m_x - center3) > 0)
+            swap(face.m_n[0], face.m_n[1]);
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <BulletSoftBody/btSoftBody.h>
+#include <vector>
+
+// Index tables relating the nodes, links, faces and tetrahedra of a btSoftBody,
+// built in time linear in the size of the mesh: node pointers are turned into
+// indices by pointer arithmetic on m_nodes, and the faces shared between
+// tetrahedra are matched in a hash table keyed by their sorted node indices.
+
+// index in psb->m_nodes of a node of psb
+inline int nodeIndex(const btSoftBody *psb, const btSoftBody::Node *n) {
+    return int(n - &psb->m_nodes[0]);
+}
+
+// face2nodes[j][c] is the index of faces[j].m_n[c] and node2faces[i] lists
+// the faces using node i in ascending order. The faces are made of nodes of psb.
+void computeNodeFaceMapping(const btSoftBody *psb, const btSoftBody::tFaceArray &faces,
+                            std::vector<std::vector<int> > &node2faces,
+                            std::vector<std::vector<int> > &face2nodes);
+
+// link2nodes[l][c] is the index of psb->m_links[l].m_n[c]
+void computeLinkNodeMapping(const btSoftBody *psb, std::vector<std::vector<int> > &link2nodes);
+
+// Sets faces to the distinct triangles of the tetrahedra of psb, in order of
+// first appearance, with face2tetras[j] the (one or two) tetrahedra sharing
+// face j and tetra2faces[t] the four faces of tetrahedron t. The surface faces
+// (those of a single tetrahedron) are ordered counterclockwise seen from outside.
+void computeTetraFaces(const btSoftBody *psb, btSoftBody::tFaceArray &faces,
+                       std::vector<std::vector<int> > &face2tetras,
+                       std::vector<std::vector<int> > &tetra2faces);
@@ -16,6 +16,7 @@
 #include "clouds/utils_pcl.h"
 #include <boost/foreach.hpp>
 #include "softBodyHelpers.h"
+#include "soft_body_topology.h"
 #include "tetgen_helpers.h"
 
 using std::isfinite;
@@ -99,158 +100,22 @@ void BulletSoftObject::init() {
 }
 
 void BulletSoftObject::computeNodeFaceMapping() {
-	const btSoftBody::tNodeArray& nodes = softBody->m_nodes;
-	const btSoftBody::tFaceArray& faces = softBody->m_faces;
-
 	// compute faces to nodes indices and vice versa
-	node2faces = vector<vector<int> >(nodes.size());
-	face2nodes = vector<vector<int> >(faces.size(), vector<int>(3,-1));
-	for (int i=0; i<nodes.size(); i++) {
-		int j,c;
-		for(j=0; j<faces.size(); j++) {
-			for(c=0; c<3; c++) {
-				if (&nodes[i] == faces[j].m_n[c]) {
-					node2faces[i].push_back(j);
-					face2nodes[j][c] = i;
-				}
-			}
-		}
-	}
-}
-
-int findNode(btSoftBody::Node* n, btSoftBody::Node* nodes[], int nodes_size) {
-	int i;
-	for (i=0; i<nodes_size; i++)
-		if (n == nodes[i]) break;
-	return i;
-}
-
-bool areFacesEqual(btSoftBody::Face face0, btSoftBody::Face face1) {
-	// assert n0, n1, n2 are all different
-	for (int c=0; c<3; c++)
-		for (int d=c+1; d<3; d++) {
-			assert(face0.m_n[c] != face0.m_n[d]);
-			assert(face1.m_n[c] != face1.m_n[d]);
-		}
-
-	for (int c=0; c<3; c++)
-		if (findNode(face0.m_n[c], face1.m_n, 3) == 3) return false;
-	return true;
-}
-
-void reverseNodesOrder(btSoftBody::Face& face) {
-	btSoftBody::Node* tmp = face.m_n[0];
-	face.m_n[0] = face.m_n[1];
-	face.m_n[1] = tmp;
+	::computeNodeFaceMapping(softBody.get(), softBody->m_faces, node2faces, face2nodes);
 }
 
 void BulletSoftObject::computeNodeFaceTetraMapping() {
-	btSoftBody::tNodeArray& nodes = softBody->m_nodes;
-
-//	std::map<btSoftBody::Node*, int> node2ind;
-//	for (int i=0; i < nodes.size(); ++i) {
-//		node2ind[&nodes[i]]=i;
-//	}
-
-	// faces_internal initially empty
 	tetras_internal.resize(softBody->m_tetras.size());
-
-	for (int t=0; t<softBody->m_tetras.size(); t++) {
-		for (int d=0; d<4; d++)
-			assert(softBody->m_tetras[t].m_n[d]!=0);
-	}
-
-	// compute tetras to faces indices and vice versa
-	face2tetras = vector<vector <int> >(0);
-	tetra2faces = vector<vector<int> >(tetras_internal.size());
-	for (int t=0; t<softBody->m_tetras.size(); t++) {
+	for (int t=0; t<softBody->m_tetras.size(); t++)
 		for (int d=0; d<4; d++)
 			tetras_internal[t].m_n[d] = softBody->m_tetras[t].m_n[d];
 
-		for (int c=0; c<4; c++) {
-			for (int d=c+1; d<4; d++) {
-				for (int e=d+1; e<4; e++) {
-					btSoftBody::Face face;
-					face.m_n[0] = tetras_internal[t].m_n[c];
-					face.m_n[1] = tetras_internal[t].m_n[d];
-					face.m_n[2] = tetras_internal[t].m_n[e];
-					int j;
-					for (j=0; j<faces_internal.size(); j++) {
-						if (areFacesEqual(face, faces_internal[j])) break;
-					}
-					if (j==faces_internal.size()) {
-						faces_internal.push_back(face);
-						face2tetras.push_back(vector<int>(0));
-					}
-
-					face2tetras[j].push_back(t);
-//					if (face2tetras[j].size() > 2) {
-//						printf("bad face found (%i)\n", j);
-//						for (int k=0; k < face2tetras[j].size(); ++k) {
-//							int tt = face2tetras[j][k];
-//							int t0, t1, t2, t3, f0, f1, f2;
-//							t0 = node2ind[softBody->m_tetras[tt].m_n[0]];
-//							t1 = node2ind[softBody->m_tetras[tt].m_n[1]];
-//							t2 = node2ind[softBody->m_tetras[tt].m_n[2]];
-//							t3 = node2ind[softBody->m_tetras[tt].m_n[3]];
-//							f0 = node2ind[faces_internal[j].m_n[0]];
-//							f1 = node2ind[faces_internal[j].m_n[1]];
-//							f2 = node2ind[faces_internal[j].m_n[2]];
-//							printf("tetra %i: %i %i %i %i. face: %i %i %i\n", k, t0, t1, t2, t3, f0, f1, f2);
-//						}
-//					}
-					tetra2faces[t].push_back(j);
-				}
-			}
-		}
-	}
-
-	//order the nodes of the surface faces so that their nodes are in counterclockwise order when looked from outside
-	for (int j=0; j<faces_internal.size(); j++) {
-		if (face2tetras[j].size() == 1) {
-			btSoftBody::Node* other_node = NULL;
-			btSoftBody::Face& face = faces_internal[j];
-			btSoftBody::Tetra& tetra = softBody->m_tetras[face2tetras[j][0]];
-			for (int tj=0; tj<4; tj++) {
-				if (findNode(tetra.m_n[tj], face.m_n, 3) == 3) {
-					other_node = tetra.m_n[tj];
-					break;
-				}
-			}
-			assert(other_node != NULL);
-
-			// normal direction should be on the other side of the other node direction
-			btVector3 normal = (face.m_n[1]->m_x - face.m_n[0]->m_x).cross(face.m_n[2]->m_x - face.m_n[0]->m_x);
-			btVector3 center3 = (face.m_n[0]->m_x + face.m_n[1]->m_x + face.m_n[2]->m_x);
-			btVector3 other_node_dir = 3*other_node->m_x - center3;
-			if (normal.dot(other_node_dir) > 0)
-				reverseNodesOrder(face);
-		}
-	}
-
-	assert(face2tetras.size() == faces_internal.size());
-	assert(tetra2faces.size() == tetras_internal.size());
-	for (int t=0; t<tetra2faces.size(); t++) {
-		assert(tetra2faces[t].size() == 4);
-	}
-	for (int j=0; j<face2tetras.size(); j++) {
-		assert(face2tetras[j].size()==1 || face2tetras[j].size()==2);
-	}
+	// compute tetras to faces indices and vice versa; the surface faces are ordered
+	// counterclockwise when looked from outside
+	computeTetraFaces(softBody.get(), faces_internal, face2tetras, tetra2faces);
 
 	// compute faces to nodes indices and vice versa
-	node2faces = vector<vector<int> >(nodes.size());
-	face2nodes = vector<vector<int> >(faces_internal.size(), vector<int>(3,-1));
-	for (int i=0; i<nodes.size(); i++) {
-		int j,c;
-		for(j=0; j<faces_internal.size(); j++) {
-			for(c=0; c<3; c++) {
-				if (&nodes[i] == faces_internal[j].m_n[c]) {
-					node2faces[i].push_back(j);
-					face2nodes[j][c] = i;
-				}
-			}
-		}
-	}
+	::computeNodeFaceMapping(softBody.get(), faces_internal, node2faces, face2nodes);
 }
 
 void BulletSoftObject::computeBoundaries() {
@@ -396,20 +261,27 @@ void BulletSoftObject::adjustTransparency(float increment) {
 		setColorAfterInit();
 }
 
-int BulletSoftObject::getIndex(const btTransform& transform) {
-	const btVector3 pos = transform.getOrigin();
+void BulletSoftObject::updateFaceGrid() {
+	if (!faceGridStale && faceGrid.size() == softBody->m_faces.size()) return;
 	const btSoftBody::tFaceArray& faces = softBody->m_faces;
-	int j_nearest = -1;
-	float nearest_length2 = DBL_MAX;
-	for (int j=0; j<faces.size(); j++) {
-		const btVector3 center = (faces[j].m_n[0]->m_x + faces[j].m_n[1]->m_x + faces[j].m_n[2]->m_x)/3.0;
-		const float length2 = (pos-center).length2();
-		if (length2 < nearest_length2) {
-			j_nearest = j;
-			nearest_length2 = length2;
-		}
-	}
-	return j_nearest;
+	vector<btVector3> centers(faces.size());
+	for (int j=0; j<faces.size(); j++)
+		centers[j] = (faces[j].m_n[0]->m_x + faces[j].m_n[1]->m_x + faces[j].m_n[2]->m_x)/3.0;
+	faceGrid.build(centers);
+	faceGridStale = false;
+}
+
+int BulletSoftObject::getIndex(const btTransform& transform) {
+	updateFaceGrid();
+	return faceGrid.nearest(transform.getOrigin());
+}
+
+vector<int> BulletSoftObject::getIndices(const vector<btTransform>& transforms) {
+	updateFaceGrid();
+	vector<int> indices(transforms.size());
+	for (int k=0; k<transforms.size(); k++)
+		indices[k] = faceGrid.nearest(transforms[k].getOrigin());
+	return indices;
 }
 
 int BulletSoftObject::getIndexSize() {
@@ -451,6 +323,10 @@ vector<btVector3> BulletSoftObject::getIntersectionPoints(const btVector3& start
 	return inter_points;
 }
 
+void BulletSoftObject::prePhysics() {
+	faceGridStale = true;
+}
+
 void BulletSoftObject::preDraw() {
 	transform->setMatrix(osgbCollision::asOsgMatrix(softBody->getWorldTransform()));
 
@@ -3,6 +3,7 @@
 
 #include "environment.h"
 #include "basicobjects.h"
+#include "point_grid.h"
 #include "utils/config.h"
 
 class BulletSoftObject : public EnvironmentObject {
@@ -47,7 +48,7 @@ public:
     boost::shared_ptr<btSoftBody> softBody;
 
     // constructors/destructors
-    BulletSoftObject(boost::shared_ptr<btSoftBody> softBody_) : softBody(softBody_), nextAnchorHandle(0)
+    BulletSoftObject(boost::shared_ptr<btSoftBody> softBody_) : softBody(softBody_), nextAnchorHandle(0), faceGridStale(true)
     {
     	if (softBody->m_tetras.size() == 0)	computeNodeFaceMapping();
     	else {
@@ -55,7 +56,7 @@ public:
     		computeBoundaries();
     	}
     }
-    BulletSoftObject(btSoftBody *softBody_) : softBody(softBody_), nextAnchorHandle(0)
+    BulletSoftObject(btSoftBody *softBody_) : softBody(softBody_), nextAnchorHandle(0), faceGridStale(true)
     {
 			if (softBody->m_tetras.size() == 0)	computeNodeFaceMapping();
 			else {
@@ -84,9 +85,15 @@ public:
   void adjustTransparency(float increment);
 
 		// for softbody transforms. look at EnvironmentObject for precise definition.
+  // the nearest face is found with a grid over the face centroids, which is
+  // rebuilt on the first query after each step
   int getIndex(const btTransform& transform);
+  vector<int> getIndices(const vector<btTransform>& transforms);
   int getIndexSize();
   btTransform getIndexTransform(int index);
+  // to be called after moving the nodes outside of a step
+  // (Environment::restoreState does it through postRestoreState)
+  void invalidateFaceGrid() { faceGridStale = true; }
 
   bool checkIntersection(const btVector3& start, const btVector3& end);
   vector<btVector3> getIntersectionPoints(const btVector3& start, const btVector3& end);
@@ -104,8 +111,10 @@ public:
 
     // called by Environment
     void init();
+    void prePhysics();
     void preDraw();
     void destroy();
+    void postRestoreState() { invalidateFaceGrid(); }
 
     osg::Node *getOSGNode() const { return transform.get(); }
 
@@ -124,6 +133,9 @@ private:
 		void setTextureAfterInit();
     AnchorHandle nextAnchorHandle;
     map<AnchorHandle, int> anchormap;
+    PointGrid faceGrid;
+    bool faceGridStale;
+    void updateFaceGrid();
 public:
 		cv::Mat getTexture() {
 		  if(m_cvimage) return *m_cvimage;
@@ -0,0 +1,41 @@
+import openravepy as rave
+import numpy as np
+import bulletsimpy
+
+# RayTestBatch has to report OpenRAVE link indices, also for bodies with links
+# that have no geometry (the PR2 has several), and agree with RayTest
+
+env = rave.Environment()
+env.Load('robots/pr2-beta-static.zae')
+robot = env.GetRobots()[0]
+links = robot.GetLinks()
+print 'links without geometry:', [l.GetName() for l in links if not l.GetGeometries()]
+assert any(not l.GetGeometries() for l in links)
+
+bullet_env = bulletsimpy.BulletEnvironment(env, [])
+bullet_robot = bullet_env.GetObjectByName(robot.GetName())
+
+# rays from outside the robot towards the center of each link that has geometry
+rayFroms, rayTos = [], []
+for l in links:
+  if not l.GetGeometries(): continue
+  center = l.ComputeAABB().pos()
+  for d in [[1, 0, 0], [-1, 0, 0], [0, 1, 0], [0, -1, 0], [0, 0, 1]]:
+    rayFroms.append(center + 3*np.array(d, dtype=float))
+    rayTos.append(center)
+rayFroms, rayTos = np.array(rayFroms), np.array(rayTos)
+
+batch = bullet_env.RayTestBatch(rayFroms, rayTos, bullet_robot)
+numHits = 0
+for i in range(len(rayFroms)):
+  hits = bullet_env.RayTest(rayFroms[i:i+1], rayTos[i:i+1], bullet_robot)
+  if not hits:
+    assert batch['linkIndices'][i] == -1
+    continue
+  numHits += 1
+  # the last hit RayTest reports is the closest one
+  expected = hits[len(hits)-1].link.GetIndex()
+  assert batch['linkIndices'][i] == expected, (i, batch['linkIndices'][i], expected)
+  assert links[batch['linkIndices'][i]].GetGeometries()
+  assert np.allclose(batch['pt'][i], hits[len(hits)-1].pt, atol=1e-4)
+print 'checked', len(rayFroms), 'rays,', numHits, 'hits'
@@ -0,0 +1,112 @@
+// Check for PointGrid::nearest against a linear scan over the points.
+// Runs random, coplanar, collinear, duplicate and clustered point sets with
+// queries inside, on and far outside the points, and fails on any mismatch.
+// usage: test_point_grid [numQueries per set] [seed]
+#include "point_grid.h"
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+static btScalar uniform(btScalar lo, btScalar hi) {
+    return lo + (hi - lo) * (rand() / (btScalar) RAND_MAX);
+}
+
+static btVector3 randomPoint(btScalar lo, btScalar hi) {
+    return btVector3(uniform(lo, hi), uniform(lo, hi), uniform(lo, hi));
+}
+
+// the lowest index among the closest points, as promised by PointGrid::nearest
+static int linearNearest(const std::vector<btVector3> &points, const btVector3 &p) {
+    int best = -1;
+    btScalar bestDist2 = std::numeric_limits<btScalar>::max();
+    for (int i = 0; i < points.size(); ++i) {
+        const btScalar d2 = p.distance2(points[i]);
+        if (d2 < bestDist2) {
+            bestDist2 = d2;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static bool check(const std::string &name, const std::vector<btVector3> &points, int numQueries) {
+    PointGrid grid;
+    grid.build(points);
+    std::vector<btVector3> queries(points);
+    for (int q = 0; q < numQueries; ++q)
+        queries.push_back(randomPoint(-2, 2));
+    for (int q = 0; q < numQueries / 10; ++q)
+        queries.push_back(randomPoint(-1000, 1000));
+
+    int numMismatches = 0;
+    for (int q = 0; q < queries.size(); ++q) {
+        const int expected = linearNearest(points, queries[q]), got = grid.nearest(queries[q]);
+        if (got != expected) {
+            if (numMismatches < 5)
+                printf("  query (%g %g %g): nearest %d, expected %d\n",
+                       queries[q].x(), queries[q].y(), queries[q].z(), got, expected);
+            ++numMismatches;
+        }
+    }
+    printf("%-12s %6d points, %6d queries: %s\n", name.c_str(), (int) points.size(), (int) queries.size(),
+           numMismatches ? "MISMATCH" : "ok");
+    return numMismatches == 0;
+}
+
+int main(int argc, char *argv[]) {
+    const int numQueries = argc > 1 ? atoi(argv[1]) : 2000;
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+
+    bool ok = true;
+    std::vector<btVector3> points;
+
+    ok = check("empty", points, numQueries) && ok;
+
+    points.assign(1, btVector3(.3, -.2, .1));
+    ok = check("single", points, numQueries) && ok;
+
+    points.clear();
+    for (int i = 0; i < 5000; ++i)
+        points.push_back(randomPoint(-1, 1));
+    ok = check("random", points, numQueries) && ok;
+
+    // a cloth lying flat
+    points.clear();
+    for (int i = 0; i < 5000; ++i)
+        points.push_back(btVector3(uniform(-1, 1), uniform(-.5, .5), .25));
+    ok = check("coplanar", points, numQueries) && ok;
+
+    points.clear();
+    for (int i = 0; i < 1000; ++i)
+        points.push_back(btVector3(-1, 1, 0) + uniform(0, 1) * btVector3(2, -1, .5));
+    ok = check("collinear", points, numQueries) && ok;
+
+    points.assign(100, btVector3(.5, .5, .5));
+    ok = check("coincident", points, numQueries) && ok;
+
+    // every point several times, on a lattice where many queries are equally
+    // far from several points
+    points.clear();
+    for (int i = 0; i < 3000; ++i) {
+        const btVector3 p = randomPoint(-1, 1);
+        points.push_back(btVector3(btScalar(int(p.x() * 4)) / 4, btScalar(int(p.y() * 4)) / 4, btScalar(int(p.z() * 4)) / 4));
+    }
+    ok = check("duplicates", points, numQueries) && ok;
+
+    // dense clusters far apart, so most cells are empty
+    points.clear();
+    for (int i = 0; i < 2000; ++i)
+        points.push_back((i % 2 ? btVector3(-50, -50, -50) : btVector3(50, 50, 50)) + randomPoint(-.01, .01));
+    points.push_back(btVector3(0, 0, 0));
+    ok = check("clustered", points, numQueries) && ok;
+
+    // a mostly flat set with one point off the plane
+    points.clear();
+    for (int i = 0; i < 2000; ++i)
+        points.push_back(btVector3(uniform(-1, 1), uniform(-1, 1), 0));
+    points.push_back(btVector3(0, 0, 1e-4));
+    ok = check("almost flat", points, numQueries) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// Check for Environment::saveState/restoreState.
+// A stack of boxes is pushed by a kinematic box next to a cloth patch. The state
+// is saved, a few steps are taken, the state is restored and the same steps are
+// replayed; the replay has to reproduce the poses and nodes exactly. A restore
+// after the cloth gained a node has to be refused without touching the world.
+// usage: test_state_replay [numBoxes]
+#include "environment.h"
+#include "basicobjects.h"
+#include <BulletSoftBody/btSoftBodyHelpers.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+struct Snapshot {
+    std::vector<btTransform> poses;
+    std::vector<btVector3> nodes;
+};
+
+static void snapshot(const std::vector<BoxObject::Ptr> &boxes, const btSoftBody *cloth, Snapshot &out) {
+    out.poses.resize(boxes.size());
+    for (int i = 0; i < boxes.size(); ++i)
+        out.poses[i] = boxes[i]->rigidBody->getCenterOfMassTransform();
+    out.nodes.resize(cloth->m_nodes.size());
+    for (int i = 0; i < cloth->m_nodes.size(); ++i)
+        out.nodes[i] = cloth->m_nodes[i].m_x;
+}
+
+static bool sameTransform(const btTransform &a, const btTransform &b) {
+    return memcmp(&a, &b, sizeof(btTransform)) == 0;
+}
+
+static bool same(const Snapshot &a, const Snapshot &b) {
+    if (a.poses.size() != b.poses.size() || a.nodes.size() != b.nodes.size()) return false;
+    for (int i = 0; i < a.poses.size(); ++i)
+        if (!sameTransform(a.poses[i], b.poses[i])) return false;
+    for (int i = 0; i < a.nodes.size(); ++i)
+        if (a.nodes[i] != b.nodes[i]) return false;
+    return true;
+}
+
+static void step(Environment &env, BoxObject::Ptr pusher, int numSteps) {
+    for (int i = 0; i < numSteps; ++i) {
+        btTransform t = pusher->rigidBody->getCenterOfMassTransform();
+        t.setOrigin(t.getOrigin() + btVector3(.01, 0, 0));
+        pusher->motionState->setKinematicPos(t);
+        env.step(1/60., 1, 1/60.);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int numBoxes = argc > 1 ? atoi(argv[1]) : 60;
+
+    Environment env(BulletInstance::Ptr(new BulletInstance));
+    env.bullet->setGravity(btVector3(0, 0, -9.8));
+    BoxObject::Ptr ground(new BoxObject(0, btVector3(10, 10, .5), btTransform(btQuaternion::getIdentity(), btVector3(0, 0, -.5))));
+    env.add(ground);
+    std::vector<BoxObject::Ptr> boxes;
+    for (int i = 0; i < numBoxes; ++i) {
+        btVector3 pos(.5 * (i % 4), .5 * ((i / 4) % 4), .1 + .21 * (i / 16));
+        boxes.push_back(BoxObject::Ptr(new BoxObject(1, btVector3(.1, .1, .1), btTransform(btQuaternion::getIdentity(), pos))));
+        env.add(boxes.back());
+    }
+    BoxObject::Ptr pusher(new BoxObject(0, btVector3(.1, 1, .3), btTransform(btQuaternion::getIdentity(), btVector3(-.5, .75, .3))));
+    pusher->setKinematic(true);
+    env.add(pusher);
+    btSoftBody *cloth = btSoftBodyHelpers::CreatePatch(*env.bullet->softBodyWorldInfo,
+        btVector3(3, -1, 1), btVector3(5, -1, 1), btVector3(3, 1, 1), btVector3(5, 1, 1), 10, 10, 1 + 2, true);
+    cloth->setTotalMass(1);
+    env.bullet->dynamicsWorld->addSoftBody(cloth);
+
+    // let the stack settle into contact, so the manifolds matter
+    step(env, pusher, 30);
+
+    bool ok = true;
+    EnvironmentState state;
+    const int replayLengths[] = { 1, 2, 5 };
+    for (int r = 0; r < sizeof(replayLengths) / sizeof(replayLengths[0]); ++r) {
+        const int n = replayLengths[r];
+        env.saveState(state);
+        const btTransform pusherPose = pusher->rigidBody->getCenterOfMassTransform();
+        Snapshot first, replay;
+        step(env, pusher, n);
+        snapshot(boxes, cloth, first);
+        env.restoreState(state);
+        pusher->motionState->setKinematicPos(pusherPose);
+        step(env, pusher, n);
+        snapshot(boxes, cloth, replay);
+        const bool exact = same(first, replay);
+        printf("replay of %d steps: %s\n", n, exact ? "exact" : "DIFFERS");
+        ok = ok && exact;
+    }
+
+    // a refused restore must not write anything
+    env.saveState(state);
+    step(env, pusher, 3);
+    Snapshot before, after;
+    snapshot(boxes, cloth, before);
+    cloth->appendNode(btVector3(4, 0, 2), 1);
+    bool refused = false;
+    try {
+        env.restoreState(state);
+    } catch (const std::runtime_error &e) {
+        refused = true;
+        printf("restore with an extra node refused: %s\n", e.what());
+    }
+    snapshot(boxes, cloth, after);
+    after.nodes.pop_back();
+    const bool untouched = same(before, after);
+    printf("world after the refused restore: %s\n", untouched ? "untouched" : "MODIFIED");
+    ok = ok && refused && untouched;
+
+    env.bullet->dynamicsWorld->removeSoftBody(cloth);
+    delete cloth;
+    return ok ? 0 : 1;
+}
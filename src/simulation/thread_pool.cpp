@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+#include <boost/bind.hpp>
+#include <stdexcept>
+#include <algorithm>
+
+ThreadPool::ThreadPool(int numThreads) :
+    m_generation(0), m_activeWorkers(0), m_running(false), m_stop(false),
+    m_fn(NULL), m_n(0), m_grainSize(1), m_next(0), m_failed(false) {
+    for (int i = 1; i < numThreads; ++i)
+        m_threads.push_back(new boost::thread(boost::bind(&ThreadPool::workerLoop, this, i)));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (int i = 0; i < m_threads.size(); ++i) {
+        m_threads[i]->join();
+        delete m_threads[i];
+    }
+}
+
+bool ThreadPool::claim(int &begin, int &end) {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_next >= m_n) return false;
+    begin = m_next;
+    end = std::min(m_n, m_next + m_grainSize);
+    m_next = end;
+    return true;
+}
+
+void ThreadPool::runItems(int threadIndex) {
+    int begin, end;
+    while (claim(begin, end)) {
+        for (int i = begin; i < end; ++i) {
+            try {
+                (*m_fn)(i, threadIndex);
+            } catch (const std::exception &e) {
+                boost::mutex::scoped_lock lock(m_mutex);
+                if (!m_failed) { m_failed = true; m_error = e.what(); }
+            } catch (...) {
+                boost::mutex::scoped_lock lock(m_mutex);
+                if (!m_failed) { m_failed = true; m_error = "unknown exception in ThreadPool::parallelFor"; }
+            }
+        }
+    }
+}
+
+void ThreadPool::workerLoop(int threadIndex) {
+    unsigned seen = 0;
+    while (true) {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while (m_generation == seen && !m_stop)
+                m_wake.wait(lock);
+            if (m_stop) return;
+            seen = m_generation;
+        }
+        runItems(threadIndex);
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (--m_activeWorkers == 0)
+                m_done.notify_all();
+        }
+    }
+}
+
+// must be called with m_mutex held
+int ThreadPool::currentThreadIndex() const {
+    boost::thread::id self = boost::this_thread::get_id();
+    if (m_running && self == m_callerId) return 0;
+    for (int i = 0; i < m_threads.size(); ++i)
+        if (m_threads[i]->get_id() == self) return i + 1;
+    return -1;
+}
+
+void ThreadPool::parallelFor(int n, const ForBody &fn, int grainSize) {
+    if (n <= 0) return;
+    int serialIndex = -1;
+    if (m_threads.empty())
+        serialIndex = 0;
+    else {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if (m_running)
+            serialIndex = currentThreadIndex();
+        if (serialIndex < 0) {
+            while (m_running)
+                m_done.wait(lock);
+            m_running = true;
+            m_callerId = boost::this_thread::get_id();
+            m_fn = &fn;
+            m_n = n;
+            m_grainSize = std::max(1, grainSize);
+            m_next = 0;
+            m_failed = false;
+            m_error.clear();
+            m_activeWorkers = m_threads.size();
+            ++m_generation;
+        }
+    }
+    if (serialIndex >= 0) {
+        for (int i = 0; i < n; ++i)
+            fn(i, serialIndex);
+        return;
+    }
+
+    m_wake.notify_all();
+    runItems(0);
+
+    std::string error;
+    bool failed;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (m_activeWorkers > 0)
+            m_done.wait(lock);
+        m_running = false;
+        m_callerId = boost::thread::id();
+        m_fn = NULL;
+        failed = m_failed;
+        error = m_error;
+    }
+    m_done.notify_all();
+    if (failed)
+        throw std::runtime_error(error);
+}
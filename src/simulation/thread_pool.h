@@ -0,0 +1,56 @@
+#pragma once
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <string>
+#include <vector>
+
+// Fixed-size pool of worker threads for data-parallel loops.
+// The calling thread takes part in every parallelFor, so a pool of size n
+// runs n-1 background threads. Work items are claimed in chunks from a
+// shared counter, so threads that finish early keep pulling work from the
+// ones that are still busy.
+class ThreadPool {
+public:
+    typedef boost::shared_ptr<ThreadPool> Ptr;
+    // fn(item, threadIndex); threadIndex is in [0, size()) and can be used
+    // to index per-thread scratch data
+    typedef boost::function<void (int, int)> ForBody;
+
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    int size() const { return (int) m_threads.size() + 1; }
+
+    // Calls fn(i, threadIndex) for every i in [0, n) and blocks until all
+    // calls have returned. Items are handed out grainSize at a time.
+    // A nested call from inside a running loop is executed serially on
+    // the calling thread; a call from an unrelated thread waits for the
+    // running loop to finish.
+    // If fn throws, the first exception's message is rethrown as a
+    // std::runtime_error once the loop has finished.
+    void parallelFor(int n, const ForBody &fn, int grainSize=1);
+
+private:
+    std::vector<boost::thread *> m_threads;
+    boost::thread::id m_callerId; // thread index 0 of the running loop
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_wake, m_done;
+    unsigned m_generation;
+    int m_activeWorkers;
+    bool m_running, m_stop;
+
+    // current loop
+    const ForBody *m_fn;
+    int m_n, m_grainSize, m_next;
+    bool m_failed;
+    std::string m_error;
+
+    int currentThreadIndex() const;
+    void workerLoop(int threadIndex);
+    void runItems(int threadIndex);
+    bool claim(int &begin, int &end);
+};